@@ -0,0 +1,10 @@
+#version 330 core
+
+out vec4 color;
+
+// Values that stay constant for all tracers.
+uniform vec4 tracerColor;
+
+void main(){
+    color = tracerColor;
+}
\ No newline at end of file
@@ -0,0 +1,8 @@
+#version 330 core
+
+// Position normalized to the simulation grid.
+layout(location = 0) in vec2 vertexPosition;
+
+void main(){
+  gl_Position = vec4(vertexPosition * 2.0 - 1.0, 0.0, 1.0);
+}
\ No newline at end of file
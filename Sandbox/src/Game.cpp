@@ -1,54 +1,186 @@
 #include "stdfax.h"
 #include <glm/gtx/compatibility.hpp>
 #include "Game.h"
-
-#define DX	(1.0f / 32.0f)
-#define RDX (1.0f / DX)
-#define HALFDX (0.5f * DX)
-#define VISCOSITY 1.0f
-#define TIMESTEP 0.05f		// 20 simulation steps per "unit" time-measure at least.
+#include "Simulation/WorkerPool.h"
+#include "Simulation/Constants.h"
+#include "Simulation/Stencil.h"
+#include "Simulation/Reduction.h"
+#include "Simulation/Hash.h"
 
 #define EPSILON 1e-4f
-#define NUM_THREADS 12
+#define STROKE_GAP 0.1		// Cursor samples further apart in seconds are not connected into a stroke.
+#define TILE_ROWS 32		// Rows per task of the dataflow step graph.
+#define CORRECTION_SWEEPS 2	// Full-resolution sweeps after prolongating a coarse pressure solution.
+#define ACTIVITY_INTERVAL 16	// Frames between measurements of the kinetic energy and the dye.
+#define ACTIVITY_BLOCK 16		// Size of the blocks of cells the dye change is measured over.
+#define SETTLED_ENERGY 1e-6f	// Largest kinetic energy of a cell of a settled fluid.
+#define SETTLED_DYE 1e-3f		// Largest total dye change between measurements of a settled fluid.
+#define SETTLED_MEASUREMENTS 2	// Consecutive settled measurements before the simulation is skipped.
+#define SCHWARZ_OVERLAP 4		// Rows a Schwarz tile overlaps each neighbouring tile.
+#define SCHWARZ_SWEEPS 8		// Local sweeps per Schwarz iteration, the sweeps an iteration replaces.
+#define SCHWARZ_CORRECTION_INTERVAL 2	// Schwarz iterations per coarse correction.
+#define SCHWARZ_COARSE_SCALE 8	// Scale of the coarse correction when the projection runs at full resolution.
+#define SCHWARZ_COARSE_SWEEPS 32	// Over-relaxed Gauss-Seidel sweeps of the coarse correction.
+#define SCHWARZ_COARSE_OMEGA 1.8f	// Over-relaxation of the coarse correction.
 
 Game::Game()
 {
-	m_VelocityBuffer = (glm::vec2*)malloc(sizeof(glm::vec2) * WIDTH * HEIGHT);
-	m_VelocityOutput = (glm::vec2*)malloc(sizeof(glm::vec2) * WIDTH * HEIGHT);
-	m_PressureBuffer = (float*)malloc(sizeof(float) * WIDTH * HEIGHT);
-	m_PressureOutput = (float*)malloc(sizeof(float) * WIDTH * HEIGHT);
-	m_ColorBuffer = (glm::vec4*)malloc(sizeof(glm::vec4) * WIDTH * HEIGHT);
-	m_ColorOutput = (glm::vec4*)malloc(sizeof(glm::vec4) * WIDTH * HEIGHT);
-	m_DivergenceBuffer = (float*)malloc(sizeof(float) * WIDTH * HEIGHT);
-
-	InitSimulation();
+	Resize(WIDTH, HEIGHT);
 }
 
 Game::~Game()
 {
-	free(m_VelocityBuffer);
-	free(m_VelocityOutput);
-	free(m_PressureBuffer);
-	free(m_PressureOutput);
-	free(m_ColorBuffer);
-	free(m_ColorOutput);
-	free(m_DivergenceBuffer);
+	if (m_SolverBuilder.joinable()) m_SolverBuilder.join();
+	delete m_BuiltSolver;
+	delete m_Volume;
+	delete m_Ensemble;
+	delete m_DirectSolver;
+	delete m_Lattice;
+	delete m_Sph;
+	delete m_Flip;
+	delete m_Tracers;
+	delete m_TracerShader;
+	delete m_TracerBuffer;
+	delete m_Obstacles;
+}
+
+void Game::Resize(int width, int height)
+{
+	m_Width = width, m_Height = height;
+
+	ResizeCoarseGrid();
+	AllocateBuffers();
+	InitSimulation();
+	UpdateDirectSolver();
+	BuildStepGraph();
+
+	// The engines that outgrow the fields are switched off on large grids.
+	const bool engines = GridScale() <= MAX_ENGINE_GRID_SCALE;
+	if (!engines) m_LatticeEngine = m_FlipEngine = false;
+	if (m_Lattice) {
+		delete m_Lattice;
+		m_Lattice = engines ? new LatticeSolver(width, height) : nullptr;
+	}
+	if (m_Sph) {
+		delete m_Sph;
+		m_Sph = new SphSolver(width, height, SPH_PARTICLES);
+	}
+	if (m_Flip) {
+		ParticleTransfer transfer = m_Flip->GetTransfer();
+		delete m_Flip;
+		m_Flip = nullptr;
+		if (engines) {
+			m_Flip = new FlipSolver(width, height);
+			m_Flip->SetTransfer(transfer);
+		}
+	}
+	if (m_Tracers) {
+		delete m_Tracers;
+		m_Tracers = new TracerSystem(width, height, TRACER_COUNT);
+	}
+	if (m_Obstacles) CreateObstacles();
 }
 
 void Game::Tick(float dt)
 {
 	HandleInput(dt);
+	AdoptDirectSolver();
+	Step(dt);
+}
 
-	// Clamp the timestep to a maximum of TIMESTEP.
-	dt = glm::min(dt, TIMESTEP);
-	SimulateTimeStep(dt);
+void Game::Step(float dt)
+{
+	if (!m_Impulses.Empty() || !m_IdleWhenSettled) WakeUp();
+	if (m_Quiescent) return;
+
+	// Clamp the timestep to a maximum of TIMESTEP. Frame times differ between runs, the deterministic mode takes
+	// fixed steps instead.
+	dt = m_Deterministic ? TIMESTEP : glm::min(dt, TIMESTEP);
+
+	if (!m_SkipTiles.empty() && !UsesColdTiles()) ReleaseColdTiles();
+	if (UsesObstacles()) MoveObstacles(dt);
+
+	if (m_VolumePreview) {
+		// Keep a plume of smoke rising from the bottom of the volume.
+		const float size = (float)VOLUME_PREVIEW_SIZE;
+		m_Volume->AddSource(glm::vec3(0.5f * size, 0.1f * size, 0.5f * size), 0.06f * size, glm::vec3(0.0f, 2.0f, 0.0f), 1.0f);
+		m_Volume->Step(dt);
+		m_Impulses.Clear();
+	}
+	else if (m_EnsemblePreview) SimulateEnsembleStep(dt);
+	else if (m_LatticeEngine) SimulateLatticeStep(dt);
+	else if (m_SphEngine) SimulateSphStep(dt);
+	else if (m_FlipEngine) SimulateFlipStep(dt);
+	else if (m_VorticityEngine) SimulateVorticityStep(dt);
+	else SimulateTimeStep(dt);
+	// Only the streamfunction-vorticity step keeps the carried vorticity in step with the velocity.
+	m_VorticityCarried = m_VorticityEngine && !m_VolumePreview && !m_EnsemblePreview && !m_LatticeEngine && !m_SphEngine && !m_FlipEngine;
+
+	// The SPH liquid, the volume and the ensemble have no velocity grid to trace.
+	if (m_ShowTracers && !m_VolumePreview && !m_EnsemblePreview && !m_SphEngine) SimulateTracers(dt);
+
+	// The volume and the SPH liquid keep moving under their sources and gravity.
+	if (m_IdleWhenSettled && !m_VolumePreview && !m_EnsemblePreview && !m_SphEngine && ++m_FramesSinceMeasurement >= ACTIVITY_INTERVAL) {
+		m_FramesSinceMeasurement = 0;
+		MeasureActivity();
+	}
 
 }
 
 void Game::Draw(float dt)
 {
-	Application::Screen()->PlotPixels((Color*)m_ColorBuffer);
-	Application::Screen()->SyncPixels();
+	Surface* screen = Application::Screen();
+
+	if (m_VolumePreview)
+		m_Volume->ExportSlice(screen, m_VolumeSlice);
+	else if (m_EnsemblePreview)
+		m_Ensemble->ExportSpread(screen);
+	else if (screen->GetWidth() == (uint)m_Width && screen->GetHeight() == (uint)m_Height) {
+		// Skipped tiles did not change since they were last drawn, reading them would thaw them.
+		if (m_SkipTiles.empty()) screen->PlotPixels((Color*)m_ColorBuffer);
+		else for (int y = 0; y < m_Height; y += TILE_ROWS)
+			if (!IsSkipped(y)) screen->PlotPixels((Color*)m_ColorBuffer, 0, y, m_Width, glm::min(TILE_ROWS, m_Height - y));
+	}
+	else {
+		// Nearest-neighbour resample the grid onto the screen.
+		for (uint y = 0; y < screen->GetHeight(); y++)
+			for (uint x = 0; x < screen->GetWidth(); x++) {
+				int gx = (int)((size_t)x * m_Width / screen->GetWidth());
+				int gy = (int)(y * m_Height / screen->GetHeight());
+				if (IsSkipped(gy)) continue;
+				screen->PlotPixel(*(Color*)&m_ColorBuffer[gx + (size_t)gy * m_Width], x, y);
+			}
+	}
+
+	// The obstacles are drawn over the dye, only the rows they cover are scanned.
+	if (UsesObstacles()) {
+		const uchar* solid = m_Obstacles->Solid();
+		const RowRange rows = m_Obstacles->Rows();
+		for (uint y = 0; y < screen->GetHeight(); y++) {
+			int gy = (int)(y * m_Height / screen->GetHeight());
+			if (gy < rows.begin || gy >= rows.end) continue;
+			for (uint x = 0; x < screen->GetWidth(); x++) {
+				int gx = (int)((size_t)x * m_Width / screen->GetWidth());
+				if (solid[gx + (size_t)gy * m_Width]) screen->PlotPixel(Color(0.5f), x, y);
+			}
+		}
+	}
+	screen->SyncPixels();
+}
+
+void Game::DrawOverlay(float dt)
+{
+	if (!m_ShowTracers || m_VolumePreview || m_EnsemblePreview || m_SphEngine) return;
+
+	// Orphan the buffer every frame so the upload does not wait for the previous draw.
+	m_TracerBuffer->Write(sizeof(uint) * m_Tracers->Size(), m_Tracers->Packed(), GL_STREAM_DRAW);
+
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+	m_TracerShader->Activate();
+	m_TracerShader->DrawPoints(m_Tracers->Size());
+	m_TracerShader->Deactivate();
+	glDisable(GL_BLEND);
 }
 
 void Game::RenderGUI(float dt)
@@ -65,340 +197,1628 @@ void Game::RenderGUI(float dt)
 	ImGui::Begin(windowTitle, &display, ImGuiWindowFlags_NoResize | ImGuiWindowFlags_AlwaysAutoResize);
 	ImGui::SetWindowFontScale(1.75f);
 	ImGui::Text("Frame-time: %.1f", dt * 1000.0f);
+	ImGui::Text("Kinetic energy: %.3g, dye change: %.3g%s", m_Activity.energy, m_Activity.dye, m_Quiescent ? " (idle)" : "");
+	ImGui::Checkbox("Idle when settled", &m_IdleWhenSettled);
+	int frameCap = (int)Application::FrameCap();
+	if (ImGui::SliderInt("Frame cap", &frameCap, 0, 240)) Application::SetFrameCap((uint)frameCap);
+	static const char* gridScales[] = { "1x", "2x", "4x", "8x", "16x" };
+	int gridScale = 0;
+	while ((WIDTH << gridScale) < m_Width && (1 << gridScale) < MAX_GRID_SCALE) gridScale++;
+	if (ImGui::Combo("Grid size", &gridScale, gridScales, IM_ARRAYSIZE(gridScales))) Resize(WIDTH << gridScale, HEIGHT << gridScale);
+	ImGui::Checkbox("Dataflow scheduling", &m_Dataflow);
+	if (ImGui::Checkbox("Deterministic", &m_Deterministic))
+		Application::Workers()->SetFloatControl(m_Deterministic ? DETERMINISTIC_FLOAT_CONTROL : 0);
+	if (m_Deterministic) {
+		// Compare against a run with another number of threads, or run the app with --check-determinism.
+		if (ImGui::Button("Hash state")) m_StateHash = StateHash();
+		ImGui::SameLine();
+		ImGui::Text("%016llx", (unsigned long long)m_StateHash);
+	}
+
+	static const char* relaxations[] = { "Jacobi", "Chebyshev", "Additive Schwarz" };
+	int relaxation = (int)m_Relaxation;
+	if (ImGui::Combo("Relaxation", &relaxation, relaxations, IM_ARRAYSIZE(relaxations))) {
+		m_Relaxation = (Relaxation)relaxation;
+		UpdateLayout();
+		BuildStepGraph();
+	}
+	if (ImGui::SliderInt("Sweeps", &m_Sweeps, 1, 32)) BuildStepGraph();
+
+	static const char* scales[] = { "Full", "Half", "Quarter" };
+	int scale = m_ProjectionScale == 4 ? 2 : m_ProjectionScale - 1;
+	if (ImGui::Combo("Projection resolution", &scale, scales, IM_ARRAYSIZE(scales))) {
+		m_ProjectionScale = 1 << scale;
+		ResizeCoarseGrid();
+		UpdateDirectSolver();
+		BuildStepGraph();
+	}
+	if (ImGui::Checkbox("Streaming sweeps", &m_Streaming)) {
+		UpdateLayout();
+		BuildStepGraph();
+	}
+	ImGui::BeginDisabled(GridScale() > MAX_DIRECT_GRID_SCALE);
+	if (ImGui::Checkbox("Direct pressure solve", &m_DirectPressure)) {
+		UpdateDirectSolver();
+		BuildStepGraph();
+	}
+	ImGui::EndDisabled();
+	if (m_SolverBuilder.joinable()) {
+		ImGui::SameLine();
+		ImGui::Text("factorizing...");
+	}
+	ImGui::Checkbox("Compress cold tiles", &m_CompressColdTiles);
+	if (m_CompressColdTiles)
+		ImGui::Text("Frozen tiles: %d / %d, %.1f MB compressed", m_ColdTiles.FrozenTiles(), m_ColdTiles.Tiles(), m_ColdTiles.CompressedBytes() / (1024.0 * 1024.0));
+	ImGui::BeginDisabled(GridScale() > MAX_ENGINE_GRID_SCALE);
+	if (ImGui::Checkbox("Lattice Boltzmann", &m_LatticeEngine) && m_LatticeEngine && !m_Lattice)
+		m_Lattice = new LatticeSolver(m_Width, m_Height);
+	ImGui::EndDisabled();
+	if (m_LatticeEngine) ImGui::SliderInt("Lattice substeps", &m_LatticeSubsteps, 1, 64);
+	if (ImGui::Checkbox("SPH particles", &m_SphEngine) && m_SphEngine && !m_Sph)
+		m_Sph = new SphSolver(m_Width, m_Height, SPH_PARTICLES);
+	if (m_SphEngine) ImGui::SliderInt("SPH substeps", &m_SphSubsteps, 1, 16);
+	ImGui::BeginDisabled(GridScale() > MAX_ENGINE_GRID_SCALE);
+	if (ImGui::Checkbox("FLIP particles", &m_FlipEngine) && m_FlipEngine && !m_Flip)
+		m_Flip = new FlipSolver(m_Width, m_Height);
+	ImGui::EndDisabled();
+	if (m_FlipEngine) {
+		static const char* transfers[] = { "FLIP", "APIC" };
+		int transfer = (int)m_Flip->GetTransfer();
+		if (ImGui::Combo("Transfer", &transfer, transfers, IM_ARRAYSIZE(transfers))) m_Flip->SetTransfer((ParticleTransfer)transfer);
+	}
+	ImGui::Checkbox("Streamfunction-vorticity", &m_VorticityEngine);
+	if (ImGui::Checkbox("Moving obstacles", &m_MovingObstacles) && m_MovingObstacles && !m_Obstacles) CreateObstacles();
+	if (ImGui::Checkbox("Tracers", &m_ShowTracers) && m_ShowTracers && !m_Tracers) {
+		m_Tracers = new TracerSystem(m_Width, m_Height, TRACER_COUNT);
+		m_TracerShader = new GLshader("tracer.vert", "tracer.frag");
+		m_TracerBuffer = new GLbuffer(GL_ARRAY_BUFFER, sizeof(uint) * m_Tracers->Size());
+		m_TracerShader->SetBufferUshort2Normalized(m_TracerBuffer, 0);
+		m_TracerShader->SetUniformVec4("tracerColor", glm::vec4(1.0f, 0.8f, 0.4f, 0.15f));
+	}
+	if (ImGui::Checkbox("Volume preview", &m_VolumePreview) && m_VolumePreview && !m_Volume)
+		m_Volume = new VolumeSolver(VOLUME_PREVIEW_SIZE, VOLUME_PREVIEW_SIZE, VOLUME_PREVIEW_SIZE);
+	if (m_VolumePreview) ImGui::SliderInt("Slice", &m_VolumeSlice, 0, VOLUME_PREVIEW_SIZE - 1);
+	if (ImGui::Checkbox("Ensemble preview", &m_EnsemblePreview) && m_EnsemblePreview && !m_Ensemble) CreateEnsemble();
+	if (m_EnsemblePreview) {
+		if (ImGui::SliderInt("Members", &m_EnsembleMembers, 1, 32)) CreateEnsemble();
+		if (ImGui::SliderFloat("Viscosity spread", &m_EnsembleSpread, 0.0f, 0.9f)) UpdateEnsembleViscosity();
+		ImGui::Text("Dye spread: %.3g", m_Ensemble->MeanSpread());
+	}
 	ImGui::End();
 
+	// Changed settings apply from the next step.
+	if (ImGui::IsAnyItemActive()) WakeUp();
+
 	// Render dear imgui into screen
 	ImGui::Render();
 	ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
+void Game::AllocateBuffers()
+{
+	const size_t cells = (size_t)m_Width * m_Height;
+	// Large enough for the coarse grid at any projection scale.
+	const size_t coarseCells = (size_t)((m_Width + 1) / 2) * ((m_Height + 1) / 2);
+	const int threads = (int)Application::Workers()->Size();
+	const int bands = glm::max(threads, (m_Height + TILE_ROWS - 1) / TILE_ROWS);
+	m_LineBufferSize = Arena::Align(sizeof(glm::vec2) * 4 * m_Width);
+	m_SchwarzWindowSize = Arena::Align(sizeof(float) * (TILE_ROWS + 2 * SCHWARZ_OVERLAP) * m_Width) / sizeof(float);
+
+	// Reserve room for every field back-to-back in the arena, each starting on a cache-line. Only the fields
+	// handed out are committed.
+	size_t size =
+		4 * Arena::Align(sizeof(glm::vec2) * cells) +
+		3 * Arena::Align(sizeof(float) * cells) +
+		2 * Arena::Align(sizeof(glm::vec4) * cells) +
+		1 * Arena::Align(sizeof(float) * cells) +
+		3 * Arena::Align(sizeof(float) * coarseCells) +
+		bands * m_LineBufferSize +
+		2 * threads * m_SchwarzWindowSize * sizeof(float);
+
+	// The old fields are thawed before their pages are reused.
+	m_ColdTiles.Reset(m_Height, TILE_ROWS);
+	m_Arena.Reset(size);
+
+	// The state, including the carried vorticity and the coarse warm start, keeps its place for any settings.
+	m_VelocityBuffer = m_Arena.Allocate<glm::vec2>(cells);
+	m_PressureBuffer = m_Arena.Allocate<float>(cells);
+	m_ColorBuffer = m_Arena.Allocate<glm::vec4>(cells);
+	m_DivergenceBuffer = m_Arena.Allocate<float>(cells);
+	m_CoarseDivergence = m_Arena.Allocate<float>(coarseCells);
+	m_CoarsePressure = m_Arena.Allocate<float>(coarseCells);
+	m_CoarsePressureOutput = m_Arena.Allocate<float>(coarseCells);
+
+	m_ColorOutput = m_Arena.Allocate<glm::vec4>(cells);
+	// The streaming sweeps write no full-size outputs, the velocity advection and the engines that still need
+	// the outputs use the color output's storage, a vec4 per cell holds a vec2 and a float.
+	m_LaidOutStreaming = m_Streaming;
+	if (m_LaidOutStreaming) {
+		m_VelocityOutput = (glm::vec2*)m_ColorOutput;
+		m_PressureOutput = (float*)(m_VelocityOutput + cells);
+	}
+	else {
+		m_VelocityOutput = m_Arena.Allocate<glm::vec2>(cells);
+		m_PressureOutput = m_Arena.Allocate<float>(cells);
+	}
+	// Only the Chebyshev iteration keeps the previous iterates.
+	m_LaidOutChebyshev = m_Relaxation == Relaxation::Chebyshev;
+	m_VelocityPrevious = m_LaidOutChebyshev ? m_Arena.Allocate<glm::vec2>(cells) : nullptr;
+	m_VelocitySource = m_LaidOutChebyshev ? m_Arena.Allocate<glm::vec2>(cells) : nullptr;
+	m_PressurePrevious = m_LaidOutChebyshev ? m_Arena.Allocate<float>(cells) : nullptr;
+	m_LineBuffers = m_Arena.Allocate<uchar>(bands * m_LineBufferSize);
+	m_SchwarzWindows = m_Arena.Allocate<float>(2 * threads * m_SchwarzWindowSize);
+	m_Arena.Trim();
+
+	// The fields the step graph computes per tile. Everything else is rewritten from the state every step.
+	m_ColdTiles.AddField(m_VelocityBuffer, sizeof(glm::vec2) * m_Width, false);
+	m_ColdTiles.AddField(m_PressureBuffer, sizeof(float) * m_Width, false);
+	m_ColdTiles.AddField(m_ColorBuffer, sizeof(glm::vec4) * m_Width, false);
+	if (!m_LaidOutStreaming) {
+		m_ColdTiles.AddField(m_VelocityOutput, sizeof(glm::vec2) * m_Width, true);
+		m_ColdTiles.AddField(m_PressureOutput, sizeof(float) * m_Width, true);
+	}
+	if (m_LaidOutChebyshev) {
+		m_ColdTiles.AddField(m_VelocityPrevious, sizeof(glm::vec2) * m_Width, true);
+		m_ColdTiles.AddField(m_VelocitySource, sizeof(glm::vec2) * m_Width, true);
+		m_ColdTiles.AddField(m_PressurePrevious, sizeof(float) * m_Width, true);
+	}
+	m_ColdTiles.AddField(m_ColorOutput, sizeof(glm::vec4) * m_Width, true);
+	m_ColdTiles.AddField(m_DivergenceBuffer, sizeof(float) * m_Width, true);
+}
+
+void Game::UpdateLayout()
+{
+	if (m_LaidOutChebyshev == (m_Relaxation == Relaxation::Chebyshev) && m_LaidOutStreaming == m_Streaming) return;
+
+	// Re-laying out thaws every tile.
+	ReleaseColdTiles();
+	AllocateBuffers();
+	ClearScratchFields();
+}
+
+int Game::CoarseScale() const
+{
+	// A full-resolution projection only uses the coarse grid for the Schwarz correction.
+	return m_ProjectionScale > 1 ? m_ProjectionScale : SCHWARZ_COARSE_SCALE;
+}
+
+void Game::ResizeCoarseGrid()
+{
+	const int scale = CoarseScale();
+	m_CoarseWidth = (m_Width + scale - 1) / scale;
+	m_CoarseHeight = (m_Height + scale - 1) / scale;
+}
+
+void Game::UpdateDirectSolver()
+{
+	delete m_DirectSolver;
+	m_DirectSolver = nullptr;
+	// The factorization in progress is for the old projection grid.
+	m_SolverStale = m_SolverBuilder.joinable();
+	if (m_SolverStale) return;
+	// The factorization's fill outgrows memory and its int offsets on large grids.
+	if (!m_DirectPressure || GridScale() > MAX_DIRECT_GRID_SCALE) return;
+
+	// The edges of the full grid are boundary cells, on the coarse grid every cell is solved.
+	int width = m_Width - 2, height = m_Height - 2, stride = m_Width;
+	if (m_ProjectionScale > 1) width = m_CoarseWidth, height = m_CoarseHeight, stride = m_CoarseWidth;
+
+	// Factorizing a full-resolution grid takes seconds, so it runs next to the simulation.
+	m_SolverBuilt = false;
+	m_SolverBuilder = std::thread([this, width, height, stride]() {
+		m_BuiltSolver = new CholeskySolver(width, height, stride);
+		m_SolverBuilt = true;
+	});
+}
+
+void Game::AdoptDirectSolver(bool wait)
+{
+	if (!m_SolverBuilder.joinable() || (!wait && !m_SolverBuilt)) return;
+	m_SolverBuilder.join();
+
+	CholeskySolver* solver = m_BuiltSolver;
+	m_BuiltSolver = nullptr;
+	if (m_SolverStale) {
+		delete solver;
+		UpdateDirectSolver();
+		return;
+	}
+	m_DirectSolver = solver;
+	BuildStepGraph();
+}
+
 void Game::InitSimulation()
 {
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
+	WorkerPool* pool = Application::Workers();
+	ReleaseColdTiles();
+	m_VorticityCarried = false;
+
+	// First-touch every field from the thread that owns the rows, so the pages land on that thread's node.
+	pool->Run([&](uint thread) {
+		RowRange rows = pool->Rows(thread, m_Height);
+		// Row offsets are 64-bit, a large grid has more cells than an int holds.
+		for (int y = rows.begin; y < rows.end; y++) {
+			const size_t row = (size_t)y * m_Width;
+			std::fill_n(m_PressureBuffer + row, m_Width, 0.0f);
+			std::fill_n(m_VelocityBuffer + row, m_Width, glm::vec2(0.0f, 0.0f));
+			std::fill_n(m_ColorBuffer + row, m_Width, glm::vec4(0.0f));
+			std::fill_n(m_DivergenceBuffer + row, m_Width, 0.0f);
+		}
 
-			m_PressureBuffer[x + y * WIDTH] = 0.0f;
-			m_VelocityBuffer[x + y * WIDTH] = glm::vec2(0.0f, 0.0f);
-			m_ColorBuffer[x + y * WIDTH] = glm::vec4(0.0f);
+		// The coarse grid is at most half the size in each direction.
+		RowRange coarseRows = pool->Rows(thread, (m_Height + 1) / 2);
+		size_t coarseWidth = (m_Width + 1) / 2;
+		for (int y = coarseRows.begin; y < coarseRows.end; y++) {
+			memset(m_CoarseDivergence + y * coarseWidth, 0, sizeof(float) * coarseWidth);
+			memset(m_CoarsePressure + y * coarseWidth, 0, sizeof(float) * coarseWidth);
+			memset(m_CoarsePressureOutput + y * coarseWidth, 0, sizeof(float) * coarseWidth);
 		}
+	});
+	ClearScratchFields();
+}
+
+void Game::ClearScratchFields()
+{
+	WorkerPool* pool = Application::Workers();
+
+	pool->Run([&](uint thread) {
+		RowRange rows = pool->Rows(thread, m_Height);
+		for (int y = rows.begin; y < rows.end; y++) {
+			const size_t row = (size_t)y * m_Width;
+			std::fill_n(m_ColorOutput + row, m_Width, glm::vec4(0.0f));
+			if (!m_LaidOutStreaming) {
+				std::fill_n(m_VelocityOutput + row, m_Width, glm::vec2(0.0f, 0.0f));
+				std::fill_n(m_PressureOutput + row, m_Width, 0.0f);
+			}
+			if (!m_LaidOutChebyshev) continue;
+			std::fill_n(m_VelocityPrevious + row, m_Width, glm::vec2(0.0f, 0.0f));
+			std::fill_n(m_VelocitySource + row, m_Width, glm::vec2(0.0f, 0.0f));
+			std::fill_n(m_PressurePrevious + row, m_Width, 0.0f);
+		}
+	});
+}
+
+template<typename T>
+void Game::CopyRows(T* dst, const T* src, RowRange rows)
+{
+	memcpy(dst + (size_t)rows.begin * m_Width, src + (size_t)rows.begin * m_Width, sizeof(T) * m_Width * (rows.end - rows.begin));
+}
+
+void Game::UpdateSweepWeights(float dt)
+{
+	if (m_Relaxation != Relaxation::Chebyshev) return;
+
+	// The diffusion's Jacobi matrix is the Laplacian's scaled by 4 / (alpha + 4).
+	float rho = JacobiSpectralRadius(m_Width, m_Height);
+	float alpha = (DX * DX) / (VISCOSITY * dt);
+
+	// The correction sweeps after a coarse projection may outnumber the sweeps.
+	ChebyshevWeights(rho, glm::max(m_Sweeps, CORRECTION_SWEEPS), m_PressureWeights);
+	ChebyshevWeights(rho * 4.0f / (alpha + 4.0f), m_Sweeps, m_DiffusionWeights);
+}
+
+void Game::CommitVelocitySweep(RowRange rows)
+{
+	if (m_Relaxation == Relaxation::Chebyshev) CopyRows(m_VelocityPrevious, m_VelocityBuffer, rows);
+	CopyRows(m_VelocityBuffer, m_VelocityOutput, rows);
+}
+
+void Game::CommitPressureSweep(RowRange rows)
+{
+	if (m_Relaxation == Relaxation::Chebyshev) CopyRows(m_PressurePrevious, m_PressureBuffer, rows);
+	CopyRows(m_PressureBuffer, m_PressureOutput, rows);
+}
+
+template<typename T>
+void Game::SaveLineHalos(const T* field, RowRange rows, int band)
+{
+	T* lines = LineBuffer<T>(band);
+	if (rows.begin > 0) memcpy(lines, field + (size_t)(rows.begin - 1) * m_Width, sizeof(T) * m_Width);
+	if (rows.end < m_Height) memcpy(lines + m_Width, field + (size_t)rows.end * m_Width, sizeof(T) * m_Width);
+}
+
+template<typename T, typename Kernel>
+void Game::StreamSweep(T* field, T* previous, RowRange rows, int band, const Kernel& kernel)
+{
+	T* lines = LineBuffer<T>(band);
+	T* ring = lines + 2 * m_Width;
+
+	// Rows outside the band may already be overwritten, they are read from the saved halos.
+	auto row = [&](int y) -> const T* {
+		y = glm::clamp(y, 0, m_Height - 1);
+		if (y < rows.begin) return lines;
+		if (y >= rows.end) return lines + m_Width;
+		return field + (size_t)y * m_Width;
+	};
+	auto commit = [&](int y) {
+		if (previous) memcpy(previous + (size_t)y * m_Width, field + (size_t)y * m_Width, sizeof(T) * m_Width);
+		memcpy(field + (size_t)y * m_Width, ring + (size_t)(y & 1) * m_Width, sizeof(T) * m_Width);
+	};
+
+	for (int y = rows.begin; y < rows.end; y++) {
+		kernel(y, row(y - 1), row(y), row(y + 1), ring + (size_t)(y & 1) * m_Width);
+		if (y > rows.begin) commit(y - 1);
 	}
+	if (rows.end > rows.begin) commit(rows.end - 1);
 }
 
-void Game::SimulateTimeStep(float dt)
+void Game::StreamDiffusionSweep(float dt, int sweep, RowRange rows, int band)
 {
-	// Update the velocities.
-	UpdateVelocityBoundaries();
-	AdvectVelocity(dt);
-	memcpy(m_VelocityBuffer, m_VelocityOutput, sizeof(glm::vec2) * WIDTH * HEIGHT);
+	glm::vec2* previous = m_Relaxation == Relaxation::Chebyshev ? m_VelocityPrevious : nullptr;
+	StreamSweep(m_VelocityBuffer, previous, rows, band,
+		[&](int y, const glm::vec2* below, const glm::vec2* center, const glm::vec2* above, glm::vec2* output) {
+			DiffuseVelocityRow(dt, sweep, y, below, center, above, output);
+		});
+}
 
-	for (int i = 0; i < 8; i++) {
-		DiffuseVelocities(dt);
-		memcpy(m_VelocityBuffer, m_VelocityOutput, sizeof(glm::vec2) * WIDTH * HEIGHT);
+void Game::StreamPressureSweep(int sweep, RowRange rows, int band)
+{
+	float* previous = m_Relaxation == Relaxation::Chebyshev ? m_PressurePrevious : nullptr;
+	StreamSweep(m_PressureBuffer, previous, rows, band,
+		[&](int y, const float* below, const float* center, const float* above, float* output) {
+			ComputePressureRow(sweep, y, below, center, above, output);
+		});
+}
+
+void Game::SimulateTimeStep(float dt)
+{
+	WorkerPool* pool = Application::Workers();
+
+	UpdateSweepWeights(dt);
+	if (m_Dataflow) {
+		m_StepDt = dt;
+		if (UsesColdTiles()) PrepareColdTiles();
+		m_StepGraph.Execute(pool);
+		if (UsesColdTiles()) UpdateColdTiles();
+		m_Impulses.Clear();
+		return;
 	}
 
-	// Update divergence.
-	ComputeDivergence();
+	// The whole step runs in a single job, the threads only synchronize between phases.
+	pool->Run([&](uint thread) {
+		RowRange rows = pool->Rows(thread, m_Height);
+
+		ApplyImpulses(rows);
+		pool->Sync(thread);
+
+		// Advect the velocities and colors through the same velocity field. The boundaries are O(width + height), not worth splitting.
+		if (thread == 0) UpdateVelocityBoundaries(), UpdateColorBoundaries();
+		pool->Sync(thread);
+		AdvectColors(dt, rows);
+		if (!m_LaidOutStreaming) AdvectVelocity(dt, rows);
+		pool->Sync(thread);
+		CopyRows(m_ColorBuffer, m_ColorOutput, rows);
+		// The velocity output shares the color output's storage, it is only written once the colors are copied.
+		if (m_LaidOutStreaming) {
+			pool->Sync(thread);
+			AdvectVelocity(dt, rows);
+			pool->Sync(thread);
+		}
+		CopyRows(m_VelocityBuffer, m_VelocityOutput, rows);
+		if (m_Relaxation == Relaxation::Chebyshev) CopyRows(m_VelocitySource, m_VelocityOutput, rows);
+		pool->Sync(thread);
+
+		for (int i = 0; i < m_Sweeps; i++) {
+			if (m_Streaming) {
+				SaveLineHalos(m_VelocityBuffer, rows, thread);
+				pool->Sync(thread);
+				StreamDiffusionSweep(dt, i, rows, thread);
+				pool->Sync(thread);
+				continue;
+			}
+			DiffuseVelocities(dt, i, rows);
+			pool->Sync(thread);
+			CommitVelocitySweep(rows);
+			pool->Sync(thread);
+		}
 
-	for (int i = 0; i < 8; i++) {
-		ComputePressure();
-		memcpy(m_PressureBuffer, m_PressureOutput, sizeof(float) * WIDTH * HEIGHT);
+		Project(pool, thread, rows);
+	});
+	m_Impulses.Clear();
+}
+
+void Game::Project(WorkerPool* pool, uint thread, RowRange rows)
+{
+	ComputeDivergence(rows);
+	pool->Sync(thread);
+
+	auto directSolve = [&]() {
+		for (int stage = 0; stage < m_DirectSolver->Stages(); stage++) {
+			int size = m_DirectSolver->StageSize(stage);
+			if (!m_DirectSolver->IsSerial(stage)) SolvePressureDirect(stage, pool->Rows(thread, size));
+			else if (thread == 0) SolvePressureDirect(stage, { 0, size });
+			pool->Sync(thread);
+		}
+	};
+
+	int sweeps = m_Sweeps;
+	if (m_ProjectionScale > 1) {
+		// Solve on the coarse grid, then correct the prolongated solution at full resolution.
+		RowRange coarseRows = pool->Rows(thread, m_CoarseHeight);
+		Restrict(m_DivergenceBuffer, coarseRows);
+		pool->Sync(thread);
+		if (m_DirectSolver) directSolve();
+		else for (int i = 0; i < m_Sweeps; i++) {
+			ComputeCoarsePressure(coarseRows);
+			pool->Sync(thread);
+			CommitCoarsePressure(coarseRows);
+			pool->Sync(thread);
+		}
+		ProlongatePressure(rows);
+		pool->Sync(thread);
+		sweeps = CORRECTION_SWEEPS;
+	}
+	else if (m_DirectSolver) {
+		directSolve();
+		sweeps = 0;
 	}
-	UpdatePressureBoundaries();
 
-	SubtractPressureGradient();
+	if (m_Relaxation == Relaxation::Schwarz) {
+		SolvePressureSchwarz(pool, thread, sweeps);
+		sweeps = 0;
+	}
+	for (int i = 0; i < sweeps; i++) {
+		if (m_Streaming) {
+			SaveLineHalos(m_PressureBuffer, rows, thread);
+			pool->Sync(thread);
+			StreamPressureSweep(i, rows, thread);
+			pool->Sync(thread);
+			continue;
+		}
+		ComputePressure(i, rows);
+		pool->Sync(thread);
+		CommitPressureSweep(rows);
+		pool->Sync(thread);
+	}
+	if (thread == 0) UpdatePressureBoundaries();
+	pool->Sync(thread);
 
-	UpdateColorBoundaries();
-	AdvectColors(dt);
-	memcpy(m_ColorBuffer, m_ColorOutput, sizeof(glm::vec4) * WIDTH * HEIGHT);
+	SubtractPressureGradient(rows);
 }
 
-void Game::HandleInput(float dt)
+void Game::SimulateLatticeStep(float dt)
 {
-	HandleMouseDown(dt);
-	HandleMouseClick(dt);
+	WorkerPool* pool = Application::Workers();
+
+	pool->Run([&](uint thread) {
+		RowRange rows = pool->Rows(thread, m_Height);
+
+		ApplyImpulses(rows);
+		pool->Sync(thread);
 
-	if (Input::KeyPressed(Key::R)) InitSimulation();
+		// The lattice picks up the impulses from the velocity field and ends with a sync.
+		m_Lattice->Step(pool, thread, dt, m_LatticeSubsteps, m_VelocityBuffer);
+
+		if (thread == 0) UpdateColorBoundaries();
+		pool->Sync(thread);
+		AdvectColors(dt, rows);
+		pool->Sync(thread);
+		CopyRows(m_ColorBuffer, m_ColorOutput, rows);
+	});
+	m_Impulses.Clear();
 }
 
-void Game::HandleMouseDown(float dt)
+void Game::SimulateEnsembleStep(float dt)
 {
-	static const float sqrdRad = RDX * RDX * 0.75f;
+	// The members run on a coarser grid of their own, the impulses are scaled down onto it.
+	m_Ensemble->ApplyImpulses(m_Impulses, (float)m_Width / m_Ensemble->Width());
+	m_Ensemble->Step(dt, m_Sweeps);
+	m_Impulses.Clear();
+}
 
-	// Only apply forces when the mouse is being pressed.
-	if (!Input::MouseLeftButtonDown()) return;
+void Game::SimulateSphStep(float dt)
+{
+	WorkerPool* pool = Application::Workers();
 
-	// Check if mouse is inside the screen. 
-	glm::ivec2 cursorPos = Input::CursorPosition();
-	cursorPos.y = HEIGHT - cursorPos.y - 1.0f;
+	pool->Run([&](uint thread) {
+		m_Sph->Step(pool, thread, dt, m_SphSubsteps, m_Impulses);
+		m_Sph->Splat(pool, thread, m_ColorBuffer);
+	});
+	m_Impulses.Clear();
+}
 
-	if (cursorPos.x < 0 || cursorPos.y < 0 || cursorPos.x > WIDTH - 1 || cursorPos.y > HEIGHT - 1) return;
+void Game::SimulateFlipStep(float dt)
+{
+	WorkerPool* pool = Application::Workers();
+
+	UpdateSweepWeights(dt);
+	pool->Run([&](uint thread) {
+		RowRange rows = pool->Rows(thread, m_Height);
+
+		m_Flip->Bin(pool, thread);
+		m_Flip->TransferToGrid(rows, m_VelocityBuffer);
+		pool->Sync(thread);
+		if (thread == 0) UpdateVelocityBoundaries();
+		pool->Sync(thread);
+
+		// Keep the transferred velocity for the FLIP update, the impulses count as a change of the grid velocity.
+		CopyRows(m_VelocityOutput, m_VelocityBuffer, rows);
+		ApplyImpulses(rows);
+		pool->Sync(thread);
+		if (thread == 0) UpdateVelocityBoundaries(), UpdateColorBoundaries();
+		pool->Sync(thread);
+
+		Project(pool, thread, rows);
+		pool->Sync(thread);
+
+		m_Flip->TransferToParticles(pool->Rows(thread, (int)m_Flip->Size()), m_VelocityBuffer, m_VelocityOutput, dt);
+		// The velocity output may share the color output's storage.
+		if (m_LaidOutStreaming) pool->Sync(thread);
+		AdvectColors(dt, rows);
+		pool->Sync(thread);
+		CopyRows(m_ColorBuffer, m_ColorOutput, rows);
+	});
+	m_Impulses.Clear();
+}
 
-	// Force-direction.
-	glm::vec2 forceDirection = Input::CursorMovement();
-	forceDirection.y *= -1.0f;
+void Game::SimulateVorticityStep(float dt)
+{
+	WorkerPool* pool = Application::Workers();
+
+	UpdateSweepWeights(dt);
+	const bool carried = m_VorticityCarried, impulses = !m_Impulses.Empty();
+	pool->Run([&](uint thread) {
+		RowRange rows = pool->Rows(thread, m_Height);
+
+		// The vorticity is carried in the right-hand side of the Poisson equation, the stream function is solved
+		// for in the pressure field. Without a carried vorticity it is derived from the velocity.
+		if (!carried || impulses) {
+			ComputeVorticity(rows);
+			if (!carried) CopyRows(m_DivergenceBuffer, m_PressureOutput, rows);
+			pool->Sync(thread);
+		}
 
-	if (glm::abs(forceDirection.x) < EPSILON || glm::abs(forceDirection.y) < EPSILON) return;
-	forceDirection = glm::normalize(forceDirection);
+		ApplyImpulses(rows);
+		pool->Sync(thread);
+		if (impulses) {
+			AddImpulseVorticity(rows);
+			pool->Sync(thread);
+		}
+		if (thread == 0) UpdateVelocityBoundaries(), UpdateColorBoundaries();
+		pool->Sync(thread);
+
+		Advect(dt, m_DivergenceBuffer, m_PressureOutput, rows);
+		// The pressure output may share the color output's storage, it is committed before the colors advect.
+		if (m_LaidOutStreaming) {
+			pool->Sync(thread);
+			CopyRows(m_DivergenceBuffer, m_PressureOutput, rows);
+			pool->Sync(thread);
+		}
+		AdvectColors(dt, rows);
+		pool->Sync(thread);
+		if (!m_LaidOutStreaming) CopyRows(m_DivergenceBuffer, m_PressureOutput, rows);
+		CopyRows(m_ColorBuffer, m_ColorOutput, rows);
+		pool->Sync(thread);
+
+		// The vorticity diffuses like the velocity does in the other steps, once the colors freed the scratch field.
+		for (int i = 0; i < m_Sweeps; i++) {
+			DiffuseVorticity(dt, rows);
+			pool->Sync(thread);
+			CopyRows(m_DivergenceBuffer, m_PressureOutput, rows);
+			pool->Sync(thread);
+		}
 
-	glm::ivec2 minBounds = glm::clamp(cursorPos - 100, glm::ivec2(0), glm::ivec2(WIDTH - 1, HEIGHT - 1));
-	glm::ivec2 maxBounds = glm::clamp(cursorPos + 100, glm::ivec2(0), glm::ivec2(WIDTH - 1, HEIGHT - 1));
+		for (int i = 0; i < m_Sweeps; i++) {
+			ComputePressure(i, rows);
+			pool->Sync(thread);
+			CommitPressureSweep(rows);
+			UpdateStreamFunctionBoundaries(rows);
+			pool->Sync(thread);
+		}
 
-	for (int dy = minBounds.y; dy < maxBounds.y; dy++)
-		for (int dx = minBounds.x; dx < maxBounds.x; dx++) {
-			float sqrdDist =
-				(dx - cursorPos.x) * (dx - cursorPos.x) +
-				(dy - cursorPos.y) * (dy - cursorPos.y);
+		ComputeStreamFunctionVelocity(rows);
+	});
+	m_Impulses.Clear();
+}
 
-			float multiplier = 1.0f;
+bool Game::UsesColdTiles() const
+{
+	// The coarse projection, the direct solve and the Schwarz correction read every row, the other engines and the
+	// tracers touch the fields outside the step graph. The outputs sharing the color output's storage do not line
+	// up with its tiles.
+	return m_CompressColdTiles && m_Dataflow && m_ProjectionScale == 1 && !m_DirectSolver && m_Relaxation != Relaxation::Schwarz && !m_Arena.LargePages() &&
+		!m_LaidOutStreaming &&
+		!m_LatticeEngine && !m_SphEngine && !m_FlipEngine && !m_VorticityEngine && !m_ShowTracers;
+}
 
-			if (sqrdDist > sqrdRad) continue;
-			if (sqrdDist > (0.5f * sqrdRad)) multiplier = 5.0f;
-			if (sqrdDist > (0.2f * sqrdRad)) multiplier = 10.0f;
+int Game::ColdTileReach() const
+{
+	// Without velocity the advection reads a single row; each sweep, the divergence and the gradient one more.
+	return (2 * m_Sweeps + 3 + TILE_ROWS - 1) / TILE_ROWS;
+}
 
-			// Update the velocity and color.
-			m_VelocityBuffer[dx + dy * WIDTH] = forceDirection * multiplier;
-			m_ColorBuffer[dx + dy * WIDTH] = glm::vec4(1.0f);
+bool Game::IsSkipped(int y) const
+{
+	return !m_SkipTiles.empty() && m_SkipTiles[y / TILE_ROWS];
+}
+
+void Game::PrepareColdTiles()
+{
+	const int tiles = m_ColdTiles.Tiles();
+	m_ColdTiles.Collect();
+
+	auto thaw = [&](int y0, int y1) {
+		y0 = glm::clamp(y0, 0, m_Height - 1), y1 = glm::clamp(y1, 0, m_Height - 1);
+		for (int tile = y0 / TILE_ROWS; tile <= y1 / TILE_ROWS; tile++) {
+			m_ColdTiles.Thaw(tile);
+			m_QuietSteps[tile] = 0;
 		}
+	};
+
+	// The impulses and the obstacles write their rows directly, their tiles are thawed up front instead of on
+	// the first touch.
+	for (const Impulse& impulse : m_Impulses.Impulses()) {
+		float reach = glm::max(impulse.radius, impulse.ring.y);
+		thaw((int)glm::floor(glm::min(impulse.from.y, impulse.to.y) - reach), (int)glm::ceil(glm::max(impulse.from.y, impulse.to.y) + reach));
+	}
+	if (UsesObstacles() && !m_Obstacles->Empty()) thaw(m_Obstacles->Rows().begin - 1, m_Obstacles->Rows().end);
+
+	// A frozen tile is only skipped while every tile its step reads is unchanged since the previous step, then the
+	// step would leave it unchanged as well.
+	const int reach = ColdTileReach();
+	for (int tile = 0; tile < tiles; tile++) {
+		if (!m_ColdTiles.IsFrozen(tile)) continue;
+		for (int other = glm::max(tile - reach, 0); other <= glm::min(tile + reach, tiles - 1); other++)
+			if (m_QuietSteps[other] == 0) {
+				m_ColdTiles.Thaw(tile);
+				break;
+			}
+	}
+
+	m_SkipTiles.resize(tiles);
+	for (int tile = 0; tile < tiles; tile++) m_SkipTiles[tile] = m_ColdTiles.IsFrozen(tile);
 }
 
-void Game::HandleMouseClick(float dt)
+void Game::UpdateColdTiles()
 {
-	static const float maxRad = RDX * RDX;
-	static const float minRad = maxRad * 0.5f;
+	WorkerPool* pool = Application::Workers();
+	const int tiles = m_ColdTiles.Tiles();
+
+	pool->Run([&](uint thread) {
+		RowRange range = pool->Rows(thread, tiles);
+		for (int tile = range.begin; tile < range.end; tile++) {
+			// A skipped tile that is resident again was only read by a neighbour, it is still unchanged.
+			if (m_ColdTiles.IsFrozen(tile) || m_SkipTiles[tile]) continue;
+
+			// Without velocity the step does not depend on the time-step, a tile left unchanged by one step is left
+			// unchanged by the next one as long as the tiles it reads are.
+			const size_t first = (size_t)tile * TILE_ROWS * m_Width;
+			const size_t cells = (size_t)(glm::min((tile + 1) * TILE_ROWS, m_Height) - tile * TILE_ROWS) * m_Width;
+			bool still = true;
+			for (size_t i = first; i < first + cells && still; i++) still = m_VelocityBuffer[i] == glm::vec2(0.0f);
+
+			uint64_t hash = HashWords(m_VelocityBuffer + first, sizeof(glm::vec2) * cells);
+			hash = HashWords(m_PressureBuffer + first, sizeof(float) * cells, hash);
+			hash = HashWords(m_ColorBuffer + first, sizeof(glm::vec4) * cells, hash);
+
+			m_QuietSteps[tile] = still && hash == m_TileHashes[tile] ? m_QuietSteps[tile] + 1 : 0;
+			m_TileHashes[tile] = hash;
+		}
+	});
+
+	// A tile is only frozen between tiles at rest, as far as its step reads.
+	const int reach = ColdTileReach();
+	auto cold = [&](int tile) {
+		for (int other = glm::max(tile - reach, 0); other <= glm::min(tile + reach, tiles - 1); other++)
+			if (m_QuietSteps[other] < m_ColdTileSteps) return false;
+		return true;
+	};
+	pool->Run([&](uint thread) {
+		RowRange range = pool->Rows(thread, tiles);
+		for (int tile = range.begin; tile < range.end; tile++)
+			if (!m_ColdTiles.IsFrozen(tile) && cold(tile)) m_ColdTiles.Freeze(tile);
+	});
+
+	for (int tile = 0; tile < tiles; tile++) m_SkipTiles[tile] = m_ColdTiles.IsFrozen(tile);
+}
 
+void Game::ReleaseColdTiles()
+{
+	m_ColdTiles.ThawAll();
+	m_SkipTiles.clear();
+	m_QuietSteps.assign(m_ColdTiles.Tiles(), 0);
+	m_TileHashes.assign(m_ColdTiles.Tiles(), 0);
+}
 
-	// Only apply forces when the mouse is being pressed.
-	if (!Input::MouseRightButtonClick()) return;
+void Game::CreateObstacles()
+{
+	delete m_Obstacles;
+	m_Obstacles = new ObstacleSet(m_Width, m_Height);
 
-	// Check if mouse is inside the screen. 
-	glm::ivec2 cursorPos = Input::CursorPosition();
-	cursorPos.y = HEIGHT - cursorPos.y - 1.0f;
+	// A paddle sweeping left and right through the left half and a fan spinning in the right half.
+	const float w = (float)m_Width, h = (float)m_Height;
+	m_Obstacles->Add({ glm::vec2(0.3f * w, 0.5f * h), glm::vec2(0.01f * w, 0.12f * h), glm::vec2(0.1f * w, 0.0f), 1.5f, 0.0f, 0.0f });
+	m_Obstacles->Add({ glm::vec2(0.7f * w, 0.5f * h), glm::vec2(0.1f * w, 0.012f * w), glm::vec2(0.0f), 0.0f, 0.0f, 2.0f });
+}
 
-	if (cursorPos.x < 0 || cursorPos.y < 0 || cursorPos.x > WIDTH - 1 || cursorPos.y > HEIGHT - 1) return;
+void Game::CreateEnsemble()
+{
+	delete m_Ensemble;
+	m_Ensemble = new Ensemble(ENSEMBLE_PREVIEW_SIZE, ENSEMBLE_PREVIEW_SIZE, m_EnsembleMembers);
+	UpdateEnsembleViscosity();
+}
+
+void Game::UpdateEnsembleViscosity()
+{
+	// A single member keeps the default viscosity.
+	const int members = m_Ensemble->Members();
+	for (int member = 0; member < members; member++) {
+		float t = members > 1 ? 2.0f * member / (members - 1) - 1.0f : 0.0f;
+		m_Ensemble->SetViscosity(member, VISCOSITY * (1.0f + m_EnsembleSpread * t));
+	}
+}
 
-	glm::ivec2 minBounds = glm::clamp(cursorPos - 100, glm::ivec2(0), glm::ivec2(WIDTH - 1, HEIGHT - 1));
-	glm::ivec2 maxBounds = glm::clamp(cursorPos + 100, glm::ivec2(0), glm::ivec2(WIDTH - 1, HEIGHT - 1));
+bool Game::UsesObstacles() const
+{
+	// The other engines do not project the grid velocity.
+	return m_MovingObstacles && !m_VolumePreview && !m_EnsemblePreview && !m_LatticeEngine && !m_SphEngine && !m_VorticityEngine;
+}
 
-	for (int dy = minBounds.y; dy < maxBounds.y; dy++)
-		for (int dx = minBounds.x; dx < maxBounds.x; dx++) {
-			float sqrdDist =
-				(dx - cursorPos.x) * (dx - cursorPos.x) +
-				(dy - cursorPos.y) * (dy - cursorPos.y);
+const uchar* Game::ObstacleMask(RowRange rows) const
+{
+	return UsesObstacles() && m_Obstacles->Covers(rows) ? m_Obstacles->Solid() : nullptr;
+}
 
-			if (dx == cursorPos.x && dy == cursorPos.y) continue;
+void Game::MoveObstacles(float dt)
+{
+	WorkerPool* pool = Application::Workers();
 
-			glm::vec2 force = glm::normalize(glm::vec2((float)dx - cursorPos.x, (float)dy - cursorPos.y)) * 10.0f;
+	m_Obstacles->Move(dt);
+	pool->Run([&](uint thread) {
+		m_Obstacles->Rasterize(pool, thread);
+	});
+}
 
-			// Update the velocity and color.
-			m_VelocityBuffer[dx + dy * WIDTH] = force;
-			if (sqrdDist < minRad || sqrdDist > maxRad) continue;
-			m_ColorBuffer[dx + dy * WIDTH] = glm::vec4(0.0f, 1.0f, 0.0f, 1.0f);
+void Game::MeasureActivity()
+{
+	WorkerPool* pool = Application::Workers();
+	const int blocksX = (m_Width + ACTIVITY_BLOCK - 1) / ACTIVITY_BLOCK, blocksY = (m_Height + ACTIVITY_BLOCK - 1) / ACTIVITY_BLOCK;
+
+	// A resize invalidates the blocks, the first measurement after it counts as a change.
+	if (m_DyeBlocks.size() != (size_t)blocksX * blocksY) m_DyeBlocks.assign((size_t)blocksX * blocksY, 0.0f);
+
+	// Each thread measures whole rows of blocks. In the deterministic mode every row of blocks has a partial of
+	// its own, so the sums do not depend on how the rows are split over the threads.
+	m_ActivityPartials.assign(m_Deterministic ? blocksY : pool->Size(), Activity());
+	pool->Run([&](uint thread) {
+		RowRange blockRows = pool->Rows(thread, blocksY);
+
+		for (int by = blockRows.begin; by < blockRows.end; by++) {
+			Activity& partial = m_ActivityPartials[m_Deterministic ? by : thread];
+			const int y0 = by * ACTIVITY_BLOCK, y1 = glm::min(y0 + ACTIVITY_BLOCK, m_Height);
+			// The blocks of a skipped tile are at rest and keep their dye.
+			if (IsSkipped(y0)) continue;
+			for (int bx = 0; bx < blocksX; bx++) {
+				const int x0 = bx * ACTIVITY_BLOCK, x1 = glm::min(x0 + ACTIVITY_BLOCK, m_Width);
+
+				float dye = 0.0f;
+				for (int y = y0; y < y1; y++)
+					for (int x = x0; x < x1; x++) {
+						glm::vec2 velocity = m_VelocityBuffer[x + (size_t)y * m_Width];
+						glm::vec4 color = m_ColorBuffer[x + (size_t)y * m_Width];
+						float energy = 0.5f * glm::dot(velocity, velocity);
+						partial.energy += energy;
+						partial.peak = glm::max(partial.peak, energy);
+						dye += color.r + color.g + color.b;
+					}
+
+				float& block = m_DyeBlocks[bx + (size_t)by * blocksX];
+				partial.dye += glm::abs(dye - block);
+				block = dye;
+			}
 		}
+	});
+
+	m_Activity = ReducePairwise(m_ActivityPartials, [](const Activity& a, const Activity& b) {
+		Activity sum;
+		sum.energy = a.energy + b.energy, sum.dye = a.dye + b.dye;
+		sum.peak = glm::max(a.peak, b.peak);
+		return sum;
+	});
+
+	bool settled = m_Activity.peak < SETTLED_ENERGY && m_Activity.dye < SETTLED_DYE;
+	m_SettledMeasurements = settled ? m_SettledMeasurements + 1 : 0;
+	m_Quiescent = m_SettledMeasurements >= SETTLED_MEASUREMENTS;
+}
+
+void Game::WakeUp()
+{
+	m_Quiescent = false;
+	m_SettledMeasurements = 0;
 }
 
+void Game::SimulateTracers(float dt)
+{
+	WorkerPool* pool = Application::Workers();
+
+	pool->Run([&](uint thread) {
+		m_Tracers->Step(pool, thread, dt, m_VelocityBuffer);
+	});
+}
+
+void Game::BuildStepGraph()
+{
+	typedef TaskGraph::Task Task;
+	typedef TaskGraph::TilePhase TilePhase;
+
+	TaskGraph& graph = m_StepGraph;
+	graph.Clear();
+
+	uint threads = Application::Workers()->Size();
+	// Every kernel skips the tiles frozen at the start of the step.
+	auto tiles = [&](const std::function<void(RowRange)>& kernel) {
+		return graph.AddTiles(m_Height, TILE_ROWS, threads, [this, kernel](RowRange rows) {
+			if (!IsSkipped(rows.begin)) kernel(rows);
+		});
+	};
+
+	// The boundaries read the rows next to the edges, so they wait for all impulses.
+	Task impulses = graph.AddJoin(tiles([this](RowRange rows) { ApplyImpulses(rows); }));
+
+	// Both advections read the velocity field at arbitrary positions, so they wait for the complete boundaries
+	// and the velocity field may only be overwritten once both completed.
+	Task velocityBoundaries = graph.Add([this]() { UpdateVelocityBoundaries(); });
+	Task colorBoundaries = graph.Add([this]() { UpdateColorBoundaries(); });
+	graph.Depend(velocityBoundaries, impulses);
+	graph.Depend(colorBoundaries, impulses);
+
+	TilePhase advectVelocity = tiles([this](RowRange rows) { AdvectVelocity(m_StepDt, rows); });
+	TilePhase advectColors = tiles([this](RowRange rows) { AdvectColors(m_StepDt, rows); });
+	graph.Depend(advectVelocity, velocityBoundaries);
+	graph.Depend(advectColors, velocityBoundaries);
+	graph.Depend(advectColors, colorBoundaries);
+
+	TilePhase copyColors = tiles([this](RowRange rows) { CopyRows(m_ColorBuffer, m_ColorOutput, rows); });
+	graph.Depend(copyColors, graph.AddJoin(advectColors));
+	// The velocity output shares the color output's storage, it is only written once the colors are copied.
+	if (m_LaidOutStreaming) graph.Depend(advectVelocity, graph.AddJoin(copyColors));
+
+	TilePhase advected = advectVelocity;
+	advected.insert(advected.end(), advectColors.begin(), advectColors.end());
+	TilePhase copyVelocity = tiles([this](RowRange rows) {
+		CopyRows(m_VelocityBuffer, m_VelocityOutput, rows);
+		if (m_Relaxation == Relaxation::Chebyshev) CopyRows(m_VelocitySource, m_VelocityOutput, rows);
+	});
+	graph.Depend(copyVelocity, graph.AddJoin(advected));
+
+	// The Jacobi sweeps only need the neighbouring tiles of the previous sweep or copy. A streaming sweep
+	// overwrites its tile in place, so it also waits until the neighbouring tiles saved their halos.
+	TilePhase previous = copyVelocity;
+	for (int i = 0; i < m_Sweeps; i++) {
+		if (m_Streaming) {
+			TilePhase halos = tiles([this](RowRange rows) { SaveLineHalos(m_VelocityBuffer, rows, rows.begin / TILE_ROWS); });
+			graph.DependNeighbours(halos, previous);
+			TilePhase sweep = tiles([this, i](RowRange rows) { StreamDiffusionSweep(m_StepDt, i, rows, rows.begin / TILE_ROWS); });
+			graph.DependNeighbours(sweep, halos);
+			previous = sweep;
+			continue;
+		}
+		TilePhase diffuse = tiles([this, i](RowRange rows) { DiffuseVelocities(m_StepDt, i, rows); });
+		graph.DependNeighbours(diffuse, previous);
+		TilePhase copy = tiles([this](RowRange rows) { CommitVelocitySweep(rows); });
+		graph.DependNeighbours(copy, diffuse);
+		previous = copy;
+	}
+
+	TilePhase divergence = tiles([this](RowRange rows) { ComputeDivergence(rows); });
+	graph.DependNeighbours(divergence, previous);
+
+	// The stages of the direct solve run one after the other, each split into a tile per thread.
+	auto directSolve = [&](Task dependency) {
+		for (int stage = 0; stage < m_DirectSolver->Stages(); stage++) {
+			int size = m_DirectSolver->StageSize(stage);
+			if (m_DirectSolver->IsSerial(stage)) {
+				Task serial = graph.Add([this, stage, size]() { SolvePressureDirect(stage, { 0, size }); });
+				graph.Depend(serial, dependency);
+				dependency = serial;
+			}
+			else {
+				TilePhase parts = graph.AddTiles(size, (size + threads - 1) / threads, threads,
+					[this, stage](RowRange part) { SolvePressureDirect(stage, part); });
+				graph.Depend(parts, dependency);
+				dependency = graph.AddJoin(parts);
+			}
+		}
+		return dependency;
+	};
+
+	previous = divergence;
+	int sweeps = m_Sweeps;
+	if (m_ProjectionScale == 1 && m_DirectSolver) {
+		previous = { directSolve(graph.AddJoin(divergence)) };
+		sweeps = 0;
+	}
+	else if (m_ProjectionScale > 1) {
+		// The coarse grid is small, its phases are joined instead of tracking which fine tiles a coarse tile covers.
+		auto coarseTiles = [&](const std::function<void(RowRange)>& kernel) {
+			return graph.AddTiles(m_CoarseHeight, TILE_ROWS, threads, kernel);
+		};
+
+		TilePhase restriction = coarseTiles([this](RowRange rows) { Restrict(m_DivergenceBuffer, rows); });
+		graph.Depend(restriction, graph.AddJoin(divergence));
+
+		TilePhase coarse = restriction;
+		if (m_DirectSolver) coarse = { directSolve(graph.AddJoin(restriction)) };
+		else for (int i = 0; i < m_Sweeps; i++) {
+			TilePhase pressure = coarseTiles([this](RowRange rows) { ComputeCoarsePressure(rows); });
+			graph.DependNeighbours(pressure, coarse, i == 0 ? 0 : 1);
+			TilePhase copy = coarseTiles([this](RowRange rows) { CommitCoarsePressure(rows); });
+			graph.DependNeighbours(copy, pressure);
+			coarse = copy;
+		}
+
+		previous = tiles([this](RowRange rows) { ProlongatePressure(rows); });
+		graph.Depend(previous, graph.AddJoin(coarse));
+		sweeps = CORRECTION_SWEEPS;
+	}
+
+	if (m_Relaxation == Relaxation::Schwarz && sweeps > 0) {
+		// A band of whole tiles per thread. The bands only wait for their neighbouring bands, the coarse correction
+		// is the only point where all of them meet.
+		const int tileCount = (m_Height + TILE_ROWS - 1) / TILE_ROWS;
+		const int bandRows = (tileCount + threads - 1) / threads * TILE_ROWS;
+		auto bands = [&](const std::function<void(RowRange)>& kernel) {
+			return graph.AddTiles(m_Height, bandRows, threads, kernel);
+		};
+
+		// The bands do not line up with the tiles before them, every band waits for all of those.
+		previous = TilePhase((m_Height + bandRows - 1) / bandRows, graph.AddJoin(previous));
+		for (int k = 0; k < SchwarzIterations(sweeps); k++) {
+			if (SchwarzCorrects(k)) {
+				TilePhase residual = bands([this](RowRange rows) { ComputePressureResidual(rows); });
+				graph.DependNeighbours(residual, previous);
+				TilePhase restriction = graph.AddTiles(m_CoarseHeight, TILE_ROWS, threads, [this](RowRange rows) { Restrict(m_PressureOutput, rows); });
+				graph.Depend(restriction, graph.AddJoin(residual));
+				Task coarse = graph.Add([this]() { SolveCoarseCorrection(); });
+				graph.Depend(coarse, graph.AddJoin(restriction));
+				previous = bands([this](RowRange rows) { ProlongateCorrection(rows); });
+				graph.Depend(previous, coarse);
+			}
+			TilePhase local = bands([this, bandRows](RowRange rows) { SolvePressureTiles(rows, rows.begin / bandRows); });
+			graph.DependNeighbours(local, previous);
+			TilePhase copy = bands([this](RowRange rows) { CopyRows(m_PressureBuffer, m_PressureOutput, rows); });
+			graph.DependNeighbours(copy, local);
+			previous = copy;
+		}
+		sweeps = 0;
+	}
+	for (int i = 0; i < sweeps; i++) {
+		if (m_Streaming) {
+			TilePhase halos = tiles([this](RowRange rows) { SaveLineHalos(m_PressureBuffer, rows, rows.begin / TILE_ROWS); });
+			graph.DependNeighbours(halos, previous, i == 0 && m_ProjectionScale == 1 ? 0 : 1);
+			TilePhase sweep = tiles([this, i](RowRange rows) { StreamPressureSweep(i, rows, rows.begin / TILE_ROWS); });
+			graph.DependNeighbours(sweep, halos);
+			previous = sweep;
+			continue;
+		}
+		TilePhase pressure = tiles([this, i](RowRange rows) { ComputePressure(i, rows); });
+		graph.DependNeighbours(pressure, previous, i == 0 && m_ProjectionScale == 1 ? 0 : 1);
+		TilePhase copy = tiles([this](RowRange rows) { CommitPressureSweep(rows); });
+		graph.DependNeighbours(copy, pressure);
+		previous = copy;
+	}
+
+	Task pressureBoundaries = graph.Add([this]() { UpdatePressureBoundaries(); });
+	graph.Depend(pressureBoundaries, graph.AddJoin(previous));
+
+	TilePhase gradient = tiles([this](RowRange rows) { SubtractPressureGradient(rows); });
+	graph.Depend(gradient, pressureBoundaries);
+}
+
+const char* Game::DeterminismCaseName(int determinismCase)
+{
+	static const char* names[DETERMINISM_CASES] = {
+		"Dataflow", "Phased", "Streaming Chebyshev", "Additive Schwarz", "Half-resolution projection",
+		"Direct solve", "Moving obstacles", "Streamfunction-vorticity", "FLIP particles", "Cold tiles", "Lattice Boltzmann",
+		"SPH particles", "Ensemble preview", "Volume preview"
+	};
+	return names[determinismCase];
+}
+
+uint64_t Game::RunDeterminismCase(int determinismCase, int steps)
+{
+	m_Deterministic = true;
+	m_IdleWhenSettled = false;
+	Application::Workers()->SetFloatControl(DETERMINISTIC_FLOAT_CONTROL);
+
+	switch (determinismCase) {
+	case 1: m_Dataflow = false; break;
+	case 2: m_Relaxation = Relaxation::Chebyshev, m_Streaming = true; break;
+	case 3: m_Relaxation = Relaxation::Schwarz; break;
+	case 4: m_ProjectionScale = 2, ResizeCoarseGrid(); break;
+	case 5:
+		m_DirectPressure = true;
+		UpdateDirectSolver();
+		while (m_SolverBuilder.joinable()) AdoptDirectSolver(true);
+		break;
+	case 6: m_MovingObstacles = true, CreateObstacles(); break;
+	case 7: m_VorticityEngine = true; break;
+	case 8:
+		delete m_Flip;
+		m_FlipEngine = true, m_Flip = new FlipSolver(m_Width, m_Height);
+		break;
+	// Tiles freeze after a single unchanged step, so even short runs skip some. Skipping is exact, the hash must
+	// match the plain dataflow step.
+	case 9: m_CompressColdTiles = true, m_ColdTileSteps = 1; break;
+	case 10:
+		delete m_Lattice;
+		m_LatticeEngine = true, m_Lattice = new LatticeSolver(m_Width, m_Height);
+		break;
+	case 11:
+		delete m_Sph;
+		m_SphEngine = true, m_Sph = new SphSolver(m_Width, m_Height, SPH_PARTICLES);
+		break;
+	case 12: m_EnsemblePreview = true, CreateEnsemble(); break;
+	case 13:
+		delete m_Volume;
+		m_VolumePreview = true, m_Volume = new VolumeSolver(VOLUME_PREVIEW_SIZE, VOLUME_PREVIEW_SIZE, VOLUME_PREVIEW_SIZE);
+		break;
+	}
+	UpdateLayout();
+	BuildStepGraph();
+
+	for (int step = 0; step < steps; step++) {
+		m_Impulses.AddScript(step, m_Width, m_Height);
+		Step(TIMESTEP);
+	}
+	return StateHash();
+}
+
+uint64_t Game::StateHash() const
+{
+	// The volume and the ensemble leave the grid alone and run on fields of their own.
+	if (m_VolumePreview) return m_Volume->Hash();
+	if (m_EnsemblePreview) {
+		const size_t cells = (size_t)m_Ensemble->Width() * m_Ensemble->Height();
+		std::vector<glm::vec2> velocity(cells);
+		std::vector<glm::vec4> dye(cells);
+		uint64_t hash = FNV_OFFSET;
+		for (int member = 0; member < m_Ensemble->Members(); member++) {
+			m_Ensemble->ExtractVelocity(member, velocity.data());
+			m_Ensemble->ExtractDye(member, dye.data());
+			hash = HashWords(velocity.data(), sizeof(glm::vec2) * cells, hash);
+			hash = HashWords(dye.data(), sizeof(glm::vec4) * cells, hash);
+		}
+		return hash;
+	}
+
+	const size_t cells = (size_t)m_Width * m_Height;
+	uint64_t hash = HashWords(m_VelocityBuffer, sizeof(glm::vec2) * cells);
+	hash = HashWords(m_PressureBuffer, sizeof(float) * cells, hash);
+	return HashWords(m_ColorBuffer, sizeof(glm::vec4) * cells, hash);
+}
+
+void Game::HandleInput(float dt)
+{
+	HandleMouseDown(dt);
+	HandleMouseClick(dt);
+
+	if (Input::KeyPressed(Key::R)) InitSimulation(), WakeUp();
+}
+
+void Game::HandleMouseDown(float dt)
+{
+	static const float radius = RDX * glm::sqrt(0.75f);
+
+	// Connect consecutive cursor samples with the left button held into strokes, including the last sample of the previous frame.
+	for (const CursorSample& sample : Input::CursorSamples()) {
+		const CursorSample& last = m_LastCursorSample;
+		bool connected = m_HasCursorSample && last.left && sample.left && sample.time - last.time < STROKE_GAP;
+
+		glm::vec2 from = ScreenToGrid(last.position), to = ScreenToGrid(sample.position);
+		if (connected && glm::length(to - from) > EPSILON) m_Impulses.AddStroke(from, to, radius);
+
+		m_LastCursorSample = sample, m_HasCursorSample = true;
+	}
+}
+
+void Game::HandleMouseClick(float dt)
+{
+	static const glm::vec2 ring = glm::vec2(RDX * glm::sqrt(0.5f), RDX);
+
+	// Only apply forces when the mouse right-button was clicked.
+	if (!Input::MouseRightButtonClick()) return;
+
+	// Check if mouse is inside the screen. 
+	glm::vec2 cursorPos = glm::floor(ScreenToGrid(Input::CursorPosition()));
+	if (cursorPos.x < 0 || cursorPos.y < 0 || cursorPos.x > m_Width - 1 || cursorPos.y > m_Height - 1) return;
+
+	m_Impulses.AddBurst(cursorPos, 100.0f, ring);
+}
+
+glm::vec2 Game::ScreenToGrid(glm::dvec2 position)
+{
+	glm::dvec2 window = glm::dvec2(Application::WindowWidth(), Application::WindowHeight());
+	position.y = window.y - position.y - 1.0;
+	return glm::vec2(position * glm::dvec2(m_Width, m_Height) / window);
+}
+
+void Game::ApplyImpulses(RowRange rows)
+{
+	m_Impulses.Apply(m_VelocityBuffer, m_ColorBuffer, m_Width, m_Height, rows);
+}
 
 void Game::UpdateVelocityBoundaries()
 {
 	const float scale = -1.0f;
-	// Loop over the x-boundaries.
-	for (int x = 0; x < WIDTH; x++) {
+	// Loop over the x-boundaries. The boundaries of skipped tiles are left as they are.
+	for (int x = 0; x < m_Width; x++) {
 		// Update the boundaries. 
-		m_VelocityBuffer[x + 0 * WIDTH] = m_VelocityBuffer[x + 1 * WIDTH] * scale;
-		m_VelocityBuffer[x + (HEIGHT - 1) * WIDTH] = m_VelocityBuffer[x + (HEIGHT - 2) * WIDTH] * scale;
+		if (!IsSkipped(0)) m_VelocityBuffer[x + 0 * m_Width] = m_VelocityBuffer[x + 1 * m_Width] * scale;
+		if (!IsSkipped(m_Height - 1)) m_VelocityBuffer[x + (size_t)(m_Height - 1) * m_Width] = m_VelocityBuffer[x + (size_t)(m_Height - 2) * m_Width] * scale;
 	}
 	// Loop over the y-boundaries.
-	for (int y = 0; y < HEIGHT; y++) {
+	for (int y = 0; y < m_Height; y++) {
+		if (IsSkipped(y)) continue;
 		// Update the boundaries.
-		m_VelocityBuffer[0 + y * WIDTH] = m_VelocityBuffer[1 + y * WIDTH] * scale;
-		m_VelocityBuffer[(WIDTH - 1) + y * WIDTH] = m_VelocityBuffer[(WIDTH - 2) + y * WIDTH] * scale;
+		m_VelocityBuffer[0 + (size_t)y * m_Width] = m_VelocityBuffer[1 + (size_t)y * m_Width] * scale;
+		m_VelocityBuffer[(m_Width - 1) + (size_t)y * m_Width] = m_VelocityBuffer[(m_Width - 2) + (size_t)y * m_Width] * scale;
 	}
 }
 
-void Game::AdvectVelocity(float dt)
+template<typename T>
+void Game::Advect(float dt, const T* field, T* output, RowRange rows)
 {
-#pragma omp parallel for schedule(dynamic) num_threads(NUM_THREADS)
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
+	using namespace Stencil;
+	Dense<const glm::vec2> w(m_VelocityBuffer, m_Width, m_Height);
+	Run(rows, Assign(Dense<T>(output, m_Width, m_Height), Sample(Dense<const T>(field, m_Width, m_Height), Backtrace(Center(w), dt * RDX))));
+}
 
-			const float fWidth = (float)WIDTH;
-			const float fHeight = (float)HEIGHT;
+void Game::AdvectVelocity(float dt, RowRange rows)
+{
+	Advect(dt, m_VelocityBuffer, m_VelocityOutput, rows);
+}
+
+void Game::DiffuseVelocities(float dt, int sweep, RowRange rows)
+{
+	for (int y = rows.begin; y < rows.end; y++) {
+		const glm::vec2* below = m_VelocityBuffer + (size_t)glm::clamp(y - 1, 0, m_Height - 1) * m_Width;
+		const glm::vec2* above = m_VelocityBuffer + (size_t)glm::clamp(y + 1, 0, m_Height - 1) * m_Width;
+		DiffuseVelocityRow(dt, sweep, y, below, m_VelocityBuffer + (size_t)y * m_Width, above, m_VelocityOutput + (size_t)y * m_Width);
+	}
+}
+
+void Game::DiffuseVelocityRow(float dt, int sweep, int y, const glm::vec2* below, const glm::vec2* center, const glm::vec2* above, glm::vec2* output)
+{
+	float alpha = (DX * DX) / (VISCOSITY * dt);
+	float rBeta = 1.0f / (alpha + 4.0f);
 
-			glm::vec2 pos = glm::vec2(x, y) - dt * RDX * m_VelocityBuffer[x + y * WIDTH];
+	// Chebyshev needs a fixed right-hand side, plain Jacobi keeps relaxing towards the current iterate.
+	const bool chebyshev = m_Relaxation == Relaxation::Chebyshev;
+	const glm::vec2* source = chebyshev ? m_VelocitySource + (size_t)y * m_Width : center;
+	const float omega = chebyshev ? m_DiffusionWeights[sweep] : 1.0f;
 
-			int stx = (int)glm::clamp(floor(pos.x), 0.0f, fWidth - 1.0f);
-			int sty = (int)glm::clamp(floor(pos.y), 0.0f, fHeight - 1.0f);
-			int stz = (int)glm::clamp(stx + 1.0f, 0.0f, fWidth - 1.0f);
-			int stw = (int)glm::clamp(sty + 1.0f, 0.0f, fHeight - 1.0f);
+	for (int x = 0; x < m_Width; x++) {
 
-			glm::vec2 t = glm::vec2(glm::clamp(pos.x - stx, 0.0f, 1.0f), glm::clamp(pos.y - sty, 0.0f, 1.0f));
+		int stx = glm::clamp(x - 1, 0, m_Width - 1);
+		int stz = glm::clamp(x + 1, 0, m_Width - 1);
 
-			glm::vec2 v1 = m_VelocityBuffer[stx + sty * WIDTH];
-			glm::vec2 v2 = m_VelocityBuffer[stz + sty * WIDTH];
-			glm::vec2 v3 = m_VelocityBuffer[stx + stw * WIDTH];
-			glm::vec2 v4 = m_VelocityBuffer[stz + stw * WIDTH];
+		// Retrieve the four samples.
+		glm::vec2 xL = center[stx];
+		glm::vec2 xR = center[stz];
+		glm::vec2 xB = below[x];
+		glm::vec2 xT = above[x];
 
-			m_VelocityOutput[x + y * WIDTH] = glm::lerp(glm::lerp(v1, v2, t.x), glm::lerp(v3, v4, t.x), t.y);
+		// Sample b from the center.
+		glm::vec2 bC = source[x];
+
+		// Evaluate the Jacobi iteration, extrapolated from the previous iterate.
+		glm::vec2 jacobi = (xL + xR + xB + xT + alpha * bC) * rBeta;
+		if (omega == 1.0f) output[x] = jacobi;
+		else {
+			glm::vec2 previous = m_VelocityPrevious[x + (size_t)y * m_Width];
+			output[x] = previous + omega * (jacobi - previous);
 		}
 	}
 }
 
-void Game::DiffuseVelocities(float dt)
+void Game::ComputeDivergence(RowRange rows)
 {
-	float alpha = (DX * DX) / (VISCOSITY * dt);
-	float rBeta = 1.0f / (alpha + 4.0f);
+	using namespace Stencil;
+	Dense<glm::vec2> w(m_VelocityBuffer, m_Width, m_Height);
+	const uchar* solid = ObstacleMask(rows);
+	if (!solid) {
+		Run(rows, Assign(Dense<float>(m_DivergenceBuffer, m_Width, m_Height), HALFDX * ((X(Right(w)) - X(Left(w))) + (Y(Above(w)) - Y(Below(w))))));
+		return;
+	}
 
-#pragma omp parallel for schedule(dynamic) num_threads(NUM_THREADS)
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
+	// Solid cells move with their obstacle, the divergence sees the obstacle's velocity instead of the field's.
+	auto velocity = [&](int x, int y) {
+		x = glm::clamp(x, 0, m_Width - 1), y = glm::clamp(y, 0, m_Height - 1);
+		const size_t i = x + (size_t)y * m_Width;
+		return solid[i] ? m_Obstacles->VelocityAt(x, y) : m_VelocityBuffer[i];
+	};
+	for (int y = rows.begin; y < rows.end; y++)
+		for (int x = 0; x < m_Width; x++)
+			m_DivergenceBuffer[x + (size_t)y * m_Width] = HALFDX * ((velocity(x + 1, y).x - velocity(x - 1, y).x) + (velocity(x, y + 1).y - velocity(x, y - 1).y));
+}
 
-			int stx = glm::clamp(x - 1, 0, WIDTH - 1);
-			int sty = glm::clamp(y - 1, 0, HEIGHT - 1);
-			int stz = glm::clamp(x + 1, 0, WIDTH - 1);
-			int stw = glm::clamp(y + 1, 0, HEIGHT - 1);
+void Game::ComputePressure(int sweep, RowRange rows)
+{
+	for (int y = rows.begin; y < rows.end; y++) {
+		const float* below = m_PressureBuffer + (size_t)glm::clamp(y - 1, 0, m_Height - 1) * m_Width;
+		const float* above = m_PressureBuffer + (size_t)glm::clamp(y + 1, 0, m_Height - 1) * m_Width;
+		ComputePressureRow(sweep, y, below, m_PressureBuffer + (size_t)y * m_Width, above, m_PressureOutput + (size_t)y * m_Width);
+	}
+}
 
-			// Retrieve the four samples.
-			glm::vec2 xL = m_VelocityBuffer[stx + y * WIDTH];
-			glm::vec2 xR = m_VelocityBuffer[stz + y * WIDTH];
-			glm::vec2 xB = m_VelocityBuffer[x + sty * WIDTH];
-			glm::vec2 xT = m_VelocityBuffer[x + stw * WIDTH];
+void Game::ComputePressureRow(int sweep, int y, const float* below, const float* center, const float* above, float* output)
+{
+	float alpha = -1.0f * (DX * DX);
+	float rBeta = 0.25f;
+	const float omega = m_Relaxation == Relaxation::Chebyshev ? m_PressureWeights[sweep] : 1.0f;
+
+	const uchar* solid = ObstacleMask({ y, y + 1 });
+	const size_t row = (size_t)y * m_Width;
+	const size_t rowBelow = (size_t)glm::max(y - 1, 0) * m_Width, rowAbove = (size_t)glm::min(y + 1, m_Height - 1) * m_Width;
+
+	for (int x = 0; x < m_Width; x++) {
+		int stx = glm::clamp(x - 1, 0, m_Width - 1);
+		int stz = glm::clamp(x + 1, 0, m_Width - 1);
+
+		// Retrieve the four samples.
+		float xL = center[stx];
+		float xR = center[stz];
+		float xB = below[x];
+		float xT = above[x];
+
+		// Solid neighbours take the pressure of the cell, no gradient drives flow into an obstacle.
+		if (solid) {
+			if (solid[stx + row]) xL = center[x];
+			if (solid[stz + row]) xR = center[x];
+			if (solid[x + rowBelow]) xB = center[x];
+			if (solid[x + rowAbove]) xT = center[x];
+		}
 
-			// Sample b from the center.
-			glm::vec2 bC = m_VelocityBuffer[x + y * WIDTH];
+		// Sample b from the center.
+		float bC = m_DivergenceBuffer[x + (size_t)y * m_Width];
 
-			// Evaluate the Jacobi iteration. 
-			m_VelocityOutput[x + y * WIDTH] = (xL + xR + xB + xT + alpha * bC) * rBeta;
+		// Evaluate the Jacobi iteration, extrapolated from the previous iterate.
+		float jacobi = (xL + xR + xB + xT + alpha * bC) * rBeta;
+		if (omega == 1.0f) output[x] = jacobi;
+		else {
+			float previous = m_PressurePrevious[x + (size_t)y * m_Width];
+			output[x] = previous + omega * (jacobi - previous);
 		}
 	}
 }
 
-void Game::ComputeDivergence()
+void Game::Restrict(const float* field, RowRange coarseRows)
 {
-#pragma omp parallel for schedule(dynamic) num_threads(NUM_THREADS)
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
-			int stx = glm::clamp(x - 1, 0, WIDTH - 1);
-			int sty = glm::clamp(y - 1, 0, HEIGHT - 1);
-			int stz = glm::clamp(x + 1, 0, WIDTH - 1);
-			int stw = glm::clamp(y + 1, 0, HEIGHT - 1);
+	const int f = CoarseScale();
+
+	// Average the fine cells covered by a coarse cell.
+	for (int y = coarseRows.begin; y < coarseRows.end; y++) {
+		for (int x = 0; x < m_CoarseWidth; x++) {
+			int fx1 = glm::min((x + 1) * f, m_Width), fy1 = glm::min((y + 1) * f, m_Height);
 
-			glm::vec2 wL = m_VelocityBuffer[stx + y * WIDTH];
-			glm::vec2 wR = m_VelocityBuffer[stz + y * WIDTH];
-			glm::vec2 wB = m_VelocityBuffer[x + sty * WIDTH];
-			glm::vec2 wT = m_VelocityBuffer[x + stw * WIDTH];
+			float sum = 0.0f;
+			for (int fy = y * f; fy < fy1; fy++)
+				for (int fx = x * f; fx < fx1; fx++) sum += field[fx + (size_t)fy * m_Width];
 
-			m_DivergenceBuffer[x + y * WIDTH] = HALFDX * ((wR.x - wL.x) + (wT.y - wB.y));
+			m_CoarseDivergence[x + y * m_CoarseWidth] = sum / (float)((fx1 - x * f) * (fy1 - y * f));
 		}
 	}
 }
 
-void Game::ComputePressure()
+void Game::ComputeCoarsePressure(RowRange coarseRows)
 {
-	float alpha = -1.0f * (DX * DX);
+	// Same iteration as ComputePressure with the coarse cell size.
+	float alpha = -1.0f * (CoarseScale() * DX) * (CoarseScale() * DX);
 	float rBeta = 0.25f;
 
-#pragma omp parallel for schedule(dynamic) num_threads(NUM_THREADS)
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
-			int stx = glm::clamp(x - 1, 0, WIDTH - 1);
-			int sty = glm::clamp(y - 1, 0, HEIGHT - 1);
-			int stz = glm::clamp(x + 1, 0, WIDTH - 1);
-			int stw = glm::clamp(y + 1, 0, HEIGHT - 1);
-
-			// Retrieve the four samples.
-			float xL = m_PressureBuffer[stx + y * WIDTH];
-			float xR = m_PressureBuffer[stz + y * WIDTH];
-			float xB = m_PressureBuffer[x + sty * WIDTH];
-			float xT = m_PressureBuffer[x + stw * WIDTH];
+	for (int y = coarseRows.begin; y < coarseRows.end; y++) {
+		for (int x = 0; x < m_CoarseWidth; x++) {
+			int stx = glm::clamp(x - 1, 0, m_CoarseWidth - 1);
+			int sty = glm::clamp(y - 1, 0, m_CoarseHeight - 1);
+			int stz = glm::clamp(x + 1, 0, m_CoarseWidth - 1);
+			int stw = glm::clamp(y + 1, 0, m_CoarseHeight - 1);
 
-			// Sample b from the center.
-			float bC = m_DivergenceBuffer[x + y * WIDTH];
+			float xL = m_CoarsePressure[stx + y * m_CoarseWidth];
+			float xR = m_CoarsePressure[stz + y * m_CoarseWidth];
+			float xB = m_CoarsePressure[x + sty * m_CoarseWidth];
+			float xT = m_CoarsePressure[x + stw * m_CoarseWidth];
+			float bC = m_CoarseDivergence[x + y * m_CoarseWidth];
 
-			// Evaluate the Jacobi iteration. 
-			m_PressureOutput[x + y * WIDTH] = (xL + xR + xB + xT + alpha * bC) * rBeta;
+			m_CoarsePressureOutput[x + y * m_CoarseWidth] = (xL + xR + xB + xT + alpha * bC) * rBeta;
 		}
 	}
+}
 
+void Game::CommitCoarsePressure(RowRange coarseRows)
+{
+	memcpy(m_CoarsePressure + coarseRows.begin * m_CoarseWidth, m_CoarsePressureOutput + coarseRows.begin * m_CoarseWidth,
+		sizeof(float) * m_CoarseWidth * (coarseRows.end - coarseRows.begin));
 }
 
-void Game::UpdatePressureBoundaries()
+float Game::SampleCoarsePressure(int x, int y) const
 {
-	const float scale = 1.0f;
-	// Loop over the x-boundaries.
-	for (int x = 0; x < WIDTH; x++) {
-		// Update the boundaries. 
-		m_PressureBuffer[x + 0 * WIDTH] = m_PressureBuffer[x + 1 * WIDTH] * scale;
-		m_PressureBuffer[x + (HEIGHT - 1) * WIDTH] = m_PressureBuffer[x + (HEIGHT - 2) * WIDTH] * scale;
+	const float f = (float)CoarseScale();
+
+	// Bilinear interpolation between the coarse cell centers.
+	float cy = glm::clamp((y + 0.5f) / f - 0.5f, 0.0f, m_CoarseHeight - 1.0f);
+	int y0 = (int)cy, y1 = glm::min(y0 + 1, m_CoarseHeight - 1);
+	float ty = cy - y0;
+
+	float cx = glm::clamp((x + 0.5f) / f - 0.5f, 0.0f, m_CoarseWidth - 1.0f);
+	int x0 = (int)cx, x1 = glm::min(x0 + 1, m_CoarseWidth - 1);
+	float tx = cx - x0;
+
+	float bottom = glm::mix(m_CoarsePressure[x0 + y0 * m_CoarseWidth], m_CoarsePressure[x1 + y0 * m_CoarseWidth], tx);
+	float top = glm::mix(m_CoarsePressure[x0 + y1 * m_CoarseWidth], m_CoarsePressure[x1 + y1 * m_CoarseWidth], tx);
+	return glm::mix(bottom, top, ty);
+}
+
+void Game::ProlongatePressure(RowRange rows)
+{
+	for (int y = rows.begin; y < rows.end; y++)
+		for (int x = 0; x < m_Width; x++) m_PressureBuffer[x + (size_t)y * m_Width] = SampleCoarsePressure(x, y);
+}
+
+int Game::SchwarzIterations(int sweeps) const
+{
+	return (sweeps + SCHWARZ_SWEEPS - 1) / SCHWARZ_SWEEPS;
+}
+
+bool Game::SchwarzCorrects(int iteration) const
+{
+	// A pressure just prolongated from the coarse projection has no coarse error left to correct.
+	if (iteration == 0 && m_ProjectionScale > 1) return false;
+	return iteration % SCHWARZ_CORRECTION_INTERVAL == 0;
+}
+
+void Game::SolvePressureSchwarz(WorkerPool* pool, uint thread, int sweeps)
+{
+	RowRange rows = pool->Rows(thread, m_Height);
+	RowRange band = SchwarzBand(thread, pool->Size());
+
+	for (int k = 0; k < SchwarzIterations(sweeps); k++) {
+		if (SchwarzCorrects(k)) {
+			ComputePressureResidual(rows);
+			pool->Sync(thread);
+			Restrict(m_PressureOutput, pool->Rows(thread, m_CoarseHeight));
+			pool->Sync(thread);
+			if (thread == 0) SolveCoarseCorrection();
+			pool->Sync(thread);
+			ProlongateCorrection(rows);
+			pool->Sync(thread);
+		}
+		// The local solves of an iteration need no barrier between them, only one before they are committed.
+		SolvePressureTiles(band, thread);
+		pool->Sync(thread);
+		CopyRows(m_PressureBuffer, m_PressureOutput, band);
+		pool->Sync(thread);
 	}
-	// Loop over the y-boundaries.
-	for (int y = 0; y < HEIGHT; y++) {
-		// Update the boundaries.
-		m_PressureBuffer[0 + y * WIDTH] = m_PressureBuffer[1 + y * WIDTH] * scale;
-		m_PressureBuffer[(WIDTH - 1) + y * WIDTH] = m_PressureBuffer[(WIDTH - 2) + y * WIDTH] * scale;
+}
+
+RowRange Game::SchwarzBand(int band, int bands) const
+{
+	// Whole tiles per band, so every tile is solved alike whichever thread owns it.
+	const int tileCount = (m_Height + TILE_ROWS - 1) / TILE_ROWS;
+	const int bandRows = (tileCount + bands - 1) / bands * TILE_ROWS;
+	return { glm::min(band * bandRows, m_Height), glm::min((band + 1) * bandRows, m_Height) };
+}
+
+void Game::SolvePressureTiles(RowRange rows, int window)
+{
+	float* windows = m_SchwarzWindows + 2 * window * m_SchwarzWindowSize;
+
+	for (int tile = rows.begin; tile < rows.end; tile += TILE_ROWS) {
+		const int tileEnd = glm::min(tile + TILE_ROWS, m_Height);
+		const int y0 = glm::max(tile - SCHWARZ_OVERLAP, 0), y1 = glm::min(tileEnd + SCHWARZ_OVERLAP, m_Height);
+		// The window's edge rows are the tile's boundary condition, except at the edges of the grid.
+		const int r0 = y0 == 0 ? 0 : y0 + 1, r1 = y1 == m_Height ? m_Height : y1 - 1;
+
+		float* window = windows, * output = windows + m_SchwarzWindowSize;
+		const size_t size = sizeof(float) * (y1 - y0) * m_Width;
+		memcpy(window, m_PressureBuffer + (size_t)y0 * m_Width, size);
+		memcpy(output, window, size);
+
+		for (int i = 0; i < SCHWARZ_SWEEPS; i++) {
+			for (int y = r0; y < r1; y++) {
+				const float* center = window + (size_t)(y - y0) * m_Width;
+				const float* below = y > 0 ? center - m_Width : center;
+				const float* above = y < m_Height - 1 ? center + m_Width : center;
+				ComputePressureRow(i, y, below, center, above, output + (size_t)(y - y0) * m_Width);
+			}
+			std::swap(window, output);
+		}
+
+		// The overlap belongs to the neighbouring tiles, only the tile's own rows are kept.
+		memcpy(m_PressureOutput + (size_t)tile * m_Width, window + (size_t)(tile - y0) * m_Width, sizeof(float) * (tileEnd - tile) * m_Width);
 	}
 }
 
-void Game::SubtractPressureGradient()
+void Game::ComputePressureResidual(RowRange rows)
 {
-#pragma omp parallel for schedule(dynamic) num_threads(NUM_THREADS)
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
+	// Residual of 4 p - sum(neighbours) = alpha * b, divided by alpha.
+	using namespace Stencil;
+	Dense<float> p(m_PressureBuffer, m_Width, m_Height), b(m_DivergenceBuffer, m_Width, m_Height);
+	const uchar* solid = ObstacleMask(rows);
+	if (!solid) {
+		Run(rows, Assign(Dense<float>(m_PressureOutput, m_Width, m_Height), Center(b) - RDX * RDX * (Left(p) + Right(p) + Below(p) + Above(p) - 4.0f * Center(p))));
+		return;
+	}
 
-			int stx = glm::clamp(x - 1, 0, WIDTH - 1);
-			int sty = glm::clamp(y - 1, 0, HEIGHT - 1);
-			int stz = glm::clamp(x + 1, 0, WIDTH - 1);
-			int stw = glm::clamp(y + 1, 0, HEIGHT - 1);
+	// The operator of ComputePressureRow, solid neighbours take the pressure of the cell.
+	for (int y = rows.begin; y < rows.end; y++) {
+		const size_t row = (size_t)y * m_Width;
+		const size_t rowBelow = (size_t)glm::max(y - 1, 0) * m_Width, rowAbove = (size_t)glm::min(y + 1, m_Height - 1) * m_Width;
 
-			float pL = m_PressureBuffer[stx + y * WIDTH];
-			float pR = m_PressureBuffer[stz + y * WIDTH];
-			float pB = m_PressureBuffer[x + sty * WIDTH];
-			float pT = m_PressureBuffer[x + stw * WIDTH];
+		for (int x = 0; x < m_Width; x++) {
+			int stx = glm::clamp(x - 1, 0, m_Width - 1);
+			int stz = glm::clamp(x + 1, 0, m_Width - 1);
 
-			m_VelocityBuffer[x + y * WIDTH] = m_VelocityBuffer[x + y * WIDTH] - HALFDX * glm::vec2(pR - pL, pT - pB);
+			float pC = m_PressureBuffer[x + row];
+			float xL = solid[stx + row] ? pC : m_PressureBuffer[stx + row];
+			float xR = solid[stz + row] ? pC : m_PressureBuffer[stz + row];
+			float xB = solid[x + rowBelow] ? pC : m_PressureBuffer[x + rowBelow];
+			float xT = solid[x + rowAbove] ? pC : m_PressureBuffer[x + rowAbove];
+
+			m_PressureOutput[x + row] = m_DivergenceBuffer[x + row] - RDX * RDX * (xL + xR + xB + xT - 4.0f * pC);
 		}
 	}
 }
 
-void Game::UpdateColorBoundaries()
+void Game::SolveCoarseCorrection()
 {
-	const float scale = 0.0f;
-	// Loop over the x-boundaries.
-	for (int x = 0; x < WIDTH; x++) {
+	// Same equation as ComputeCoarsePressure for the correction, from zero. A single thread solves it in place.
+	float alpha = -1.0f * (CoarseScale() * DX) * (CoarseScale() * DX);
+	float rBeta = 0.25f;
+	memset(m_CoarsePressure, 0, sizeof(float) * m_CoarseWidth * m_CoarseHeight);
+
+	for (int i = 0; i < SCHWARZ_COARSE_SWEEPS; i++) {
+		for (int y = 0; y < m_CoarseHeight; y++) {
+			for (int x = 0; x < m_CoarseWidth; x++) {
+				int stx = glm::clamp(x - 1, 0, m_CoarseWidth - 1);
+				int sty = glm::clamp(y - 1, 0, m_CoarseHeight - 1);
+				int stz = glm::clamp(x + 1, 0, m_CoarseWidth - 1);
+				int stw = glm::clamp(y + 1, 0, m_CoarseHeight - 1);
+
+				float xL = m_CoarsePressure[stx + y * m_CoarseWidth];
+				float xR = m_CoarsePressure[stz + y * m_CoarseWidth];
+				float xB = m_CoarsePressure[x + sty * m_CoarseWidth];
+				float xT = m_CoarsePressure[x + stw * m_CoarseWidth];
+				float bC = m_CoarseDivergence[x + y * m_CoarseWidth];
+
+				float& e = m_CoarsePressure[x + y * m_CoarseWidth];
+				e += SCHWARZ_COARSE_OMEGA * ((xL + xR + xB + xT + alpha * bC) * rBeta - e);
+			}
+		}
+	}
+}
+
+void Game::ProlongateCorrection(RowRange rows)
+{
+	for (int y = rows.begin; y < rows.end; y++)
+		for (int x = 0; x < m_Width; x++) m_PressureBuffer[x + (size_t)y * m_Width] += SampleCoarsePressure(x, y);
+}
+
+void Game::SolvePressureDirect(int stage, RowRange part)
+{
+	// Same system as the Jacobi sweeps, 4 p - sum(neighbours) = alpha * b.
+	if (m_ProjectionScale > 1) {
+		float h = m_ProjectionScale * DX;
+		m_DirectSolver->SolveStage(stage, part, m_CoarseDivergence, -1.0f * h * h, m_CoarsePressure);
+	}
+	else m_DirectSolver->SolveStage(stage, part, m_DivergenceBuffer + 1 + m_Width, -1.0f * (DX * DX), m_PressureBuffer + 1 + m_Width);
+}
+
+void Game::UpdatePressureBoundaries()
+{
+	const float scale = 1.0f;
+	// Loop over the x-boundaries. The boundaries of skipped tiles are left as they are.
+	for (int x = 0; x < m_Width; x++) {
 		// Update the boundaries. 
-		m_ColorBuffer[x + 0 * WIDTH] = m_ColorBuffer[x + 1 * WIDTH] * scale;
-		m_ColorBuffer[x + (HEIGHT - 1) * WIDTH] = m_ColorBuffer[x + (HEIGHT - 2) * WIDTH] * scale;
+		if (!IsSkipped(0)) m_PressureBuffer[x + 0 * m_Width] = m_PressureBuffer[x + 1 * m_Width] * scale;
+		if (!IsSkipped(m_Height - 1)) m_PressureBuffer[x + (size_t)(m_Height - 1) * m_Width] = m_PressureBuffer[x + (size_t)(m_Height - 2) * m_Width] * scale;
 	}
 	// Loop over the y-boundaries.
-	for (int y = 0; y < HEIGHT; y++) {
+	for (int y = 0; y < m_Height; y++) {
+		if (IsSkipped(y)) continue;
 		// Update the boundaries.
-		m_ColorBuffer[0 + y * WIDTH] = m_ColorBuffer[1 + y * WIDTH] * scale;
-		m_ColorBuffer[(WIDTH - 1) + y * WIDTH] = m_ColorBuffer[(WIDTH - 2) + y * WIDTH] * scale;
+		m_PressureBuffer[0 + (size_t)y * m_Width] = m_PressureBuffer[1 + (size_t)y * m_Width] * scale;
+		m_PressureBuffer[(m_Width - 1) + (size_t)y * m_Width] = m_PressureBuffer[(m_Width - 2) + (size_t)y * m_Width] * scale;
 	}
 }
 
-void Game::AdvectColors(float dt)
+void Game::SubtractPressureGradient(RowRange rows)
 {
-#pragma omp parallel for schedule(dynamic) num_threads(NUM_THREADS)
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
+	using namespace Stencil;
+	Dense<glm::vec2> w(m_VelocityBuffer, m_Width, m_Height);
+	Dense<float> p(m_PressureBuffer, m_Width, m_Height);
+	const uchar* solid = ObstacleMask(rows);
+	if (!solid) {
+		Run(rows, Assign(w, Center(w) - HALFDX * Vec2(Right(p) - Left(p), Above(p) - Below(p))));
+		return;
+	}
 
-			static const float fWidth = (float)WIDTH;
-			static const float fHeight = (float)HEIGHT;
+	// Solid cells take the velocity of their obstacle, solid neighbours the pressure of the cell like in the solve.
+	for (int y = rows.begin; y < rows.end; y++)
+		for (int x = 0; x < m_Width; x++) {
+			const size_t i = x + (size_t)y * m_Width;
+			if (solid[i]) {
+				m_VelocityBuffer[i] = m_Obstacles->VelocityAt(x, y);
+				continue;
+			}
+			auto pressure = [&](int sx, int sy) {
+				const size_t j = glm::clamp(sx, 0, m_Width - 1) + (size_t)glm::clamp(sy, 0, m_Height - 1) * m_Width;
+				return solid[j] ? m_PressureBuffer[i] : m_PressureBuffer[j];
+			};
+			m_VelocityBuffer[i] -= HALFDX * glm::vec2(pressure(x + 1, y) - pressure(x - 1, y), pressure(x, y + 1) - pressure(x, y - 1));
+		}
+}
 
-			glm::vec2 pos = glm::vec2(x, y) - dt * RDX * m_VelocityBuffer[x + y * WIDTH];
+void Game::ComputeVorticity(RowRange rows)
+{
+	using namespace Stencil;
+	Dense<glm::vec2> w(m_VelocityBuffer, m_Width, m_Height);
+	Run(rows, Assign(Dense<float>(m_PressureOutput, m_Width, m_Height), 0.5f * RDX * ((Y(Right(w)) - Y(Left(w))) - (X(Above(w)) - X(Below(w))))));
+}
 
-			int stx = (int)glm::clamp(floor(pos.x), 0.0f, fWidth - 1.0f);
-			int sty = (int)glm::clamp(floor(pos.y), 0.0f, fHeight - 1.0f);
-			int stz = (int)glm::clamp(stx + 1.0f, 0.0f, fWidth - 1.0f);
-			int stw = (int)glm::clamp(sty + 1.0f, 0.0f, fHeight - 1.0f);
+void Game::DiffuseVorticity(float dt, RowRange rows)
+{
+	// Plain Jacobi towards the current iterate, like the velocity's sweeps.
+	const float alpha = (DX * DX) / (VISCOSITY * dt);
+	const float rBeta = 1.0f / (alpha + 4.0f);
 
-			glm::vec2 t = glm::vec2(glm::clamp(pos.x - stx, 0.0f, 1.0f), glm::clamp(pos.y - sty, 0.0f, 1.0f));
+	using namespace Stencil;
+	Dense<float> omega(m_DivergenceBuffer, m_Width, m_Height);
+	Run(rows, Assign(Dense<float>(m_PressureOutput, m_Width, m_Height), (Left(omega) + Right(omega) + Below(omega) + Above(omega) + alpha * Center(omega)) * rBeta));
+}
 
-			glm::vec4 v1 = m_ColorBuffer[stx + sty * WIDTH];
-			glm::vec4 v2 = m_ColorBuffer[stz + sty * WIDTH];
-			glm::vec4 v3 = m_ColorBuffer[stx + stw * WIDTH];
-			glm::vec4 v4 = m_ColorBuffer[stz + stw * WIDTH];
+void Game::AddImpulseVorticity(RowRange rows)
+{
+	// The curl is linear, the curl of the impulses is the change of the velocity's curl.
+	using namespace Stencil;
+	Dense<glm::vec2> w(m_VelocityBuffer, m_Width, m_Height);
+	Dense<float> omega(m_DivergenceBuffer, m_Width, m_Height), before(m_PressureOutput, m_Width, m_Height);
+	Run(rows, Assign(omega, Center(omega) + 0.5f * RDX * ((Y(Right(w)) - Y(Left(w))) - (X(Above(w)) - X(Below(w)))) - Center(before)));
+}
 
-			m_ColorOutput[x + y * WIDTH] = glm::lerp(glm::lerp(v1, v2, t.x), glm::lerp(v3, v4, t.x), t.y);
-		}
+void Game::UpdateStreamFunctionBoundaries(RowRange rows)
+{
+	// The walls are a single streamline, the stream function is zero along all of them.
+	for (int y = rows.begin; y < rows.end; y++) {
+		if (y == 0 || y == m_Height - 1) memset(m_PressureBuffer + (size_t)y * m_Width, 0, sizeof(float) * m_Width);
+		m_PressureBuffer[0 + (size_t)y * m_Width] = m_PressureBuffer[(m_Width - 1) + (size_t)y * m_Width] = 0.0f;
+	}
+}
+
+void Game::ComputeStreamFunctionVelocity(RowRange rows)
+{
+	// With the Laplacian of the stream function equal to the vorticity, the velocity is its rotated gradient.
+	using namespace Stencil;
+	Dense<float> p(m_PressureBuffer, m_Width, m_Height);
+	Run(rows, Assign(Dense<glm::vec2>(m_VelocityBuffer, m_Width, m_Height), 0.5f * RDX * Vec2(Below(p) - Above(p), Right(p) - Left(p))));
+}
+
+void Game::UpdateColorBoundaries()
+{
+	const float scale = 0.0f;
+	// Loop over the x-boundaries. The boundaries of skipped tiles are left as they are.
+	for (int x = 0; x < m_Width; x++) {
+		// Update the boundaries. 
+		if (!IsSkipped(0)) m_ColorBuffer[x + 0 * m_Width] = m_ColorBuffer[x + 1 * m_Width] * scale;
+		if (!IsSkipped(m_Height - 1)) m_ColorBuffer[x + (size_t)(m_Height - 1) * m_Width] = m_ColorBuffer[x + (size_t)(m_Height - 2) * m_Width] * scale;
+	}
+	// Loop over the y-boundaries.
+	for (int y = 0; y < m_Height; y++) {
+		if (IsSkipped(y)) continue;
+		// Update the boundaries.
+		m_ColorBuffer[0 + (size_t)y * m_Width] = m_ColorBuffer[1 + (size_t)y * m_Width] * scale;
+		m_ColorBuffer[(m_Width - 1) + (size_t)y * m_Width] = m_ColorBuffer[(m_Width - 2) + (size_t)y * m_Width] * scale;
 	}
-}
\ No newline at end of file
+}
+
+void Game::AdvectColors(float dt, RowRange rows)
+{
+	Advect(dt, m_ColorBuffer, m_ColorOutput, rows);
+
+	// The obstacles displace the dye.
+	const uchar* solid = ObstacleMask(rows);
+	if (!solid) return;
+	for (int y = rows.begin; y < rows.end; y++)
+		for (int x = 0; x < m_Width; x++)
+			if (solid[x + (size_t)y * m_Width]) m_ColorOutput[x + (size_t)y * m_Width] = glm::vec4(0.0f);
+}
@@ -1,5 +1,64 @@
 #pragma once
+#include <atomic>
+#include <thread>
 #include "Template/Application.h"
+#include "Simulation/Arena.h"
+#include "Simulation/TaskGraph.h"
+#include "Simulation/Impulse.h"
+#include "Simulation/Volume.h"
+#include "Simulation/Relaxation.h"
+#include "Simulation/Cholesky.h"
+#include "Simulation/Lattice.h"
+#include "Simulation/Sph.h"
+#include "Simulation/Flip.h"
+#include "Simulation/Tracers.h"
+#include "Simulation/ColdTiles.h"
+#include "Simulation/Obstacles.h"
+#include "Simulation/Ensemble.h"
+
+/*
+* Number of cells along each axis of the volume preview.
+*/
+#define VOLUME_PREVIEW_SIZE 128
+/*
+* Number of cells along each axis of the ensemble preview, its default number of members and the default
+* spread of their viscosity relative to VISCOSITY.
+*/
+#define ENSEMBLE_PREVIEW_SIZE 256
+#define ENSEMBLE_MEMBERS 8
+#define ENSEMBLE_VISCOSITY_SPREAD 0.5f
+/*
+* Default number of lattice Boltzmann steps per frame.
+*/
+#define LATTICE_SUBSTEPS 16
+/*
+* Number of particles of the SPH liquid and its default number of steps per frame.
+*/
+#define SPH_PARTICLES (1 << 20)
+#define SPH_SUBSTEPS 4
+/*
+* Number of tracer particles drawn over the flow.
+*/
+#define TRACER_COUNT (1 << 21)
+/*
+* Largest grid, as a power-of-two multiple of the window size along each axis. 16 times 1024 is 16k x 16k cells,
+* roughly 25 GB of fields; every index into a field is 64-bit, so the limit is memory rather than int range.
+*/
+#define MAX_GRID_SCALE 16
+/*
+* Largest grid scales with a direct pressure solve, and with the lattice Boltzmann and FLIP engines. The fill of
+* the factorization and the distributions and particles per cell outgrow the fields long before MAX_GRID_SCALE.
+*/
+#define MAX_DIRECT_GRID_SCALE 1
+#define MAX_ENGINE_GRID_SCALE 2
+/*
+* Consecutive steps a tile and the tiles its step reads must stay unchanged before it is compressed.
+*/
+#define COLD_TILE_STEPS 64
+/*
+* Number of configurations the determinism check runs the step in.
+*/
+#define DETERMINISM_CASES 14
 
 class Game
 {
@@ -10,17 +69,245 @@ public:
 	void Tick(float dt);
 	void Draw(float dt);
 	void RenderGUI(float dt);
+	/*
+	* Draws on top of the rendered screen surface, before the GUI.
+	*/
+	void DrawOverlay(float dt);
+
+	/*
+	* Indicates whether the fluid has settled and the simulation is skipped until new input arrives.
+	*/
+	bool IsQuiescent() const { return m_Quiescent; }
+
+	/*
+	* Resizes the simulation grid, re-lays out all buffers in the arena and resets the simulation.
+	* @param[in] width			Number of grid cells in x-direction.
+	* @param[in] height			Number of grid cells in y-direction.
+	*/
+	void Resize(int width, int height);
+
+	/*
+	* Retrieves the name of a configuration of the determinism check.
+	*/
+	static const char* DeterminismCaseName(int determinismCase);
+	/*
+	* Runs the scripted impulses through a number of steps of a configuration in the deterministic mode, without
+	* input or drawing.
+	* @param[in] determinismCase	Index of the configuration, below DETERMINISM_CASES.
+	* @param[in] steps				Number of steps.
+	* @returns						Hash of the resulting state.
+	*/
+	uint64_t RunDeterminismCase(int determinismCase, int steps);
+	/*
+	* Hashes the velocity, pressure and dye with 64-bit FNV-1a over their 32-bit words, or the fields of the volume
+	* or ensemble preview when it runs instead.
+	*/
+	uint64_t StateHash() const;
 
 private:
+	/*
+	* Simulation grid dimensions.
+	*/
+	int m_Width = WIDTH, m_Height = HEIGHT;
+	/*
+	* Arena holding all simulation fields and scratch buffers.
+	*/
+	Arena m_Arena;
+
+	/*
+	* Time step as a graph of per-tile tasks, executed instead of the phase-by-phase step when enabled.
+	*/
+	TaskGraph m_StepGraph;
+	bool m_Dataflow = true;
+	/*
+	* Makes the fields bitwise identical whatever the number of threads: every thread runs with the same SSE
+	* control register and the reductions combine partials of fixed blocks pairwise. The kernels already write
+	* each cell from the previous fields only, so how the rows are split does not change their results.
+	*/
+	bool m_Deterministic = false;
+	/*
+	* Hash of the state shown by the GUI, taken on request.
+	*/
+	uint64_t m_StateHash = 0;
+	/*
+	* Time-step of the step currently executed by the graph.
+	*/
+	float m_StepDt = 0.0f;
+
+	/*
+	* Iteration and number of sweeps of the diffusion and the pressure solve. Changing the number of sweeps
+	* requires rebuilding the step graph.
+	*/
+	Relaxation m_Relaxation = Relaxation::Jacobi;
+	int m_Sweeps = 8;
+	/*
+	* Relaxation the fields were laid out for, the previous iterates are only allocated for the Chebyshev
+	* iteration.
+	*/
+	bool m_LaidOutChebyshev = false;
+	/*
+	* Chebyshev weight per sweep, the diffusion weights depend on the time-step.
+	*/
+	std::vector<float> m_PressureWeights, m_DiffusionWeights;
+	/*
+	* Factor by which the pressure grid is coarser than the simulation grid, 1, 2 or 4. A coarse solution is
+	* prolongated and corrected with a few full-resolution sweeps. Changing it requires rebuilding the step graph.
+	*/
+	int m_ProjectionScale = 1;
+	/*
+	* Dimensions of the coarse grid, at the projection scale or, at full resolution, at the scale of the Schwarz
+	* coarse correction.
+	*/
+	int m_CoarseWidth = 0, m_CoarseHeight = 0;
+	/*
+	* Direct solver of the pressure on the projection grid, replacing its Jacobi sweeps while it exists. Created
+	* when enabled and recreated whenever the projection grid changes.
+	*/
+	CholeskySolver* m_DirectSolver = nullptr;
+	bool m_DirectPressure = false;
+	/*
+	* Thread factorizing the next direct solver, which is adopted once it is ready. A factorization requested
+	* while another one runs starts when that one finished, whose result is then discarded.
+	*/
+	std::thread m_SolverBuilder;
+	CholeskySolver* m_BuiltSolver = nullptr;
+	std::atomic<bool> m_SolverBuilt = false;
+	bool m_SolverStale = false;
+	/*
+	* Runs the full-resolution sweeps in place, streaming each band of rows through a few lines instead of
+	* writing full-size output fields. Changing it requires re-laying out the fields and rebuilding the step graph.
+	*/
+	bool m_Streaming = false;
+	/*
+	* Whether the fields were laid out for streaming sweeps. The velocity and pressure outputs then have no
+	* storage of their own, they share the color output's, and are only written once the colors were committed.
+	*/
+	bool m_LaidOutStreaming = false;
+
+	/*
+	* Tiles of the step graph that stayed at rest long enough are compressed and skipped by the step. A tile
+	* stays frozen until an impulse lands on it or a neighbouring tile reads it, which thaws it on access.
+	*/
+	ColdTiles m_ColdTiles;
+	bool m_CompressColdTiles = false;
+	int m_ColdTileSteps = COLD_TILE_STEPS;
+	/*
+	* Per tile the number of consecutive steps it was at rest and left bitwise unchanged, and the hash of its
+	* state after the previous step.
+	*/
+	std::vector<int> m_QuietSteps;
+	std::vector<uint64_t> m_TileHashes;
+	/*
+	* Per tile whether the current step skips it, the frozen tiles at the start of the step. Empty while the
+	* cold tiles are not in use.
+	*/
+	std::vector<uchar> m_SkipTiles;
+
+	/*
+	* Kinetic energy and change of the dye since the previous measurement, sampled every few frames. When both
+	* stay below their thresholds the game turns quiescent and skips the simulation until new input arrives.
+	*/
+	struct Activity {
+		double energy = 0.0, dye = 0.0;
+		float peak = 0.0f;
+	};
+	Activity m_Activity;
+	std::vector<Activity> m_ActivityPartials;
+	/*
+	* Dye per block of cells at the previous measurement.
+	*/
+	std::vector<float> m_DyeBlocks;
+	int m_FramesSinceMeasurement = 0, m_SettledMeasurements = 0;
+	bool m_IdleWhenSettled = true;
+	bool m_Quiescent = false;
+
+	/*
+	* Forces and dye queued by the input, applied at the start of the next step.
+	*/
+	ImpulseQueue m_Impulses;
+	/*
+	* Last cursor sample seen, strokes continue from it in the next frame.
+	*/
+	CursorSample m_LastCursorSample = {};
+	bool m_HasCursorSample = false;
+
+	/*
+	* Volumetric smoke simulated and previewed slice by slice instead of the 2D grid, created on first use.
+	*/
+	VolumeSolver* m_Volume = nullptr;
+	bool m_VolumePreview = false;
+	int m_VolumeSlice = VOLUME_PREVIEW_SIZE / 2;
+	/*
+	* Batch of simulations differing in viscosity, stepped on a coarser grid instead of the 2D grid and previewed
+	* as the spread of their dye, created on first use.
+	*/
+	Ensemble* m_Ensemble = nullptr;
+	bool m_EnsemblePreview = false;
+	int m_EnsembleMembers = ENSEMBLE_MEMBERS;
+	float m_EnsembleSpread = ENSEMBLE_VISCOSITY_SPREAD;
+	/*
+	* Lattice Boltzmann engine replacing the velocity pipeline when enabled, created on first use. The dye is
+	* still advected through the velocity field it writes.
+	*/
+	LatticeSolver* m_Lattice = nullptr;
+	bool m_LatticeEngine = false;
+	int m_LatticeSubsteps = LATTICE_SUBSTEPS;
+	/*
+	* SPH liquid replacing the grid when enabled, created on first use. It splats into the color field.
+	*/
+	SphSolver* m_Sph = nullptr;
+	bool m_SphEngine = false;
+	int m_SphSubsteps = SPH_SUBSTEPS;
+	/*
+	* Particles carrying the velocity between the projections of the grid when enabled, created on first use.
+	*/
+	FlipSolver* m_Flip = nullptr;
+	bool m_FlipEngine = false;
+	/*
+	* Replaces the velocity pipeline by the streamfunction-vorticity formulation: a single scalar is advected and
+	* a single Poisson equation solved per step, the velocity follows from the solution without a projection.
+	* The vorticity is carried between steps in the divergence field, it is only derived from the velocity again
+	* after another engine or a reset changed the velocity.
+	*/
+	bool m_VorticityEngine = false;
+	bool m_VorticityCarried = false;
+	/*
+	* Tracers advected through the velocity field and drawn as points over the dye when enabled, created on
+	* first use together with their shader and vertex buffer.
+	*/
+	TracerSystem* m_Tracers = nullptr;
+	bool m_ShowTracers = false;
+	GLshader* m_TracerShader = nullptr;
+	GLbuffer* m_TracerBuffer = nullptr;
+	/*
+	* Paddle and fan moving through the grid when enabled, created on first use. Their cells are solid for the
+	* projection and carry the velocity of the obstacle.
+	*/
+	ObstacleSet* m_Obstacles = nullptr;
+	bool m_MovingObstacles = false;
+
 	/*
 	* Buffer containing the velocity values per grid cell.
 	*/
 	glm::vec2* m_VelocityBuffer = nullptr, * m_VelocityOutput = nullptr;
 	/*
+	* Previous iterate of the diffusion and the velocity it started from, used by the Chebyshev iteration and
+	* null otherwise.
+	*/
+	glm::vec2* m_VelocityPrevious = nullptr, * m_VelocitySource = nullptr;
+	/*
 	* Buffer containing the pressure values per grid cell.
 	*/
 	float* m_PressureBuffer = nullptr, * m_PressureOutput = nullptr;
 	/*
+	* Previous iterate of the pressure solve, used by the Chebyshev iteration and null otherwise.
+	*/
+	float* m_PressurePrevious = nullptr;
+	/*
+	* Divergence and pressure on the coarse projection grid.
+	*/
+	float* m_CoarseDivergence = nullptr, * m_CoarsePressure = nullptr, * m_CoarsePressureOutput = nullptr;
+	/*
 	* Buffer containing the color values per grid cell.
 	*/
 	glm::vec4* m_ColorBuffer = nullptr, * m_ColorOutput = nullptr;
@@ -28,36 +315,306 @@ private:
 	* Buffer storing the divergence values.
 	*/
 	float* m_DivergenceBuffer = nullptr;
+	/*
+	* Four lines per band of rows for the streaming sweeps: the rows just below and above the band, and a ring
+	* of two output lines. Sized for the widest field type and for as many bands as threads or graph tiles.
+	*/
+	uchar* m_LineBuffers = nullptr;
+	size_t m_LineBufferSize = 0;
+	/*
+	* Two windows per thread for the local solves of the Schwarz iteration, each holding a tile and its overlap.
+	*/
+	float* m_SchwarzWindows = nullptr;
+	size_t m_SchwarzWindowSize = 0;
 
+	/*
+	* Sub-allocates the simulation buffers the current settings need from the arena for the current grid
+	* dimensions. The arena is reserved for every buffer and the state fields are laid out first, so re-laying
+	* out for other settings keeps the state in place.
+	*/
+	void AllocateBuffers();
+	/*
+	* Re-lays out the buffers when the settings changed which of them are needed, and clears the new scratch
+	* fields. Requires rebuilding the step graph.
+	*/
+	void UpdateLayout();
 	/*
 	* Initialize simulation values.
 	*/
 	void InitSimulation();
 	/*
+	* Clears the fields that are rewritten every step, first-touching them from the threads that own their rows.
+	*/
+	void ClearScratchFields();
+	/*
+	* Copies a band of rows between two fields.
+	* @param[out] dst		Destination field.
+	* @param[in] src		Source field.
+	* @param[in] rows		Rows to copy.
+	*/
+	template<typename T>
+	void CopyRows(T* dst, const T* src, RowRange rows);
+	/*
+	* Computes the Chebyshev weights of the sweeps for a time-step.
+	*/
+	void UpdateSweepWeights(float dt);
+	/*
+	* Moves the result of a diffusion sweep into the velocity field, keeping the previous iterate when needed.
+	*/
+	void CommitVelocitySweep(RowRange rows);
+	/*
+	* Moves the result of a pressure sweep into the pressure field, keeping the previous iterate when needed.
+	*/
+	void CommitPressureSweep(RowRange rows);
+	/*
+	* Retrieves the line buffer of a band.
+	*/
+	template<typename T>
+	T* LineBuffer(int band) { return (T*)(m_LineBuffers + m_LineBufferSize * band); }
+	/*
+	* Copies the rows just outside a band into its line buffer, before the neighbouring bands overwrite them.
+	* @param[in] field		Field that is swept next.
+	* @param[in] rows		Rows of the band.
+	* @param[in] band		Index of the band's line buffer.
+	*/
+	template<typename T>
+	void SaveLineHalos(const T* field, RowRange rows, int band);
+	/*
+	* Sweeps a band in place. Each row is computed into the ring of output lines and written back as soon as
+	* the row above it was computed, the last reader of its old values. Requires the band's saved halos.
+	* @param[in,out] field		Field to sweep.
+	* @param[out] previous		Receives the old values of the field when not nullptr.
+	* @param[in] rows			Rows of the band.
+	* @param[in] band			Index of the band's line buffer.
+	* @param[in] kernel			Callable computing a row, receiving y, the rows below, at and above y, and the output line.
+	*/
+	template<typename T, typename Kernel>
+	void StreamSweep(T* field, T* previous, RowRange rows, int band, const Kernel& kernel);
+	void StreamDiffusionSweep(float dt, int sweep, RowRange rows, int band);
+	void StreamPressureSweep(int sweep, RowRange rows, int band);
+	/*
+	* Retrieves the factor by which the coarse grid is coarser than the simulation grid.
+	*/
+	int CoarseScale() const;
+	/*
+	* Retrieves the grid size as a multiple of the window size.
+	*/
+	int GridScale() const { return m_Width / WIDTH; }
+	/*
+	* Derives the coarse projection grid from the grid dimensions and the projection scale.
+	*/
+	void ResizeCoarseGrid();
+	/*
+	* Destroys the direct solver and starts factorizing the one for the projection grid when enabled. The
+	* Jacobi sweeps solve the pressure until it is adopted.
+	*/
+	void UpdateDirectSolver();
+	/*
+	* Adopts the direct solver once its factorization finished, and rebuilds the step graph for it.
+	* @param[in] wait			Waits for the factorization in progress instead of returning.
+	*/
+	void AdoptDirectSolver(bool wait = false);
+	/*
+	* Builds the task graph of a time-step for the current grid dimensions.
+	*/
+	void BuildStepGraph();
+	/*
 	* Simulate a time-step.
 	*/
 	void SimulateTimeStep(float dt);
+	/*
+	* Simulate a time-step with the lattice Boltzmann engine.
+	*/
+	void SimulateLatticeStep(float dt);
+	/*
+	* Simulate a time-step of the ensemble preview.
+	*/
+	void SimulateEnsembleStep(float dt);
+	/*
+	* Simulate a time-step of the SPH liquid.
+	*/
+	void SimulateSphStep(float dt);
+	/*
+	* Simulate a time-step with the velocity carried by the FLIP particles.
+	*/
+	void SimulateFlipStep(float dt);
+	/*
+	* Simulate a time-step with the streamfunction-vorticity engine.
+	*/
+	void SimulateVorticityStep(float dt);
+	/*
+	* Projects the velocity field onto its divergence-free part with the configured pressure solve. Called by
+	* every thread of the pool after the velocity boundaries were updated.
+	*/
+	void Project(WorkerPool* pool, uint thread, RowRange rows);
+	/*
+	* Indicates whether the current settings let the step skip frozen tiles. Solvers that read the whole grid
+	* every step, and large pages, which cannot be decommitted, rule them out.
+	*/
+	bool UsesColdTiles() const;
+	/*
+	* Retrieves the number of tiles on each side of a tile at rest whose state its step reads.
+	*/
+	int ColdTileReach() const;
+	/*
+	* Indicates whether the current step skips the tile of a row.
+	*/
+	bool IsSkipped(int y) const;
+	/*
+	* Thaws the tiles the queued impulses touch and the frozen tiles next to a tile that changed, and takes the
+	* snapshot of the tiles the step skips.
+	*/
+	void PrepareColdTiles();
+	/*
+	* Measures the activity of every resident tile after a step and freezes the tiles that stayed at rest.
+	*/
+	void UpdateColdTiles();
+	/*
+	* Thaws every tile and stops skipping them.
+	*/
+	void ReleaseColdTiles();
+	/*
+	* Measures the kinetic energy and the change of the dye, and decides whether the fluid has settled.
+	*/
+	void MeasureActivity();
+	/*
+	* Leaves the quiescent state.
+	*/
+	void WakeUp();
+	/*
+	* Creates the obstacles for the current grid dimensions.
+	*/
+	void CreateObstacles();
+	/*
+	* Creates the ensemble with the current number of members.
+	*/
+	void CreateEnsemble();
+	/*
+	* Spreads the viscosity of the ensemble members evenly around VISCOSITY.
+	*/
+	void UpdateEnsembleViscosity();
+	/*
+	* Indicates whether the current engine moves the obstacles through the grid.
+	*/
+	bool UsesObstacles() const;
+	/*
+	* Retrieves the solid mask when a range of rows or its neighbouring rows hold solid cells, otherwise nullptr.
+	*/
+	const uchar* ObstacleMask(RowRange rows) const;
+	/*
+	* Moves the obstacles by a step and rasterises the cells they left and entered.
+	*/
+	void MoveObstacles(float dt);
+	/*
+	* Advects the tracers through the velocity field of the last step.
+	*/
+	void SimulateTracers(float dt);
 	/* 
 	* Apply forces based on the user-input.
 	*/
 	void HandleInput(float dt);
 	/*
-	* Apply forces when the mouse was held-down.
+	* Advances the simulation by a time-step with the queued impulses, unless the fluid has settled.
+	*/
+	void Step(float dt);
+	/*
+	* Queue strokes for the cursor movement while the mouse was held-down.
 	*/
 	void HandleMouseDown(float dt);
 	/*
-	* Apply forces when the mouse left-button was clicked.
+	* Queue a burst when the mouse right-button was clicked.
 	*/
 	void HandleMouseClick(float dt);
+	/*
+	* Converts window coordinates to grid coordinates.
+	* @param[in] position		Position in window coordinates.
+	* @returns					Position in grid coordinates.
+	*/
+	glm::vec2 ScreenToGrid(glm::dvec2 position);
+	/*
+	* Apply the queued impulses to a band of rows.
+	*/
+	void ApplyImpulses(RowRange rows);
 
 	void UpdateVelocityBoundaries();
-	void AdvectVelocity(float dt);
-	void DiffuseVelocities(float dt);
-	void ComputeDivergence();
-	void ComputePressure();
+	/*
+	* Advects a band of rows of a field through the velocity field, semi-Lagrangian with bilinear interpolation.
+	*/
+	template<typename T>
+	void Advect(float dt, const T* field, T* output, RowRange rows);
+	void AdvectVelocity(float dt, RowRange rows);
+	void DiffuseVelocities(float dt, int sweep, RowRange rows);
+	void DiffuseVelocityRow(float dt, int sweep, int y, const glm::vec2* below, const glm::vec2* center, const glm::vec2* above, glm::vec2* output);
+	void ComputeDivergence(RowRange rows);
+	void ComputePressure(int sweep, RowRange rows);
+	void ComputePressureRow(int sweep, int y, const float* below, const float* center, const float* above, float* output);
+	/*
+	* Averages a full-resolution field onto the coarse divergence.
+	*/
+	void Restrict(const float* field, RowRange coarseRows);
+	void ComputeCoarsePressure(RowRange coarseRows);
+	void CommitCoarsePressure(RowRange coarseRows);
+	/*
+	* Interpolates the coarse pressure bilinearly at a full-resolution cell.
+	*/
+	float SampleCoarsePressure(int x, int y) const;
+	void ProlongatePressure(RowRange rows);
+	/*
+	* Number of iterations of the Schwarz solve replacing a number of sweeps, and whether an iteration starts with
+	* a coarse correction.
+	*/
+	int SchwarzIterations(int sweeps) const;
+	bool SchwarzCorrects(int iteration) const;
+	/*
+	* Relaxes the pressure with the Schwarz iteration instead of sweeps. Called by every thread of the pool.
+	* @param[in] sweeps			Number of sweeps it replaces.
+	*/
+	void SolvePressureSchwarz(WorkerPool* pool, uint thread, int sweeps);
+	/*
+	* Retrieves the rows of the tiles a band of the Schwarz iteration owns.
+	* @param[in] band			Index of the band.
+	* @param[in] bands			Number of bands.
+	*/
+	RowRange SchwarzBand(int band, int bands) const;
+	/*
+	* Solves the pressure of each tile of a band locally into the pressure's scratch field. A tile is relaxed
+	* together with the rows overlapping its neighbours, which are held at the current pressure at the window's
+	* edges, and only its own rows are kept.
+	* @param[in] rows			Rows of the band, starting at a tile.
+	* @param[in] window			Index of the thread's windows.
+	*/
+	void SolvePressureTiles(RowRange rows, int window);
+	/*
+	* Computes the residual of the pressure equation into the pressure's scratch field.
+	*/
+	void ComputePressureResidual(RowRange rows);
+	/*
+	* Solves the coarse pressure equation for the correction of the restricted residual, serially.
+	*/
+	void SolveCoarseCorrection();
+	/*
+	* Adds the prolongated coarse correction to the pressure.
+	*/
+	void ProlongateCorrection(RowRange rows);
+	/*
+	* Solves a part of a stage of the direct pressure solve on the projection grid.
+	*/
+	void SolvePressureDirect(int stage, RowRange part);
 	void UpdatePressureBoundaries();
-	void SubtractPressureGradient();
+	void SubtractPressureGradient(RowRange rows);
+	void ComputeVorticity(RowRange rows);
+	/*
+	* Adds the curl of the impulses to the carried vorticity, from the vorticity before them in the pressure's
+	* scratch field.
+	*/
+	void AddImpulseVorticity(RowRange rows);
+	/*
+	* Runs a Jacobi sweep of the viscous diffusion on the vorticity, into the pressure's scratch field.
+	*/
+	void DiffuseVorticity(float dt, RowRange rows);
+	void UpdateStreamFunctionBoundaries(RowRange rows);
+	void ComputeStreamFunctionVelocity(RowRange rows);
 	void UpdateColorBoundaries();
-	void AdvectColors(float dt);
+	void AdvectColors(float dt, RowRange rows);
 };
 
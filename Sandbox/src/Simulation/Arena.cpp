@@ -0,0 +1,110 @@
+#include "stdfax.h"
+#include "Arena.h"
+
+/*
+* Tries to enable the SeLockMemoryPrivilege for the current process, which is required for large pages.
+* @returns		True if the privilege is held.
+*/
+static bool EnableLargePagePrivilege() {
+	static int s_Enabled = -1;
+	if (s_Enabled >= 0) return s_Enabled == 1;
+
+	s_Enabled = 0;
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) return false;
+
+	TOKEN_PRIVILEGES privileges;
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+	if (LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid)) {
+		// AdjustTokenPrivileges succeeds even when the privilege is not assigned, so check the last error.
+		AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL);
+		s_Enabled = GetLastError() == ERROR_SUCCESS ? 1 : 0;
+	}
+
+	CloseHandle(token);
+	return s_Enabled == 1;
+}
+
+Arena::~Arena()
+{
+	Release();
+}
+
+void Arena::Reset(size_t capacity)
+{
+	if (capacity > m_Capacity) {
+		Release();
+		Reserve(capacity);
+	}
+	m_Offset = 0;
+}
+
+void Arena::Trim()
+{
+	if (m_LargePages) return;
+
+	size_t keep = Align(m_Offset, ARENA_COMMIT_CHUNK);
+	if (keep >= m_Committed) return;
+	VirtualFree(m_Base + keep, m_Committed - keep, MEM_DECOMMIT);
+	m_Committed = keep;
+}
+
+void* Arena::Allocate(size_t size, size_t alignment)
+{
+	size_t offset = Align(m_Offset, alignment);
+	if (offset + size > m_Capacity)
+		FATAL_ERROR("Arena out of memory: requested %zu bytes, %zu of %zu bytes in use.", size, m_Offset, m_Capacity);
+
+	m_Offset = offset + size;
+	if (m_Offset > m_Committed) Commit(m_Offset);
+	return m_Base + offset;
+}
+
+size_t Arena::Align(size_t size, size_t alignment)
+{
+	return (size + alignment - 1) & ~(alignment - 1);
+}
+
+void Arena::Reserve(size_t capacity)
+{
+	// Try large pages first, the size has to be a multiple of the large page size. They would all land on the
+	// reserving thread's node, so machines with several nodes keep regular pages placed by first touch.
+	ULONG highestNode = 0;
+	GetNumaHighestNodeNumber(&highestNode);
+	size_t largePage = GetLargePageMinimum();
+	if (highestNode == 0 && largePage > 0 && EnableLargePagePrivilege()) {
+		size_t size = Align(capacity, largePage);
+		m_Base = (uchar*)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+
+		if (m_Base) {
+			m_Capacity = m_Committed = size, m_LargePages = true;
+			return;
+		}
+	}
+
+	// Fall back to regular pages, committed on demand.
+	m_Base = (uchar*)VirtualAlloc(NULL, capacity, MEM_RESERVE, PAGE_READWRITE);
+	if (!m_Base) FATAL_ERROR("Failed to reserve %zu bytes for the simulation arena.", capacity);
+
+	m_Capacity = capacity, m_Committed = 0, m_LargePages = false;
+}
+
+void Arena::Commit(size_t size)
+{
+	while (m_Committed < size) {
+		size_t chunk = glm::min(ARENA_COMMIT_CHUNK, m_Capacity - m_Committed);
+		if (!VirtualAlloc(m_Base + m_Committed, chunk, MEM_COMMIT, PAGE_READWRITE))
+			FATAL_ERROR("Failed to commit %zu bytes of the simulation arena, %zu of %zu bytes committed.", chunk, m_Committed, m_Capacity);
+		m_Committed += chunk;
+	}
+}
+
+void Arena::Release()
+{
+	if (m_Base) VirtualFree(m_Base, 0, MEM_RELEASE);
+	m_Base = nullptr;
+	m_Capacity = m_Offset = m_Committed = 0;
+	m_LargePages = false;
+}
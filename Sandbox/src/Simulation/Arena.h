@@ -0,0 +1,110 @@
+#pragma once
+
+/*
+* Default alignment of arena sub-allocations; one cache-line.
+*/
+#define ARENA_ALIGNMENT 64
+/*
+* Granularity in which a region of regular pages is committed.
+*/
+#define ARENA_COMMIT_CHUNK ((size_t)256 << 20)
+
+/*
+* Linear allocator handing out aligned sub-allocations from a single reserved region. The region is
+* backed by large (2 MB) pages when the process is allowed to lock them and the machine has a single NUMA node,
+* regular pages otherwise. Large pages are placed when they are committed, all at once by the thread reserving
+* them, so the first touch that puts each thread's rows on its node has no effect on them; with several nodes
+* local memory is worth more than the saved TLB misses, and the two are mutually exclusive. A region of
+* regular pages is only reserved up front and committed in chunks of ARENA_COMMIT_CHUNK as the sub-allocations
+* reach them, so a large grid never asks for its whole commit charge at once and the capacity beyond the last
+* allocation is never committed.
+*/
+class Arena {
+
+public:
+	Arena() = default;
+	~Arena();
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	/*
+	* Discards all sub-allocations and makes sure the arena can hold at least the requested amount of bytes.
+	* The region is only re-reserved when it is too small, so re-laying out a smaller grid is free.
+	* @param[in] capacity		Minimum number of bytes the arena should be able to hand out.
+	*/
+	void Reset(size_t capacity);
+	/*
+	* Decommits the chunks of regular pages beyond the last sub-allocation, so re-laying out fewer fields returns
+	* their memory. Large pages stay committed.
+	*/
+	void Trim();
+
+	/*
+	* Hands out a sub-allocation. <b>NOTE:</b> memory is not cleared.
+	* @param[in] size			Size of the allocation in bytes.
+	* @param[in] alignment		Alignment in bytes, must be a power of two.
+	* @returns					Pointer to the allocation.
+	*/
+	void* Allocate(size_t size, size_t alignment = ARENA_ALIGNMENT);
+	/*
+	* Hands out a typed sub-allocation. <b>NOTE:</b> memory is not cleared.
+	* @param[in] count			Number of elements.
+	* @returns					Pointer to the first element.
+	*/
+	template<typename T>
+	T* Allocate(size_t count) { return (T*)Allocate(sizeof(T) * count); }
+
+	/*
+	* Rounds a size or offset up to the next multiple of the alignment.
+	* @param[in] size			Size or offset in bytes.
+	* @param[in] alignment		Alignment in bytes, must be a power of two.
+	*/
+	static size_t Align(size_t size, size_t alignment = ARENA_ALIGNMENT);
+
+	/*
+	* Retrieves the number of bytes reserved by the arena.
+	*/
+	size_t Capacity() const { return m_Capacity; }
+	/*
+	* Retrieves the number of bytes handed out since the last reset.
+	*/
+	size_t Used() const { return m_Offset; }
+	/*
+	* Indicates whether the arena is backed by large pages.
+	*/
+	bool LargePages() const { return m_LargePages; }
+
+private:
+	/*
+	* Start of the reserved region.
+	*/
+	uchar* m_Base = nullptr;
+	/*
+	* Size of the reserved region and the offset of the next free byte.
+	*/
+	size_t m_Capacity = 0, m_Offset = 0;
+	/*
+	* Number of bytes committed from the start of the region.
+	*/
+	size_t m_Committed = 0;
+	/*
+	* Indicates whether the region was allocated with large pages.
+	*/
+	bool m_LargePages = false;
+
+	/*
+	* Reserves a new region, preferring large pages, which are committed along with the reservation.
+	* @param[in] capacity		Minimum size of the region in bytes.
+	*/
+	void Reserve(size_t capacity);
+	/*
+	* Commits whole chunks of the region until at least the requested amount of bytes is committed.
+	* @param[in] size			Number of bytes from the start of the region that should be committed.
+	*/
+	void Commit(size_t size);
+	/*
+	* Releases the reserved region.
+	*/
+	void Release();
+};
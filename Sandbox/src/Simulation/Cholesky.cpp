@@ -0,0 +1,361 @@
+#include "stdfax.h"
+#include <filesystem>
+#include <fstream>
+#include "Cholesky.h"
+#include "Hash.h"
+
+#define CHOLESKY_CACHE_MAGIC 0x4C4F4843	// "CHOL"
+#define CHOLESKY_CACHE_VERSION 1
+/*
+* Pivots below this fraction of their diagonal are the zero pivots of the singular Laplacian.
+*/
+#define CHOLESKY_PIVOT_TOLERANCE 1e-6
+
+struct CholeskyCacheHeader {
+	uint32_t magic, version;
+	uint64_t key;
+	int32_t width, height, unknowns, padding;
+	uint64_t entries;
+};
+
+template<typename T>
+static void WriteArray(std::ofstream& file, const std::vector<T>& data)
+{
+	file.write((const char*)data.data(), sizeof(T) * data.size());
+}
+
+template<typename T>
+static void ReadArray(std::ifstream& file, std::vector<T>& data, size_t count)
+{
+	data.resize(count);
+	file.read((char*)data.data(), sizeof(T) * count);
+}
+
+CholeskySolver::CholeskySolver(int width, int height, int stride, const uchar* solid)
+	: m_Width(width), m_Height(height), m_Stride(stride)
+{
+	m_Key = Hash(solid);
+
+	char name[64];
+	snprintf(name, sizeof(name), "pressure_%016llx.bin", (unsigned long long)m_Key);
+	std::string path = std::string(CHOLESKY_CACHE_DIRECTORY) + name;
+
+	if (!Load(path)) {
+		Dissect(0, 0, m_Width, m_Height, solid);
+		Factorize(solid);
+		Save(path);
+	}
+	Schedule();
+}
+
+void CholeskySolver::SolveStage(int stage, RowRange part, const float* rhs, float scale, float* solution)
+{
+	const Stage& s = m_Stages[stage];
+
+	for (int t = part.begin; t < part.end; t++) {
+		int i = m_Order[s.begin + t];
+
+		if (s.forward) {
+			// Solve L y = b by rows, the row of an unknown only holds its descendants in the elimination tree.
+			int diagonal = m_RowStart[i + 1] - 1;
+			double sum = (double)scale * rhs[m_Cells[i]];
+			for (int p = m_RowStart[i]; p < diagonal; p++) sum -= m_RowValues[p] * m_Work[m_RowColumns[p]];
+			m_Work[i] = sum / m_RowValues[diagonal];
+		}
+		else {
+			// Solve L^T x = y by columns, the column of an unknown only holds its ancestors.
+			int diagonal = m_ColumnStart[i];
+			double sum = m_Work[i];
+			for (int p = diagonal + 1; p < m_ColumnStart[i + 1]; p++) sum -= m_ColumnValues[p] * m_Work[m_ColumnRows[p]];
+			m_Work[i] = sum / m_ColumnValues[diagonal];
+			solution[m_Cells[i]] = (float)m_Work[i];
+		}
+	}
+}
+
+uint64_t CholeskySolver::Hash(const uchar* solid) const
+{
+	const uint header[] = { CHOLESKY_CACHE_VERSION, (uint)m_Width, (uint)m_Height };
+	uint64_t hash = HashWords(header, sizeof(header));
+
+	for (int y = 0; y < m_Height; y++)
+		for (int x = 0; x < m_Width; x++) {
+			uint cell = solid && solid[x + y * m_Stride] ? 1u : 0u;
+			hash = HashWords(&cell, sizeof(cell), hash);
+		}
+	return hash;
+}
+
+void CholeskySolver::Dissect(int x0, int y0, int x1, int y1, const uchar* solid)
+{
+	auto number = [&](int xa, int ya, int xb, int yb) {
+		for (int y = ya; y < yb; y++)
+			for (int x = xa; x < xb; x++)
+				if (!solid || !solid[x + y * m_Stride]) m_Cells.push_back(x + y * m_Stride);
+	};
+
+	if ((x1 - x0) * (y1 - y0) <= CHOLESKY_LEAF_CELLS) {
+		number(x0, y0, x1, y1);
+		return;
+	}
+
+	// Split across the longer side, the separator is eliminated after both halves.
+	if (x1 - x0 >= y1 - y0) {
+		int x = (x0 + x1) / 2;
+		Dissect(x0, y0, x, y1, solid);
+		Dissect(x + 1, y0, x1, y1, solid);
+		number(x, y0, x + 1, y1);
+	}
+	else {
+		int y = (y0 + y1) / 2;
+		Dissect(x0, y0, x1, y, solid);
+		Dissect(x0, y + 1, x1, y1, solid);
+		number(x0, y, x1, y + 1);
+	}
+}
+
+void CholeskySolver::Factorize(const uchar* solid)
+{
+	const int n = Unknowns();
+
+	std::vector<int> unknown((size_t)m_Width * m_Height, -1);
+	for (int k = 0; k < n; k++) unknown[m_Cells[k] % m_Stride + m_Cells[k] / m_Stride * m_Width] = k;
+
+	// Upper triangle of the permuted Laplacian by columns, the diagonal last. A missing neighbour mirrors the
+	// cell, like the clamped samples of ComputePressure, so it drops out of both sides.
+	const int offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+	std::vector<int> columnStart(n + 1, 0), rows;
+	std::vector<double> values;
+	rows.reserve((size_t)n * 3), values.reserve((size_t)n * 3);
+	for (int k = 0; k < n; k++) {
+		int x = m_Cells[k] % m_Stride, y = m_Cells[k] / m_Stride;
+
+		double diagonal = 0.0;
+		for (const auto& offset : offsets) {
+			int nx = x + offset[0], ny = y + offset[1];
+			if (nx < 0 || ny < 0 || nx >= m_Width || ny >= m_Height) continue;
+			int j = unknown[nx + ny * m_Width];
+			if (j < 0) continue;
+
+			diagonal += 1.0;
+			if (j < k) rows.push_back(j), values.push_back(-1.0);
+		}
+		rows.push_back(k), values.push_back(diagonal);
+		columnStart[k + 1] = (int)rows.size();
+	}
+
+	// Elimination tree.
+	std::vector<int> parent(n, -1), ancestor(n, -1);
+	for (int k = 0; k < n; k++) {
+		for (int p = columnStart[k]; p < columnStart[k + 1]; p++) {
+			for (int i = rows[p]; i != -1 && i < k;) {
+				int next = ancestor[i];
+				ancestor[i] = k;
+				if (next == -1) parent[i] = k;
+				i = next;
+			}
+		}
+	}
+
+	// Pattern of row k of L, in stack[top, n) in topological order. The path walked up the tree is collected at
+	// the front of the stack and moved to its back, the two never overlap.
+	std::vector<int> stack(n), mark(n, -1);
+	auto reach = [&](int k) {
+		int top = n;
+		mark[k] = k;
+		for (int p = columnStart[k]; p < columnStart[k + 1]; p++) {
+			int length = 0;
+			for (int i = rows[p]; mark[i] != k; i = parent[i]) {
+				stack[length++] = i;
+				mark[i] = k;
+			}
+			while (length > 0) stack[--top] = stack[--length];
+		}
+		return top;
+	};
+
+	// Count the non-zeros per column of L.
+	m_ColumnStart.assign(n + 1, 0);
+	for (int k = 0; k < n; k++) {
+		for (int top = reach(k); top < n; top++) m_ColumnStart[stack[top] + 1]++;
+		m_ColumnStart[k + 1]++;
+	}
+	for (int k = 0; k < n; k++) m_ColumnStart[k + 1] += m_ColumnStart[k];
+	std::fill(mark.begin(), mark.end(), -1);
+
+	// Up-looking factorization, row k of L is solved from the rows above it.
+	const size_t entries = m_ColumnStart[n];
+	std::vector<int> next(m_ColumnStart.begin(), m_ColumnStart.end() - 1);
+	std::vector<double> x(n, 0.0), factor(entries);
+	m_ColumnRows.resize(entries);
+	for (int k = 0; k < n; k++) {
+		int top = reach(k);
+		for (int p = columnStart[k]; p < columnStart[k + 1]; p++) x[rows[p]] = values[p];
+
+		double d = x[k];
+		x[k] = 0.0;
+		for (; top < n; top++) {
+			int i = stack[top];
+			double lki = x[i] / factor[m_ColumnStart[i]];
+			x[i] = 0.0;
+			for (int p = m_ColumnStart[i] + 1; p < next[i]; p++) x[m_ColumnRows[p]] -= factor[p] * lki;
+			d -= lki * lki;
+
+			int p = next[i]++;
+			m_ColumnRows[p] = k;
+			factor[p] = lki;
+		}
+
+		// Only the last unknown of a connected region has a zero pivot, replacing it pins the region's level.
+		double diagonal = values[columnStart[k + 1] - 1];
+		if (d <= CHOLESKY_PIVOT_TOLERANCE * diagonal) d = glm::max(diagonal, 1.0);
+
+		int p = next[k]++;
+		m_ColumnRows[p] = k;
+		factor[p] = sqrt(d);
+	}
+
+	m_ColumnValues.assign(factor.begin(), factor.end());
+}
+
+void CholeskySolver::Schedule()
+{
+	const int n = Unknowns();
+	const size_t entries = m_ColumnValues.size();
+
+	// The parent of a column is its first off-diagonal row.
+	std::vector<int> parent(n, -1);
+	for (int j = 0; j < n; j++)
+		if (m_ColumnStart[j + 1] - m_ColumnStart[j] > 1) parent[j] = m_ColumnRows[m_ColumnStart[j] + 1];
+
+	// Transpose the factor, visiting the columns in order sorts every row.
+	m_RowStart.assign(n + 1, 0);
+	for (size_t p = 0; p < entries; p++) m_RowStart[m_ColumnRows[p] + 1]++;
+	for (int i = 0; i < n; i++) m_RowStart[i + 1] += m_RowStart[i];
+
+	std::vector<int> next(m_RowStart.begin(), m_RowStart.end() - 1);
+	m_RowColumns.resize(entries), m_RowValues.resize(entries);
+	for (int j = 0; j < n; j++) {
+		for (int p = m_ColumnStart[j]; p < m_ColumnStart[j + 1]; p++) {
+			int q = next[m_ColumnRows[p]]++;
+			m_RowColumns[q] = j;
+			m_RowValues[q] = m_ColumnValues[p];
+		}
+	}
+
+	// The forward substitution of an unknown waits for its descendants, so it is leveled by its height in the
+	// tree. The backward substitution waits for its ancestors, so it is leveled by its depth.
+	m_Order.clear(), m_Stages.clear();
+	std::vector<int> levels(n, 0);
+	for (int i = 0; i < n; i++)
+		if (parent[i] != -1) levels[parent[i]] = glm::max(levels[parent[i]], levels[i] + 1);
+	AddStages(levels, true);
+
+	for (int i = n - 1; i >= 0; i--) levels[i] = parent[i] == -1 ? 0 : levels[parent[i]] + 1;
+	AddStages(levels, false);
+
+	m_Work.assign(n, 0.0);
+}
+
+void CholeskySolver::AddStages(const std::vector<int>& levels, bool forward)
+{
+	const int n = Unknowns();
+
+	int depth = 0;
+	for (int level : levels) depth = glm::max(depth, level + 1);
+
+	// Counting sort of the unknowns by level.
+	std::vector<int> start(depth + 1, 0), sorted(n);
+	for (int level : levels) start[level + 1]++;
+	for (int l = 0; l < depth; l++) start[l + 1] += start[l];
+	std::vector<int> next(start.begin(), start.end() - 1);
+	for (int i = 0; i < n; i++) sorted[next[levels[i]]++] = i;
+
+	for (int l = 0; l < depth; l++) {
+		int count = start[l + 1] - start[l];
+		bool serial = count < CHOLESKY_PARALLEL_UNKNOWNS;
+
+		if (serial && !m_Stages.empty() && m_Stages.back().serial && m_Stages.back().forward == forward)
+			m_Stages.back().count += count;
+		else m_Stages.push_back({ (int)m_Order.size(), count, forward, serial });
+		m_Order.insert(m_Order.end(), sorted.begin() + start[l], sorted.begin() + start[l + 1]);
+	}
+}
+
+bool CholeskySolver::Load(const std::string& path)
+{
+	std::ifstream file(path, std::ios::in | std::ios::binary);
+	if (!file.is_open()) return false;
+
+	CholeskyCacheHeader header;
+	file.read((char*)&header, sizeof(header));
+	if (!file || header.magic != CHOLESKY_CACHE_MAGIC || header.version != CHOLESKY_CACHE_VERSION || header.key != m_Key ||
+		header.width != m_Width || header.height != m_Height) return false;
+
+	// Check the sizes against the file before allocating, a corrupt header could ask for any amount of memory.
+	std::error_code error;
+	const uint64_t size = std::filesystem::file_size(path, error);
+	const uint64_t expected = sizeof(header) + sizeof(int) * (2 * (uint64_t)header.unknowns + 1) + (sizeof(int) + sizeof(float)) * header.entries;
+	bool valid = !error && size == expected && header.unknowns >= 0 && (int64_t)header.unknowns <= (int64_t)m_Width * m_Height &&
+		header.entries <= (uint64_t)INT_MAX;
+
+	if (valid) {
+		ReadArray(file, m_Cells, header.unknowns);
+		ReadArray(file, m_ColumnStart, (size_t)header.unknowns + 1);
+		ReadArray(file, m_ColumnRows, header.entries);
+		ReadArray(file, m_ColumnValues, header.entries);
+		valid = file && IsWellFormed();
+	}
+	if (!valid) {
+		std::cerr << "Ignoring the corrupt factorization cache " << path << "." << std::endl;
+		m_Cells.clear(), m_ColumnStart.clear(), m_ColumnRows.clear(), m_ColumnValues.clear();
+		return false;
+	}
+
+	// Cells are cached unstrided.
+	for (int& cell : m_Cells) cell = cell % m_Width + cell / m_Width * m_Stride;
+	return true;
+}
+
+bool CholeskySolver::IsWellFormed() const
+{
+	const int n = (int)m_Cells.size();
+	const size_t entries = m_ColumnValues.size();
+
+	for (int cell : m_Cells)
+		if (cell < 0 || cell >= m_Width * m_Height) return false;
+
+	if (m_ColumnStart.size() != (size_t)n + 1 || m_ColumnStart[0] != 0 || m_ColumnStart[n] != (int)entries || m_ColumnRows.size() != entries)
+		return false;
+	for (int j = 0; j < n; j++) {
+		// At least the diagonal, and the rows below it in increasing order.
+		if (m_ColumnStart[j + 1] <= m_ColumnStart[j] || m_ColumnStart[j + 1] > (int)entries) return false;
+		if (m_ColumnRows[m_ColumnStart[j]] != j) return false;
+		for (int p = m_ColumnStart[j] + 1; p < m_ColumnStart[j + 1]; p++)
+			if (m_ColumnRows[p] <= m_ColumnRows[p - 1] || m_ColumnRows[p] >= n) return false;
+	}
+	return true;
+}
+
+void CholeskySolver::Save(const std::string& path) const
+{
+	std::error_code error;
+	std::filesystem::create_directories(CHOLESKY_CACHE_DIRECTORY, error);
+
+	std::ofstream file(path, std::ios::out | std::ios::binary);
+	if (!file.is_open()) {
+		std::cerr << "Could not write the factorization cache " << path << "." << std::endl;
+		return;
+	}
+
+	CholeskyCacheHeader header = { CHOLESKY_CACHE_MAGIC, CHOLESKY_CACHE_VERSION, m_Key, m_Width, m_Height, Unknowns(), 0, m_ColumnValues.size() };
+	file.write((const char*)&header, sizeof(header));
+
+	std::vector<int> cells(m_Cells);
+	for (int& cell : cells) cell = cell % m_Stride + cell / m_Stride * m_Width;
+
+	WriteArray(file, cells);
+	WriteArray(file, m_ColumnStart);
+	WriteArray(file, m_ColumnRows);
+	WriteArray(file, m_ColumnValues);
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Threading.h"
+
+/*
+* Directory the factorizations are cached in, relative to the working directory.
+*/
+#define CHOLESKY_CACHE_DIRECTORY "cache/"
+/*
+* Regions of at most this many cells are not dissected further but numbered row by row.
+*/
+#define CHOLESKY_LEAF_CELLS 64
+/*
+* Levels of the elimination tree with fewer unknowns are solved by a single thread, consecutive small levels are
+* merged into one stage so the threads only synchronize where there is enough parallel work.
+*/
+#define CHOLESKY_PARALLEL_UNKNOWNS 512
+
+/*
+* Direct solver of the pressure equation on a grid with a fixed layout of solid cells. The 5-point Laplacian
+* with Neumann boundaries, which ComputePressure relaxes, is ordered by nested dissection and factorized once
+* into L L^T. The factor is cached on disk keyed by a hash of the grid dimensions and the solid cells, so a warm
+* start skips the factorization. Each solve is a forward and a backward substitution, scheduled by levels of the
+* elimination tree so the unknowns of a level are solved in parallel.
+*
+* The Laplacian is singular, its null space is the constant pressure of each connected region of fluid. The zero
+* pivot of the last unknown of each region is replaced by its diagonal, which pins that region's pressure level.
+*/
+class CholeskySolver {
+
+public:
+	/*
+	* Loads the factorization from the cache, or computes and caches it.
+	* @param[in] width			Number of grid cells in x-direction.
+	* @param[in] height			Number of grid cells in y-direction.
+	* @param[in] stride			Distance between rows in the grid-indexed fields, at least the width.
+	* @param[in] solid			Non-zero for the cells that are not fluid, indexed x + y * stride, or nullptr.
+	*/
+	CholeskySolver(int width, int height, int stride, const uchar* solid = nullptr);
+
+	/*
+	* Retrieves the number of stages of a solve. The stages must be run in order, each one completing before the
+	* next starts.
+	*/
+	int Stages() const { return (int)m_Stages.size(); }
+	/*
+	* Retrieves the number of unknowns solved by a stage.
+	*/
+	int StageSize(int stage) const { return m_Stages[stage].count; }
+	/*
+	* Determines whether a stage must be solved as a whole by a single thread.
+	*/
+	bool IsSerial(int stage) const { return m_Stages[stage].serial; }
+	/*
+	* Solves a part of a stage of n p - sum(neighbours of p) = scale * rhs, where n is the number of fluid neighbours.
+	* @param[in] stage			Index of the stage.
+	* @param[in] part			Range of the stage's unknowns to solve.
+	* @param[in] rhs			Right-hand side, grid-indexed.
+	* @param[in] scale			Factor applied to the right-hand side.
+	* @param[out] solution		Solution, grid-indexed. Written by the backward stages, solid cells are not touched.
+	*/
+	void SolveStage(int stage, RowRange part, const float* rhs, float scale, float* solution);
+
+	/*
+	* Retrieves the number of unknowns, i.e. fluid cells.
+	*/
+	int Unknowns() const { return (int)m_Cells.size(); }
+	/*
+	* Retrieves the number of non-zeros of the factor.
+	*/
+	size_t Entries() const { return m_ColumnValues.size(); }
+
+private:
+	struct Stage {
+		int begin, count;
+		bool forward, serial;
+	};
+
+	int m_Width, m_Height, m_Stride;
+	uint64_t m_Key;
+
+	/*
+	* Grid index of each unknown, in elimination order.
+	*/
+	std::vector<int> m_Cells;
+	/*
+	* Factor by columns, the diagonal first, followed by the rows in increasing order.
+	*/
+	std::vector<int> m_ColumnStart, m_ColumnRows;
+	std::vector<float> m_ColumnValues;
+	/*
+	* Factor by rows, the columns in increasing order, so the diagonal last.
+	*/
+	std::vector<int> m_RowStart, m_RowColumns;
+	std::vector<float> m_RowValues;
+
+	/*
+	* Unknowns of the stages back-to-back, and the intermediate solution per unknown.
+	*/
+	std::vector<int> m_Order;
+	std::vector<Stage> m_Stages;
+	std::vector<double> m_Work;
+
+	/*
+	* Hashes the grid dimensions and solid cells with 64-bit FNV-1a.
+	*/
+	uint64_t Hash(const uchar* solid) const;
+	/*
+	* Numbers the fluid cells of a region by nested dissection: both halves first, the separating row or column last.
+	*/
+	void Dissect(int x0, int y0, int x1, int y1, const uchar* solid);
+	/*
+	* Factorizes the permuted Laplacian with an up-looking sparse Cholesky factorization.
+	*/
+	void Factorize(const uchar* solid);
+	/*
+	* Builds the row form of the factor and the stages of the substitutions from the elimination tree.
+	*/
+	void Schedule();
+	/*
+	* Appends the unknowns of each level as stages, in increasing level.
+	*/
+	void AddStages(const std::vector<int>& levels, bool forward);
+
+	/*
+	* Reads a cached factorization.
+	* @returns					Whether the file existed, matched the grid and held a well-formed factor.
+	*/
+	bool Load(const std::string& path);
+	/*
+	* Checks that a loaded factor has the structure the solve indexes with: cells inside the grid, and every column
+	* starting with its diagonal followed by increasing rows below it.
+	*/
+	bool IsWellFormed() const;
+	void Save(const std::string& path) const;
+};
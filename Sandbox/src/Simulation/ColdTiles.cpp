@@ -0,0 +1,280 @@
+#include "stdfax.h"
+#include <algorithm>
+#include <mutex>
+#include "ColdTiles.h"
+
+/*
+* Tags of a compressed field.
+*/
+#define COLD_CONSTANT 0
+#define COLD_PLANES 1
+
+/*
+* Grids with frozen tiles, searched by the exception handler without a lock. The mutex only serializes the
+* registration.
+*/
+static std::atomic<ColdTiles*> s_Grids[COLD_GRIDS];
+static int s_GridCount = 0;
+static std::mutex s_GridsMutex;
+static PVOID s_Handler = nullptr;
+
+static size_t PageSize()
+{
+	static size_t s_PageSize = 0;
+	if (!s_PageSize) {
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		s_PageSize = info.dwPageSize;
+	}
+	return s_PageSize;
+}
+
+/*
+* Run-length encodes bytes with a stride. A control byte below 128 is followed by that many plus one literal
+* bytes, a control byte c of 128 or above by a single byte repeated c - 125 times.
+*/
+static void EncodeRuns(const uchar* data, size_t count, size_t stride, std::vector<uchar>& output)
+{
+	size_t i = 0;
+	while (i < count) {
+		// Length of the run starting here, at most 130 bytes.
+		size_t run = 1;
+		while (i + run < count && run < 130 && data[(i + run) * stride] == data[i * stride]) run++;
+
+		if (run >= 3) {
+			output.push_back((uchar)(run + 125));
+			output.push_back(data[i * stride]);
+			i += run;
+			continue;
+		}
+
+		// Literals up to the next run of three.
+		size_t literals = 0;
+		while (i + literals < count && literals < 128) {
+			size_t j = i + literals;
+			if (j + 2 < count && data[j * stride] == data[(j + 1) * stride] && data[j * stride] == data[(j + 2) * stride]) break;
+			literals++;
+		}
+		output.push_back((uchar)(literals - 1));
+		for (size_t l = 0; l < literals; l++) output.push_back(data[(i + l) * stride]);
+		i += literals;
+	}
+}
+
+/*
+* Decodes runs written by EncodeRuns into bytes with a stride.
+* @returns					Position after the runs.
+*/
+static const uchar* DecodeRuns(const uchar* input, uchar* data, size_t count, size_t stride)
+{
+	size_t i = 0;
+	while (i < count) {
+		uchar control = *input++;
+		if (control >= 128) {
+			uchar value = *input++;
+			for (size_t r = 0; r < (size_t)control - 125; r++, i++) data[i * stride] = value;
+		}
+		else for (size_t l = 0; l <= control; l++, i++) data[i * stride] = *input++;
+	}
+	return input;
+}
+
+static void Compress(const uchar* data, size_t size, std::vector<uchar>& output)
+{
+	const uint* words = (const uint*)data;
+	const size_t count = size / sizeof(uint);
+
+	output.clear();
+	size_t i = 1;
+	while (i < count && words[i] == words[0]) i++;
+	if (i == count) {
+		output.push_back(COLD_CONSTANT);
+		output.insert(output.end(), data, data + sizeof(uint));
+	}
+	else {
+		output.push_back(COLD_PLANES);
+		for (int plane = 0; plane < 4; plane++) EncodeRuns(data + plane, count, sizeof(uint), output);
+	}
+	output.shrink_to_fit();
+}
+
+static void Decompress(const std::vector<uchar>& input, uchar* data, size_t size)
+{
+	const size_t count = size / sizeof(uint);
+
+	if (input[0] == COLD_CONSTANT) {
+		uint value;
+		memcpy(&value, &input[1], sizeof(uint));
+		std::fill_n((uint*)data, count, value);
+		return;
+	}
+	const uchar* runs = &input[1];
+	for (int plane = 0; plane < 4; plane++) runs = DecodeRuns(runs, data + plane, count, sizeof(uint));
+}
+
+ColdTiles::ColdTiles()
+{
+	std::lock_guard<std::mutex> lock(s_GridsMutex);
+	std::atomic<ColdTiles*>* slot = std::find(std::begin(s_Grids), std::end(s_Grids), nullptr);
+	if (slot == std::end(s_Grids)) FATAL_ERROR("At most %d grids can have cold tiles.", COLD_GRIDS);
+
+	if (s_GridCount++ == 0) s_Handler = AddVectoredExceptionHandler(1, OnAccessViolation);
+	slot->store(this, std::memory_order_release);
+}
+
+ColdTiles::~ColdTiles()
+{
+	ThawAll();
+
+	std::lock_guard<std::mutex> lock(s_GridsMutex);
+	std::find(std::begin(s_Grids), std::end(s_Grids), this)->store(nullptr, std::memory_order_release);
+	if (--s_GridCount == 0) RemoveVectoredExceptionHandler(s_Handler), s_Handler = nullptr;
+}
+
+void ColdTiles::Reset(int rows, int tileRows)
+{
+	ThawAll();
+
+	m_Rows = rows, m_TileRows = tileRows;
+	m_Fields.clear();
+	m_States = std::vector<std::atomic<uchar>>((rows + tileRows - 1) / tileRows);
+	m_Compressed.clear();
+}
+
+void ColdTiles::AddField(void* data, size_t rowSize, bool scratch)
+{
+	m_Fields.push_back({ (uchar*)data, rowSize, scratch });
+	m_Compressed.resize(m_States.size() * m_Fields.size());
+}
+
+void ColdTiles::Freeze(int tile)
+{
+	const uchar state = m_States[tile].load(std::memory_order_acquire);
+	if (state != COLD_RESIDENT && state != COLD_THAWED) return;
+
+	// The tile is resident and not touched while it is frozen. A thawed tile's compressed state is overwritten.
+	const size_t fields = m_Fields.size();
+	for (size_t f = 0; f < fields; f++) {
+		uchar* begin;
+		size_t size;
+		if (!m_Fields[f].scratch && Pages(m_Fields[f], tile, begin, size)) Compress(begin, size, m_Compressed[tile * fields + f]);
+	}
+
+	// The pages stay reserved, so a thaw commits them in place.
+	for (const Field& field : m_Fields) {
+		uchar* begin;
+		size_t size;
+		if (Pages(field, tile, begin, size)) VirtualFree(begin, size, MEM_DECOMMIT);
+	}
+	m_States[tile].store(COLD_FROZEN, std::memory_order_release);
+}
+
+void ColdTiles::Thaw(int tile)
+{
+	Recommit(tile);
+	Release(tile);
+}
+
+void ColdTiles::ThawAll()
+{
+	for (int tile = 0; tile < (int)m_States.size(); tile++) Thaw(tile);
+}
+
+void ColdTiles::Collect()
+{
+	for (int tile = 0; tile < (int)m_States.size(); tile++) Release(tile);
+}
+
+int ColdTiles::FrozenTiles() const
+{
+	int frozen = 0;
+	for (int tile = 0; tile < (int)m_States.size(); tile++) frozen += IsFrozen(tile) ? 1 : 0;
+	return frozen;
+}
+
+size_t ColdTiles::CompressedBytes() const
+{
+	size_t bytes = 0;
+	for (int tile = 0; tile < (int)m_States.size(); tile++)
+		for (size_t f = 0; IsFrozen(tile) && f < m_Fields.size(); f++) bytes += m_Compressed[tile * m_Fields.size() + f].size();
+	return bytes;
+}
+
+bool ColdTiles::Pages(const Field& field, int tile, uchar*& begin, size_t& size) const
+{
+	const size_t page = PageSize();
+	const int first = tile * m_TileRows, last = glm::min(first + m_TileRows, m_Rows);
+
+	uintptr_t start = (uintptr_t)(field.data + field.rowSize * first), end = (uintptr_t)(field.data + field.rowSize * last);
+	start = (start + page - 1) & ~(uintptr_t)(page - 1);
+	end &= ~(uintptr_t)(page - 1);
+	if (start >= end) return false;
+
+	begin = (uchar*)start, size = end - start;
+	return true;
+}
+
+int ColdTiles::Find(const void* address) const
+{
+	const uchar* target = (const uchar*)address;
+	for (const Field& field : m_Fields) {
+		if (target < field.data || target >= field.data + field.rowSize * m_Rows) continue;
+
+		int tile = (int)((size_t)(target - field.data) / field.rowSize) / m_TileRows;
+		uchar* begin;
+		size_t size;
+		if (Pages(field, tile, begin, size) && target >= begin && target < begin + size) return tile;
+	}
+	return -1;
+}
+
+void ColdTiles::Recommit(int tile)
+{
+	// Only one thread thaws a tile, the others touching it meanwhile wait until it is resident.
+	uchar state = COLD_FROZEN;
+	if (!m_States[tile].compare_exchange_strong(state, COLD_THAWING, std::memory_order_acquire)) {
+		while (m_States[tile].load(std::memory_order_acquire) == COLD_THAWING) YieldProcessor();
+		return;
+	}
+
+	const size_t fields = m_Fields.size();
+	for (size_t f = 0; f < fields; f++) {
+		uchar* begin;
+		size_t size;
+		if (!Pages(m_Fields[f], tile, begin, size)) continue;
+
+		if (!VirtualAlloc(begin, size, MEM_COMMIT, PAGE_READWRITE)) FATAL_ERROR("Failed to recommit %zu bytes of a cold tile.", size);
+		if (!m_Fields[f].scratch) Decompress(m_Compressed[tile * fields + f], begin, size);
+	}
+	m_States[tile].store(COLD_THAWED, std::memory_order_release);
+}
+
+void ColdTiles::Release(int tile)
+{
+	if (m_States[tile].load(std::memory_order_acquire) != COLD_THAWED) return;
+
+	const size_t fields = m_Fields.size();
+	for (size_t f = 0; f < fields; f++) m_Compressed[tile * fields + f] = std::vector<uchar>();
+	m_States[tile].store(COLD_RESIDENT, std::memory_order_release);
+}
+
+LONG CALLBACK ColdTiles::OnAccessViolation(EXCEPTION_POINTERS* exception)
+{
+	if (exception->ExceptionRecord->ExceptionCode != EXCEPTION_ACCESS_VIOLATION) return EXCEPTION_CONTINUE_SEARCH;
+
+	// The second parameter of an access violation is the address accessed. Another thread may have thawed the
+	// tile since, then thawing does nothing and the access is simply retried.
+	const void* address = (const void*)exception->ExceptionRecord->ExceptionInformation[1];
+
+	for (std::atomic<ColdTiles*>& slot : s_Grids) {
+		ColdTiles* grid = slot.load(std::memory_order_acquire);
+		if (!grid) continue;
+
+		int tile = grid->Find(address);
+		if (tile >= 0) {
+			grid->Recommit(tile);
+			return EXCEPTION_CONTINUE_EXECUTION;
+		}
+	}
+	return EXCEPTION_CONTINUE_SEARCH;
+}
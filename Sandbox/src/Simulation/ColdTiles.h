@@ -0,0 +1,110 @@
+#pragma once
+#include <atomic>
+
+/*
+* Compressed storage for tiles of a grid that stopped changing. A tile is a band of rows across every registered
+* field. Freezing a tile compresses the state fields of the tile and decommits their pages; the contents of
+* scratch fields are simply dropped. Tiles are thawed explicitly, or transparently when any code touches a
+* frozen page: a vectored exception handler catches the access violation, commits and decompresses the tile and
+* resumes the access. Scratch pages come back zero-filled. The faulting thread may hold any lock, including the
+* heap's, so the handler takes none: tiles change state with atomic transitions, decommitted pages stay reserved
+* and are committed in place, and the compressed state of a tile it thawed is only released by Collect.
+*
+* A state field is compressed into a single value when all its floats in the tile are equal, otherwise the bytes
+* of the floats are split into four planes, the exponent bytes of near-constant values form long runs, and each
+* plane is run-length encoded. Both are lossless. Only whole pages inside a tile are frozen, the pages shared
+* with the neighbouring tiles stay resident. The fields must be backed by regular pages.
+*/
+/*
+* States of a tile. A thawed tile is resident again but still holds its compressed state.
+*/
+#define COLD_RESIDENT 0
+#define COLD_FROZEN 1
+#define COLD_THAWING 2
+#define COLD_THAWED 3
+/*
+* Number of grids that can have cold tiles at once.
+*/
+#define COLD_GRIDS 8
+
+class ColdTiles {
+
+public:
+	ColdTiles();
+	~ColdTiles();
+
+	ColdTiles(const ColdTiles&) = delete;
+	ColdTiles& operator=(const ColdTiles&) = delete;
+
+	/*
+	* Thaws every tile and forgets the fields, then splits a grid into tiles.
+	* @param[in] rows			Number of rows of the grid.
+	* @param[in] tileRows		Number of rows per tile.
+	*/
+	void Reset(int rows, int tileRows);
+	/*
+	* Registers a field of the grid.
+	* @param[in] data			First row of the field.
+	* @param[in] rowSize		Size of a row in bytes, a multiple of four.
+	* @param[in] scratch		Whether the contents can be dropped instead of compressed.
+	*/
+	void AddField(void* data, size_t rowSize, bool scratch);
+
+	/*
+	* Compresses a resident tile and releases its pages. Tiles can be frozen concurrently.
+	*/
+	void Freeze(int tile);
+	/*
+	* Recommits and decompresses a frozen tile.
+	*/
+	void Thaw(int tile);
+	void ThawAll();
+	/*
+	* Releases the compressed state of the tiles the exception handler thawed. Not concurrent with Freeze.
+	*/
+	void Collect();
+
+	bool IsFrozen(int tile) const { return m_States[tile].load(std::memory_order_acquire) == COLD_FROZEN; }
+	int Tiles() const { return (int)m_States.size(); }
+	/*
+	* Retrieves the number of frozen tiles and the size of their compressed state.
+	*/
+	int FrozenTiles() const;
+	size_t CompressedBytes() const;
+
+private:
+	struct Field {
+		uchar* data;
+		size_t rowSize;
+		bool scratch;
+	};
+
+	int m_Rows = 0, m_TileRows = 1;
+	std::vector<Field> m_Fields;
+	/*
+	* Per tile its state, and its compressed fields, tile-major.
+	*/
+	std::vector<std::atomic<uchar>> m_States;
+	std::vector<std::vector<uchar>> m_Compressed;
+
+	/*
+	* Retrieves the whole pages of a field within a tile.
+	* @returns					False if the tile holds no whole page of the field.
+	*/
+	bool Pages(const Field& field, int tile, uchar*& begin, size_t& size) const;
+	/*
+	* Finds the tile of an address within the pages a tile freezes.
+	* @returns					Index of the tile, or -1 if no tile freezes the page of the address.
+	*/
+	int Find(const void* address) const;
+	/*
+	* Commits and decompresses a frozen tile, or waits until another thread did. Safe in the exception handler.
+	*/
+	void Recommit(int tile);
+	/*
+	* Releases the compressed state of a thawed tile.
+	*/
+	void Release(int tile);
+
+	static LONG CALLBACK OnAccessViolation(EXCEPTION_POINTERS* exception);
+};
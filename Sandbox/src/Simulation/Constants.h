@@ -0,0 +1,8 @@
+#pragma once
+
+#define DX	(1.0f / 32.0f)
+#define RDX (1.0f / DX)
+#define HALFDX (0.5f * DX)
+#define VISCOSITY 1.0f
+#define TIMESTEP 0.05f		// 20 simulation steps per "unit" time-measure at least.
+#define ADVECTION_REACH 16	// Rows a backtrace reaches at most in the decomposed solvers, impulses move 10 * TIMESTEP * RDX = 16.
@@ -0,0 +1,298 @@
+#include "stdfax.h"
+#include "Ensemble.h"
+#include "Constants.h"
+#include "Reduction.h"
+#include "WorkerPool.h"
+#include "Template/Application.h"
+
+#define ENSEMBLE_SPREAD_GAIN 16.0f	// Standard deviation of the dye intensity drawn fully red.
+
+Ensemble::Ensemble(int width, int height, int members)
+	: m_Width(width), m_Height(height), m_Members(members)
+{
+	m_Batch = (members + ENSEMBLE_LANES - 1) / ENSEMBLE_LANES * ENSEMBLE_LANES;
+
+	const size_t values = (size_t)width * height * m_Batch;
+	m_Arena.Reset(15 * Arena::Align(sizeof(float) * values) + 3 * Arena::Align(sizeof(float) * m_Batch));
+
+	m_U = m_Arena.Allocate<float>(values);
+	m_V = m_Arena.Allocate<float>(values);
+	m_UOutput = m_Arena.Allocate<float>(values);
+	m_VOutput = m_Arena.Allocate<float>(values);
+	m_Pressure = m_Arena.Allocate<float>(values);
+	m_PressureOutput = m_Arena.Allocate<float>(values);
+	m_Divergence = m_Arena.Allocate<float>(values);
+	for (int c = 0; c < 4; c++) {
+		m_Dye[c] = m_Arena.Allocate<float>(values);
+		m_DyeOutput[c] = m_Arena.Allocate<float>(values);
+	}
+
+	m_Viscosity = m_Arena.Allocate<float>(m_Batch);
+	m_Alpha = m_Arena.Allocate<float>(m_Batch);
+	m_RBeta = m_Arena.Allocate<float>(m_Batch);
+	for (int b = 0; b < m_Batch; b++) m_Viscosity[b] = VISCOSITY;
+
+	Reset();
+}
+
+void Ensemble::Reset()
+{
+	WorkerPool* pool = Application::Workers();
+
+	// First-touch the rows from the thread that owns them.
+	pool->Run([&](uint thread) {
+		RowRange rows = pool->Rows(thread, m_Height);
+		size_t begin = Cell(0, rows.begin), end = Cell(0, rows.end);
+
+		float* fields[] = { m_U, m_V, m_UOutput, m_VOutput, m_Pressure, m_PressureOutput, m_Divergence,
+			m_Dye[0], m_Dye[1], m_Dye[2], m_Dye[3], m_DyeOutput[0], m_DyeOutput[1], m_DyeOutput[2], m_DyeOutput[3] };
+		for (float* field : fields) memset(field + begin, 0, sizeof(float) * (end - begin));
+	});
+}
+
+void Ensemble::Step(float dt, int sweeps)
+{
+	WorkerPool* pool = Application::Workers();
+
+	for (int b = 0; b < m_Batch; b++) {
+		m_Alpha[b] = (DX * DX) / (m_Viscosity[b] * dt);
+		m_RBeta[b] = 1.0f / (m_Alpha[b] + 4.0f);
+	}
+
+	// Same pipeline as Game, every phase covers all members at once.
+	pool->Run([&](uint thread) {
+		RowRange rows = pool->Rows(thread, m_Height);
+
+		if (thread == 0) {
+			UpdateBoundaries(m_U, -1.0f), UpdateBoundaries(m_V, -1.0f);
+			for (int c = 0; c < 4; c++) UpdateBoundaries(m_Dye[c], 0.0f);
+		}
+		pool->Sync(thread);
+		Advect(dt, rows);
+		pool->Sync(thread);
+		CopyRows(m_U, m_UOutput, rows), CopyRows(m_V, m_VOutput, rows);
+		for (int c = 0; c < 4; c++) CopyRows(m_Dye[c], m_DyeOutput[c], rows);
+		pool->Sync(thread);
+
+		for (int i = 0; i < sweeps; i++) {
+			Diffuse(rows);
+			pool->Sync(thread);
+			CopyRows(m_U, m_UOutput, rows), CopyRows(m_V, m_VOutput, rows);
+			pool->Sync(thread);
+		}
+
+		ComputeDivergence(rows);
+		pool->Sync(thread);
+
+		for (int i = 0; i < sweeps; i++) {
+			ComputePressure(rows);
+			pool->Sync(thread);
+			CopyRows(m_Pressure, m_PressureOutput, rows);
+			pool->Sync(thread);
+		}
+		if (thread == 0) UpdateBoundaries(m_Pressure, 1.0f);
+		pool->Sync(thread);
+
+		SubtractPressureGradient(rows);
+	});
+}
+
+void Ensemble::SetViscosity(int member, float viscosity)
+{
+	m_Viscosity[member] = viscosity;
+}
+
+void Ensemble::SetCell(int member, int x, int y, glm::vec2 velocity, glm::vec4 dye)
+{
+	size_t i = Cell(x, y) + member;
+	m_U[i] = velocity.x, m_V[i] = velocity.y;
+	for (int c = 0; c < 4; c++) m_Dye[c][i] = dye[c];
+}
+
+void Ensemble::ApplyImpulses(const ImpulseQueue& impulses, float scale)
+{
+	if (impulses.Empty()) return;
+
+	WorkerPool* pool = Application::Workers();
+	pool->Run([&](uint thread) {
+		RowRange rows = pool->Rows(thread, m_Height);
+		for (int y = rows.begin; y < rows.end; y++)
+			for (int x = 0; x < m_Width; x++) {
+				glm::vec2 velocity;
+				if (!impulses.Sample(glm::vec2((float)x, (float)y) * scale, velocity)) continue;
+				for (int member = 0; member < m_Members; member++) SetCell(member, x, y, velocity, glm::vec4(1.0f));
+			}
+	});
+}
+
+void Ensemble::ExtractVelocity(int member, glm::vec2* velocity) const
+{
+	for (int y = 0; y < m_Height; y++)
+		for (int x = 0; x < m_Width; x++) {
+			size_t i = Cell(x, y) + member;
+			velocity[x + (size_t)y * m_Width] = glm::vec2(m_U[i], m_V[i]);
+		}
+}
+
+void Ensemble::ExtractDye(int member, glm::vec4* dye) const
+{
+	for (int y = 0; y < m_Height; y++)
+		for (int x = 0; x < m_Width; x++) {
+			size_t i = Cell(x, y) + member;
+			dye[x + (size_t)y * m_Width] = glm::vec4(m_Dye[0][i], m_Dye[1][i], m_Dye[2][i], m_Dye[3][i]);
+		}
+}
+
+void Ensemble::ExportSpread(Surface* surface) const
+{
+	WorkerPool* pool = Application::Workers();
+
+	// Nearest-neighbour resample the statistics onto the surface, split over the threads by rows of the surface.
+	pool->Run([&](uint thread) {
+		RowRange rows = pool->Rows(thread, (int)surface->GetHeight());
+		for (uint y = rows.begin; y < (uint)rows.end; y++)
+			for (uint x = 0; x < surface->GetWidth(); x++) {
+				int gx = (int)(x * m_Width / surface->GetWidth());
+				int gy = (int)(y * m_Height / surface->GetHeight());
+				glm::vec2 statistics = DyeStatistics(Cell(gx, gy));
+
+				float grey = glm::clamp(statistics.x, 0.0f, 1.0f);
+				float red = glm::clamp(statistics.y * ENSEMBLE_SPREAD_GAIN, 0.0f, 1.0f);
+				surface->PlotPixel(Color(glm::mix(grey, 1.0f, red), grey * (1.0f - red), grey * (1.0f - red)), x, y);
+			}
+	});
+}
+
+float Ensemble::MeanSpread() const
+{
+	WorkerPool* pool = Application::Workers();
+
+	m_SpreadRows.assign(m_Height, 0.0);
+	pool->Run([&](uint thread) {
+		RowRange rows = pool->Rows(thread, m_Height);
+		for (int y = rows.begin; y < rows.end; y++)
+			for (int x = 0; x < m_Width; x++) m_SpreadRows[y] += DyeStatistics(Cell(x, y)).y;
+	});
+
+	double sum = ReducePairwise(m_SpreadRows, [](double a, double b) { return a + b; });
+	return (float)(sum / ((double)m_Width * m_Height));
+}
+
+glm::vec2 Ensemble::DyeStatistics(size_t cell) const
+{
+	float sum = 0.0f, sqrdSum = 0.0f;
+	for (int b = 0; b < m_Members; b++) {
+		float intensity = (m_Dye[0][cell + b] + m_Dye[1][cell + b] + m_Dye[2][cell + b]) * (1.0f / 3.0f);
+		sum += intensity, sqrdSum += intensity * intensity;
+	}
+
+	float mean = sum / m_Members;
+	return glm::vec2(mean, glm::sqrt(glm::max(sqrdSum / m_Members - mean * mean, 0.0f)));
+}
+
+void Ensemble::UpdateBoundaries(float* field, float scale)
+{
+	for (int b = 0; b < m_Batch; b++) Stencil::Boundaries(Lane(field, b), scale, { 0, m_Height });
+}
+
+void Ensemble::Advect(float dt, RowRange rows)
+{
+	using namespace Stencil;
+
+	// Every member backtraces through its own velocity. A row at a time keeps the cells of all members in cache.
+	for (int y = rows.begin; y < rows.end; y++)
+		for (int b = 0; b < m_Batch; b++) {
+			auto position = Backtrace(Vec2(Center(Lane(m_U, b)), Center(Lane(m_V, b))), dt * RDX);
+			Run({ y, y + 1 },
+				Assign(Lane(m_UOutput, b), Sample(Lane(m_U, b), position)),
+				Assign(Lane(m_VOutput, b), Sample(Lane(m_V, b), position)),
+				Assign(Lane(m_DyeOutput[0], b), Sample(Lane(m_Dye[0], b), position)),
+				Assign(Lane(m_DyeOutput[1], b), Sample(Lane(m_Dye[1], b), position)),
+				Assign(Lane(m_DyeOutput[2], b), Sample(Lane(m_Dye[2], b), position)),
+				Assign(Lane(m_DyeOutput[3], b), Sample(Lane(m_Dye[3], b), position)));
+		}
+}
+
+void Ensemble::Diffuse(RowRange rows)
+{
+	const int B = m_Batch;
+
+	for (int y = rows.begin; y < rows.end; y++) {
+		for (int x = 0; x < m_Width; x++) {
+			const size_t c = Cell(x, y);
+			const size_t l = Cell(glm::clamp(x - 1, 0, m_Width - 1), y);
+			const size_t r = Cell(glm::clamp(x + 1, 0, m_Width - 1), y);
+			const size_t d = Cell(x, glm::clamp(y - 1, 0, m_Height - 1));
+			const size_t t = Cell(x, glm::clamp(y + 1, 0, m_Height - 1));
+
+			for (int b = 0; b < B; b++) {
+				m_UOutput[c + b] = (m_U[l + b] + m_U[r + b] + m_U[d + b] + m_U[t + b] + m_Alpha[b] * m_U[c + b]) * m_RBeta[b];
+				m_VOutput[c + b] = (m_V[l + b] + m_V[r + b] + m_V[d + b] + m_V[t + b] + m_Alpha[b] * m_V[c + b]) * m_RBeta[b];
+			}
+		}
+	}
+}
+
+void Ensemble::ComputeDivergence(RowRange rows)
+{
+	const int B = m_Batch;
+
+	for (int y = rows.begin; y < rows.end; y++) {
+		for (int x = 0; x < m_Width; x++) {
+			const size_t c = Cell(x, y);
+			const size_t l = Cell(glm::clamp(x - 1, 0, m_Width - 1), y);
+			const size_t r = Cell(glm::clamp(x + 1, 0, m_Width - 1), y);
+			const size_t d = Cell(x, glm::clamp(y - 1, 0, m_Height - 1));
+			const size_t t = Cell(x, glm::clamp(y + 1, 0, m_Height - 1));
+
+			for (int b = 0; b < B; b++)
+				m_Divergence[c + b] = HALFDX * ((m_U[r + b] - m_U[l + b]) + (m_V[t + b] - m_V[d + b]));
+		}
+	}
+}
+
+void Ensemble::ComputePressure(RowRange rows)
+{
+	const int B = m_Batch;
+	const float alpha = -1.0f * (DX * DX);
+	const float rBeta = 0.25f;
+
+	for (int y = rows.begin; y < rows.end; y++) {
+		for (int x = 0; x < m_Width; x++) {
+			const size_t c = Cell(x, y);
+			const size_t l = Cell(glm::clamp(x - 1, 0, m_Width - 1), y);
+			const size_t r = Cell(glm::clamp(x + 1, 0, m_Width - 1), y);
+			const size_t d = Cell(x, glm::clamp(y - 1, 0, m_Height - 1));
+			const size_t t = Cell(x, glm::clamp(y + 1, 0, m_Height - 1));
+
+			for (int b = 0; b < B; b++)
+				m_PressureOutput[c + b] = (m_Pressure[l + b] + m_Pressure[r + b] + m_Pressure[d + b] + m_Pressure[t + b] + alpha * m_Divergence[c + b]) * rBeta;
+		}
+	}
+}
+
+void Ensemble::SubtractPressureGradient(RowRange rows)
+{
+	const int B = m_Batch;
+
+	for (int y = rows.begin; y < rows.end; y++) {
+		for (int x = 0; x < m_Width; x++) {
+			const size_t c = Cell(x, y);
+			const size_t l = Cell(glm::clamp(x - 1, 0, m_Width - 1), y);
+			const size_t r = Cell(glm::clamp(x + 1, 0, m_Width - 1), y);
+			const size_t d = Cell(x, glm::clamp(y - 1, 0, m_Height - 1));
+			const size_t t = Cell(x, glm::clamp(y + 1, 0, m_Height - 1));
+
+			for (int b = 0; b < B; b++) {
+				m_U[c + b] -= HALFDX * (m_Pressure[r + b] - m_Pressure[l + b]);
+				m_V[c + b] -= HALFDX * (m_Pressure[t + b] - m_Pressure[d + b]);
+			}
+		}
+	}
+}
+
+void Ensemble::CopyRows(float* dst, const float* src, RowRange rows)
+{
+	size_t begin = Cell(0, rows.begin), end = Cell(0, rows.end);
+	memcpy(dst + begin, src + begin, sizeof(float) * (end - begin));
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <vector>
+#include "Arena.h"
+#include "Impulse.h"
+#include "Stencil.h"
+
+class Surface;
+
+/*
+* Number of members the batch is padded to, so the innermost loops run over whole SIMD registers.
+*/
+#define ENSEMBLE_LANES 8
+
+/*
+* A batch of independent simulations of the same grid size, stepped together. Fields are stored interleaved
+* with the member as the fastest index, (x, y, member) -> (x + y * width) * batch + member, so every kernel
+* vectorizes across the batch and small grids still keep all worker threads busy.
+*/
+class Ensemble {
+
+public:
+	/*
+	* Creates the ensemble and clears all members.
+	* @param[in] width			Number of grid cells in x-direction.
+	* @param[in] height			Number of grid cells in y-direction.
+	* @param[in] members		Number of simulations.
+	*/
+	Ensemble(int width, int height, int members);
+
+	/*
+	* Clears the velocity, pressure and dye of all members.
+	*/
+	void Reset();
+	/*
+	* Advances all members by a single time-step.
+	* @param[in] dt				Time-step.
+	* @param[in] sweeps			Jacobi sweeps of the diffusion and of the pressure solve.
+	*/
+	void Step(float dt, int sweeps);
+
+	/*
+	* Sets the viscosity of a member.
+	* @param[in] member			Index of the simulation.
+	* @param[in] viscosity		Kinematic viscosity.
+	*/
+	void SetViscosity(int member, float viscosity);
+	/*
+	* Sets the velocity and dye of a single cell of a member.
+	* @param[in] member			Index of the simulation.
+	* @param[in] x				x-coordinate of the cell.
+	* @param[in] y				y-coordinate of the cell.
+	* @param[in] velocity		Velocity of the cell.
+	* @param[in] dye			Dye color of the cell.
+	*/
+	void SetCell(int member, int x, int y, glm::vec2 velocity, glm::vec4 dye);
+	/*
+	* Applies impulses to every member, cells covered by an impulse take its velocity and white dye.
+	* @param[in] impulses		Impulses in the coordinates of a finer grid.
+	* @param[in] scale			Cells of the finer grid per cell of the members along each axis.
+	*/
+	void ApplyImpulses(const ImpulseQueue& impulses, float scale);
+
+	/*
+	* Copies the velocity field of a member.
+	* @param[in] member			Index of the simulation.
+	* @param[out] velocity		Array of size width * height.
+	*/
+	void ExtractVelocity(int member, glm::vec2* velocity) const;
+	/*
+	* Copies the dye field of a member, e.g. for previewing it on the Surface.
+	* @param[in] member			Index of the simulation.
+	* @param[out] dye			Array of size width * height.
+	*/
+	void ExtractDye(int member, glm::vec4* dye) const;
+	/*
+	* Plots the mean dye intensity of the members in grey, shaded towards red by its standard deviation across
+	* the members, onto a surface resampled to the surface size. <b>NOTE:</b> does not sync the surface.
+	* @param[in] surface		Surface to plot to.
+	*/
+	void ExportSpread(Surface* surface) const;
+	/*
+	* Computes the standard deviation of the dye intensity across the members, averaged over the grid.
+	*/
+	float MeanSpread() const;
+
+	int Width() const { return m_Width; }
+	int Height() const { return m_Height; }
+	int Members() const { return m_Members; }
+
+private:
+	int m_Width, m_Height, m_Members;
+	/*
+	* Number of members rounded up to a multiple of ENSEMBLE_LANES, the stride of a cell.
+	*/
+	int m_Batch;
+
+	Arena m_Arena;
+	/*
+	* Velocity components, pressure and divergence.
+	*/
+	float* m_U = nullptr, * m_V = nullptr, * m_UOutput = nullptr, * m_VOutput = nullptr;
+	float* m_Pressure = nullptr, * m_PressureOutput = nullptr, * m_Divergence = nullptr;
+	/*
+	* Dye, one plane per color channel.
+	*/
+	float* m_Dye[4] = {}, * m_DyeOutput[4] = {};
+	/*
+	* Per-member viscosity and the Jacobi coefficients of the diffusion derived from it.
+	*/
+	float* m_Viscosity = nullptr, * m_Alpha = nullptr, * m_RBeta = nullptr;
+	/*
+	* Spread summed per row, reduced in a fixed order whatever the number of threads.
+	*/
+	mutable std::vector<double> m_SpreadRows;
+
+	/*
+	* Offset of the first member of a cell.
+	*/
+	size_t Cell(int x, int y) const { return ((size_t)x + (size_t)y * m_Width) * m_Batch; }
+	/*
+	* Mean and standard deviation of the dye intensity of a cell across the members.
+	*/
+	glm::vec2 DyeStatistics(size_t cell) const;
+
+	/*
+	* Single member of a batched field.
+	*/
+	Stencil::Strided<float> Lane(float* field, int member) const { return Stencil::Strided<float>(field + member, m_Width, m_Height, m_Batch); }
+
+	void UpdateBoundaries(float* field, float scale);
+	void Advect(float dt, RowRange rows);
+	void Diffuse(RowRange rows);
+	void ComputeDivergence(RowRange rows);
+	void ComputePressure(RowRange rows);
+	void SubtractPressureGradient(RowRange rows);
+	void CopyRows(float* dst, const float* src, RowRange rows);
+};
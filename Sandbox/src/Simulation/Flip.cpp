@@ -0,0 +1,181 @@
+#include "stdfax.h"
+#include <emmintrin.h>
+#include "Flip.h"
+#include "WorkerPool.h"
+#include "Constants.h"
+
+/*
+* Distance the particles keep from the last interior cell, so the nodes they interpolate from stay inside the grid.
+*/
+#define FLIP_EDGE 1e-3f
+
+/*
+* Loads up to four consecutive values, the missing lanes are set to a padding value.
+*/
+static __m128 LoadLanes(const float* values, int count, float padding)
+{
+	if (count == 4) return _mm_loadu_ps(values);
+
+	alignas(16) float lanes[4] = { padding, padding, padding, padding };
+	for (int l = 0; l < count; l++) lanes[l] = values[l];
+	return _mm_load_ps(lanes);
+}
+
+/*
+* Stores the first count lanes to consecutive values.
+*/
+static void StoreLanes(float* values, int count, __m128 value)
+{
+	if (count == 4) {
+		_mm_storeu_ps(values, value);
+		return;
+	}
+
+	alignas(16) float lanes[4];
+	_mm_store_ps(lanes, value);
+	for (int l = 0; l < count; l++) values[l] = lanes[l];
+}
+
+FlipSolver::FlipSolver(int width, int height)
+	: m_Width(width), m_Height(height)
+{
+	const size_t count = (size_t)FLIP_PARTICLES_PER_CELL * (width - 2) * (height - 2);
+	m_Sorted.Resize(count);
+	for (int k = 0; k < 4; k++) m_Affine[k].resize(count), m_SortedAffine[k].resize(count);
+	m_Cells.Resize(width, height, 1.0f, count);
+
+	Reset();
+}
+
+void FlipSolver::Reset()
+{
+	const int perCell = FLIP_PARTICLES_PER_CELL;
+	const int interiorWidth = m_Width - 2, interiorHeight = m_Height - 2;
+	const size_t count = (size_t)perCell * interiorWidth * interiorHeight;
+
+	// Every interior cell is split into 2x2 quarters, the particles are placed at random within successive quarters.
+	m_Particles.Resize(count);
+	for (size_t i = 0; i < count; i++) {
+		size_t cell = i / perCell;
+		int quarter = (int)(i % perCell) & 3;
+		float x = 1.0f + (float)(cell % interiorWidth), y = 1.0f + (float)(cell / interiorWidth);
+
+		m_Particles.x[i] = x + 0.5f * ((quarter & 1) + HashUnit((uint)(2 * i)));
+		m_Particles.y[i] = y + 0.5f * ((quarter >> 1) + HashUnit((uint)(2 * i + 1)));
+		m_Particles.vx[i] = m_Particles.vy[i] = 0.0f;
+	}
+	for (int k = 0; k < 4; k++) std::fill(m_Affine[k].begin(), m_Affine[k].end(), 0.0f);
+}
+
+void FlipSolver::Bin(WorkerPool* pool, uint thread)
+{
+	RowRange slots = pool->Rows(thread, (int)Size());
+
+	m_Cells.Assign(m_Particles, slots);
+	pool->Sync(thread);
+
+	if (thread == 0) m_Cells.Sort();
+	pool->Sync(thread);
+
+	for (int slot = slots.begin; slot < slots.end; slot++) {
+		uint i = m_Cells.Particle(slot);
+		m_Sorted.x[slot] = m_Particles.x[i], m_Sorted.y[slot] = m_Particles.y[i];
+		m_Sorted.vx[slot] = m_Particles.vx[i], m_Sorted.vy[slot] = m_Particles.vy[i];
+		for (int k = 0; k < 4; k++) m_SortedAffine[k][slot] = m_Affine[k][i];
+	}
+	pool->Sync(thread);
+
+	// From here on the slots of a cell index the particles directly.
+	if (thread == 0) {
+		std::swap(m_Particles, m_Sorted);
+		for (int k = 0; k < 4; k++) m_Affine[k].swap(m_SortedAffine[k]);
+	}
+	pool->Sync(thread);
+}
+
+void FlipSolver::TransferToGrid(RowRange rows, glm::vec2* velocity) const
+{
+	const bool apic = m_Transfer == ParticleTransfer::Apic;
+
+	for (int y = rows.begin; y < rows.end; y++) {
+		for (int x = 0; x < m_Width; x++) {
+			float weight = 0.0f;
+			glm::vec2 sum = glm::vec2(0.0f);
+
+			// A node is covered by the bilinear weights of the particles in the cells to its bottom-left, the
+			// cells of a row are consecutive, so are their slots.
+			const int first = glm::max(x - 1, 0), last = glm::min(x, m_Width - 1);
+			for (int cy = glm::max(y - 1, 0); cy <= glm::min(y, m_Height - 1); cy++) {
+				const uint begin = m_Cells.Start(first + (size_t)cy * m_Width), end = m_Cells.Start(last + 1 + (size_t)cy * m_Width);
+				for (uint p = begin; p < end; p++) {
+					float dx = x - m_Particles.x[p], dy = y - m_Particles.y[p];
+					float w = glm::max(1.0f - glm::abs(dx), 0.0f) * glm::max(1.0f - glm::abs(dy), 0.0f);
+
+					glm::vec2 v = glm::vec2(m_Particles.vx[p], m_Particles.vy[p]);
+					if (apic) v += glm::vec2(m_Affine[0][p] * dx + m_Affine[2][p] * dy, m_Affine[1][p] * dx + m_Affine[3][p] * dy);
+					sum += w * v;
+					weight += w;
+				}
+			}
+			if (weight > 0.0f) velocity[x + (size_t)y * m_Width] = sum / weight;
+		}
+	}
+}
+
+void FlipSolver::TransferToParticles(RowRange range, const glm::vec2* velocity, const glm::vec2* previous, float dt)
+{
+	const bool apic = m_Transfer == ParticleTransfer::Apic;
+	const __m128 one = _mm_set1_ps(1.0f), blend = _mm_set1_ps(FLIP_BLEND), step = _mm_set1_ps(dt * RDX);
+	const __m128 upperX = _mm_set1_ps(m_Width - 1 - FLIP_EDGE), upperY = _mm_set1_ps(m_Height - 1 - FLIP_EDGE);
+
+	for (int i = range.begin; i < range.end; i += 4) {
+		const int count = glm::min(range.end - i, 4);
+		__m128 px = LoadLanes(&m_Particles.x[i], count, 1.0f), py = LoadLanes(&m_Particles.y[i], count, 1.0f);
+
+		// The node to the bottom-left of each particle and the bilinear weights.
+		alignas(16) int nodeX[4], nodeY[4];
+		__m128i ix = _mm_cvttps_epi32(px), iy = _mm_cvttps_epi32(py);
+		_mm_store_si128((__m128i*)nodeX, ix), _mm_store_si128((__m128i*)nodeY, iy);
+		__m128 wx1 = _mm_sub_ps(px, _mm_cvtepi32_ps(ix)), wy1 = _mm_sub_ps(py, _mm_cvtepi32_ps(iy));
+		__m128 wx0 = _mm_sub_ps(one, wx1), wy0 = _mm_sub_ps(one, wy1);
+
+		// Gather the four nodes around each particle, bottom-left, bottom-right, top-left, top-right.
+		alignas(16) float u[4][4], v[4][4], pu[4][4], pv[4][4];
+		for (int l = 0; l < 4; l++) {
+			const size_t node = nodeX[l] + (size_t)nodeY[l] * m_Width;
+			const size_t corners[4] = { node, node + 1, node + m_Width, node + m_Width + 1 };
+			for (int c = 0; c < 4; c++) {
+				u[c][l] = velocity[corners[c]].x, v[c][l] = velocity[corners[c]].y;
+				if (!apic) pu[c][l] = previous[corners[c]].x, pv[c][l] = previous[corners[c]].y;
+			}
+		}
+		auto interpolate = [&](const float(*values)[4]) {
+			__m128 bottom = _mm_add_ps(_mm_mul_ps(wx0, _mm_load_ps(values[0])), _mm_mul_ps(wx1, _mm_load_ps(values[1])));
+			__m128 top = _mm_add_ps(_mm_mul_ps(wx0, _mm_load_ps(values[2])), _mm_mul_ps(wx1, _mm_load_ps(values[3])));
+			return _mm_add_ps(_mm_mul_ps(wy0, bottom), _mm_mul_ps(wy1, top));
+		};
+		auto difference = [&](const float* a, const float* b) { return _mm_sub_ps(_mm_load_ps(a), _mm_load_ps(b)); };
+
+		const __m128 gridX = interpolate(u), gridY = interpolate(v);
+		__m128 vx = gridX, vy = gridY;
+		if (apic) {
+			// The gradient of the bilinear interpolant at the particle.
+			StoreLanes(&m_Affine[0][i], count, _mm_add_ps(_mm_mul_ps(wy0, difference(u[1], u[0])), _mm_mul_ps(wy1, difference(u[3], u[2]))));
+			StoreLanes(&m_Affine[1][i], count, _mm_add_ps(_mm_mul_ps(wy0, difference(v[1], v[0])), _mm_mul_ps(wy1, difference(v[3], v[2]))));
+			StoreLanes(&m_Affine[2][i], count, _mm_add_ps(_mm_mul_ps(wx0, difference(u[2], u[0])), _mm_mul_ps(wx1, difference(u[3], u[1]))));
+			StoreLanes(&m_Affine[3][i], count, _mm_add_ps(_mm_mul_ps(wx0, difference(v[2], v[0])), _mm_mul_ps(wx1, difference(v[3], v[1]))));
+		}
+		else {
+			// PIC plus the blended FLIP difference: v_pic + blend * (v_particle - v_previous).
+			__m128 particleX = LoadLanes(&m_Particles.vx[i], count, 0.0f), particleY = LoadLanes(&m_Particles.vy[i], count, 0.0f);
+			vx = _mm_add_ps(vx, _mm_mul_ps(blend, _mm_sub_ps(particleX, interpolate(pu))));
+			vy = _mm_add_ps(vy, _mm_mul_ps(blend, _mm_sub_ps(particleY, interpolate(pv))));
+		}
+		StoreLanes(&m_Particles.vx[i], count, vx), StoreLanes(&m_Particles.vy[i], count, vy);
+
+		// Move through the grid velocity, staying within the interior cells.
+		px = _mm_min_ps(_mm_max_ps(_mm_add_ps(px, _mm_mul_ps(step, gridX)), one), upperX);
+		py = _mm_min_ps(_mm_max_ps(_mm_add_ps(py, _mm_mul_ps(step, gridY)), one), upperY);
+		StoreLanes(&m_Particles.x[i], count, px), StoreLanes(&m_Particles.y[i], count, py);
+	}
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include "Particles.h"
+
+class WorkerPool;
+
+/*
+* Number of particles seeded per grid cell, on a jittered 2x2 pattern.
+*/
+#define FLIP_PARTICLES_PER_CELL 4
+/*
+* Fraction of the FLIP update in the velocity of a particle, the remainder is the PIC update. Pure FLIP is
+* noisy, a little PIC damps the noise without the dissipation of pure PIC.
+*/
+#define FLIP_BLEND 0.95f
+
+/*
+* How the particles pick up the grid velocity.
+* Flip: adds the change of the grid velocity to the particle's own, blended with PIC by FLIP_BLEND.
+* Apic: takes the grid velocity and its affine variation around the particle, which the next transfer to the
+* grid carries along, so rotation is kept without the noise of FLIP.
+*/
+enum class ParticleTransfer { Flip, Apic };
+
+/*
+* Hybrid particle-grid transfers for Game's velocity pipeline. The velocity is carried by particles, so it is
+* not smeared by the semi-Lagrangian advection of the grid every step. Each step the particles are binned into
+* the grid cells with a counting sort and copied into cell order, their velocity is gathered onto the grid,
+* Game projects the grid velocity, and the particles pick up the result with four particles at a time in SSE.
+*
+* The transfer to the grid gathers per node instead of scattering per particle: a node only reads the
+* particles of the four cells around it, which are two runs of slots in cell order, so bands of rows are
+* transferred by different threads without atomics or colouring.
+*/
+class FlipSolver {
+
+public:
+	/*
+	* Seeds FLIP_PARTICLES_PER_CELL particles at rest into every interior cell.
+	* @param[in] width			Number of grid cells in x-direction.
+	* @param[in] height			Number of grid cells in y-direction.
+	*/
+	FlipSolver(int width, int height);
+
+	/*
+	* Reseeds the particles at rest.
+	*/
+	void Reset();
+	/*
+	* Bins the particles into the grid cells and copies them into cell order. Called by every thread of the
+	* pool, ends with a sync.
+	* @param[in] pool			Pool running the step.
+	* @param[in] thread			Index of the calling thread.
+	*/
+	void Bin(WorkerPool* pool, uint thread);
+	/*
+	* Gathers the particle velocities onto a band of rows, after binning. Nodes without particles around them
+	* keep their velocity.
+	* @param[in] rows			Band of rows to transfer.
+	* @param[out] velocity		Velocity field in grid units.
+	*/
+	void TransferToGrid(RowRange rows, glm::vec2* velocity) const;
+	/*
+	* Updates a range of particles from the projected grid velocity and moves them through it.
+	* @param[in] range			Range of particles to update.
+	* @param[in] velocity		Projected velocity field.
+	* @param[in] previous		Velocity field as transferred to the grid, before the projection.
+	* @param[in] dt				Time-step.
+	*/
+	void TransferToParticles(RowRange range, const glm::vec2* velocity, const glm::vec2* previous, float dt);
+
+	ParticleTransfer GetTransfer() const { return m_Transfer; }
+	void SetTransfer(ParticleTransfer transfer) { m_Transfer = transfer; }
+
+	/*
+	* Retrieves the particles, in cell order after binning.
+	*/
+	const Particles& GetParticles() const { return m_Particles; }
+	size_t Size() const { return m_Particles.Size(); }
+
+private:
+	int m_Width, m_Height;
+	ParticleTransfer m_Transfer = ParticleTransfer::Flip;
+
+	Particles m_Particles, m_Sorted;
+	/*
+	* Affine velocity of each particle for APIC, the derivatives dvx/dx, dvy/dx, dvx/dy and dvy/dy.
+	*/
+	std::vector<float> m_Affine[4], m_SortedAffine[4];
+	CellList m_Cells;
+};
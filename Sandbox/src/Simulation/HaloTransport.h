@@ -0,0 +1,52 @@
+#pragma once
+
+/*
+* Side of a slab a halo is exchanged with. Ranks are ordered by row, the neighbour below owns the preceding rows.
+*/
+enum class HaloSide {
+	Below = 0,
+	Above = 1
+};
+
+/*
+* Point-to-point link between the ranks of a slab decomposition, carrying halo rows between neighbours. Messages
+* on a side arrive in the order they were posted.
+*/
+class HaloTransport {
+
+public:
+	virtual ~HaloTransport() = default;
+
+	/*
+	* Retrieves the index of this process in the decomposition.
+	*/
+	virtual int Rank() const = 0;
+	/*
+	* Retrieves the number of processes in the decomposition.
+	*/
+	virtual int Ranks() const = 0;
+	/*
+	* Retrieves the maximum number of floats in a single message.
+	*/
+	virtual size_t Capacity() const = 0;
+
+	/*
+	* Sends rows to the neighbour on a side. Returns as soon as the data is copied out, the neighbour
+	* does not need to be waiting.
+	* @param[in] side			Side of the receiving neighbour.
+	* @param[in] data			Data to send.
+	* @param[in] count			Number of floats to send.
+	*/
+	virtual void Post(HaloSide side, const float* data, size_t count) = 0;
+	/*
+	* Blocks until the next message of the neighbour on a side arrived and copies it.
+	* @param[in] side			Side of the sending neighbour.
+	* @param[out] data			Destination of the message.
+	* @param[in] count			Number of floats to receive.
+	*/
+	virtual void Receive(HaloSide side, float* data, size_t count) = 0;
+	/*
+	* Blocks until every rank reached the barrier.
+	*/
+	virtual void Barrier() = 0;
+};
@@ -0,0 +1,21 @@
+#pragma once
+
+/*
+* Offset basis and prime of the 64-bit FNV-1a hash.
+*/
+#define FNV_OFFSET 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+/*
+* Folds words of memory into a 64-bit FNV-1a hash, to compare results bit for bit or to key cached data.
+* @param[in] data			Words to hash.
+* @param[in] bytes			Size of the words in bytes, a trailing partial word is ignored.
+* @param[in] hash			Hash to continue, so consecutive ranges hash like a single one.
+* @returns					The updated hash.
+*/
+inline uint64_t HashWords(const void* data, size_t bytes, uint64_t hash = FNV_OFFSET)
+{
+	const uint* words = (const uint*)data;
+	for (size_t i = 0; i < bytes / sizeof(uint); i++) hash = (hash ^ words[i]) * FNV_PRIME;
+	return hash;
+}
@@ -0,0 +1,137 @@
+#include "stdfax.h"
+#include "Impulse.h"
+
+#define STROKE_STRENGTH_INNER 1.0f
+#define STROKE_STRENGTH_OUTER 10.0f
+#define BURST_STRENGTH 10.0f
+
+void ImpulseQueue::AddStroke(glm::vec2 from, glm::vec2 to, float radius)
+{
+	Impulse impulse;
+	impulse.type = ImpulseType::Stroke;
+	impulse.from = from, impulse.to = to;
+	impulse.radius = radius;
+	impulse.direction = glm::normalize(to - from);
+	impulse.ring = glm::vec2(0.0f);
+	m_Impulses.push_back(impulse);
+}
+
+void ImpulseQueue::AddBurst(glm::vec2 center, float halfSize, glm::vec2 ring)
+{
+	Impulse impulse;
+	impulse.type = ImpulseType::Burst;
+	impulse.from = impulse.to = center;
+	impulse.radius = halfSize;
+	impulse.direction = glm::vec2(0.0f);
+	impulse.ring = ring;
+	m_Impulses.push_back(impulse);
+}
+
+void ImpulseQueue::AddScript(int step, int width, int height)
+{
+	if (step >= IMPULSE_SCRIPT_STEPS) return;
+
+	const glm::vec2 size((float)width, (float)height);
+	float t = (float)step / IMPULSE_SCRIPT_STEPS;
+	AddStroke(size * glm::vec2(0.2f + 0.4f * t, 0.3f), size * glm::vec2(0.25f + 0.4f * t, 0.35f), 0.02f * size.x);
+	AddBurst(size * glm::vec2(0.7f, 0.6f), 0.05f * size.x, glm::vec2(0.01f, 0.02f) * size.x);
+}
+
+void ImpulseQueue::Apply(glm::vec2* velocity, glm::vec4* color, int width, int height, RowRange rows) const
+{
+	for (const Impulse& impulse : m_Impulses) {
+		// Only visit the rows overlapped by the impulse's bounding box.
+		int minY, maxY;
+		if (impulse.type == ImpulseType::Stroke) {
+			minY = (int)glm::floor(glm::min(impulse.from.y, impulse.to.y) - impulse.radius);
+			maxY = (int)glm::ceil(glm::max(impulse.from.y, impulse.to.y) + impulse.radius);
+		}
+		else {
+			minY = (int)impulse.from.y - (int)impulse.radius;
+			maxY = glm::min((int)impulse.from.y + (int)impulse.radius, height - 1) - 1;
+		}
+		minY = glm::max(minY, rows.begin), maxY = glm::min(maxY, rows.end - 1);
+
+		for (int y = minY; y <= maxY; y++) {
+			if (impulse.type == ImpulseType::Stroke) ApplyStroke(impulse, velocity, color, width, y);
+			else ApplyBurst(impulse, velocity, color, width, y);
+		}
+	}
+}
+
+bool ImpulseQueue::Sample(glm::vec2 position, glm::vec2& velocity) const
+{
+	bool covered = false;
+	for (const Impulse& impulse : m_Impulses) {
+		glm::vec2 offset = position - impulse.from;
+
+		if (impulse.type == ImpulseType::Stroke) {
+			const glm::vec2 axis = impulse.to - impulse.from;
+			float t = glm::clamp(glm::dot(offset, axis) / glm::max(glm::dot(axis, axis), 1e-12f), 0.0f, 1.0f);
+			glm::vec2 delta = offset - t * axis;
+			float sqrdDist = glm::dot(delta, delta), sqrdRad = impulse.radius * impulse.radius;
+			if (sqrdDist > sqrdRad) continue;
+
+			velocity = impulse.direction * (sqrdDist > 0.2f * sqrdRad ? STROKE_STRENGTH_OUTER : STROKE_STRENGTH_INNER);
+			covered = true;
+		}
+		else {
+			float sqrdDist = glm::dot(offset, offset);
+			if (glm::abs(offset.x) > impulse.radius || glm::abs(offset.y) > impulse.radius || sqrdDist == 0.0f) continue;
+
+			velocity = offset * (BURST_STRENGTH * glm::inversesqrt(sqrdDist));
+			covered = true;
+		}
+	}
+	return covered;
+}
+
+void ImpulseQueue::ApplyStroke(const Impulse& impulse, glm::vec2* velocity, glm::vec4* color, int width, int y)
+{
+	const float sqrdRad = impulse.radius * impulse.radius;
+	const glm::vec2 axis = impulse.to - impulse.from;
+	const float rAxisLength = 1.0f / glm::max(glm::dot(axis, axis), 1e-12f);
+
+	int minX = glm::max((int)glm::floor(glm::min(impulse.from.x, impulse.to.x) - impulse.radius), 0);
+	int maxX = glm::min((int)glm::ceil(glm::max(impulse.from.x, impulse.to.x) + impulse.radius), width - 1);
+
+	glm::vec2* velocityRow = velocity + (size_t)y * width;
+	glm::vec4* colorRow = color + (size_t)y * width;
+
+	// Branch-free so the row vectorizes; cells outside the capsule keep their values.
+	for (int x = minX; x <= maxX; x++) {
+		glm::vec2 offset = glm::vec2((float)x, (float)y) - impulse.from;
+		float t = glm::clamp(glm::dot(offset, axis) * rAxisLength, 0.0f, 1.0f);
+		glm::vec2 delta = offset - t * axis;
+		float sqrdDist = glm::dot(delta, delta);
+
+		bool inside = sqrdDist <= sqrdRad;
+		float strength = sqrdDist > 0.2f * sqrdRad ? STROKE_STRENGTH_OUTER : STROKE_STRENGTH_INNER;
+
+		velocityRow[x] = inside ? impulse.direction * strength : velocityRow[x];
+		colorRow[x] = inside ? glm::vec4(1.0f) : colorRow[x];
+	}
+}
+
+void ImpulseQueue::ApplyBurst(const Impulse& impulse, glm::vec2* velocity, glm::vec4* color, int width, int y)
+{
+	const glm::vec2 ring = impulse.ring * impulse.ring;
+
+	int minX = glm::max((int)impulse.from.x - (int)impulse.radius, 0);
+	int maxX = glm::min((int)impulse.from.x + (int)impulse.radius, width - 1);
+
+	glm::vec2* velocityRow = velocity + (size_t)y * width;
+	glm::vec4* colorRow = color + (size_t)y * width;
+
+	for (int x = minX; x < maxX; x++) {
+		glm::vec2 offset = glm::vec2((float)x, (float)y) - impulse.from;
+		float sqrdDist = glm::dot(offset, offset);
+
+		// The center has no outward direction.
+		bool center = sqrdDist == 0.0f;
+		bool dye = sqrdDist >= ring.x && sqrdDist <= ring.y;
+
+		velocityRow[x] = center ? velocityRow[x] : offset * (BURST_STRENGTH * glm::inversesqrt(center ? 1.0f : sqrdDist));
+		colorRow[x] = dye ? glm::vec4(0.0f, 1.0f, 0.0f, 1.0f) : colorRow[x];
+	}
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include "Threading.h"
+
+/*
+* Number of steps the scripted impulses of the headless runs are queued for.
+*/
+#define IMPULSE_SCRIPT_STEPS 8
+
+enum class ImpulseType {
+	/* Capsule around a cursor movement, pushing along the movement. */
+	Stroke,
+	/* Square around a point, pushing outwards from the point. */
+	Burst
+};
+
+/*
+* Force and dye injected into the grid, in grid coordinates.
+*/
+struct Impulse {
+	ImpulseType type;
+	/* Capsule axis, from and to are equal for a burst. */
+	glm::vec2 from, to;
+	/* Capsule radius of a stroke, half-size of the square of a burst. */
+	float radius;
+	/* Stroke direction, normalized. */
+	glm::vec2 direction;
+	/* Inner and outer radius of the dye ring of a burst. */
+	glm::vec2 ring;
+};
+
+/*
+* Impulses collected during a frame, applied to the velocity and dye fields in a single pass over the grid.
+*/
+class ImpulseQueue {
+
+public:
+	/*
+	* Queues a stroke between two cursor samples.
+	* @param[in] from			Start of the stroke in grid coordinates.
+	* @param[in] to				End of the stroke in grid coordinates.
+	* @param[in] radius			Radius of the capsule around the stroke in cells.
+	*/
+	void AddStroke(glm::vec2 from, glm::vec2 to, float radius);
+	/*
+	* Queues a burst around a point.
+	* @param[in] center			Center of the burst in grid coordinates.
+	* @param[in] halfSize		Half-size of the square affected by the burst in cells.
+	* @param[in] ring			Inner and outer radius of the ring of dye in cells.
+	*/
+	void AddBurst(glm::vec2 center, float halfSize, glm::vec2 ring);
+	/*
+	* Queues the impulses of a step of a fixed script, a stroke sweeping to the right and a burst, placed
+	* relative to the grid. Nothing is queued from IMPULSE_SCRIPT_STEPS onwards.
+	* @param[in] step			Index of the step.
+	* @param[in] width			Grid width.
+	* @param[in] height			Grid height.
+	*/
+	void AddScript(int step, int width, int height);
+
+	/*
+	* Applies all impulses in the order they were queued to a band of rows.
+	* @param[in,out] velocity	Velocity field.
+	* @param[in,out] color		Dye field.
+	* @param[in] width			Grid width.
+	* @param[in] height			Grid height.
+	* @param[in] rows			Rows to apply the impulses to.
+	*/
+	void Apply(glm::vec2* velocity, glm::vec4* color, int width, int height, RowRange rows) const;
+
+	/*
+	* Evaluates the impulses at a single point, for engines that do not store velocities on the grid.
+	* @param[in] position		Point in grid coordinates.
+	* @param[out] velocity		Velocity imposed by the last impulse covering the point.
+	* @returns					Whether any impulse covers the point.
+	*/
+	bool Sample(glm::vec2 position, glm::vec2& velocity) const;
+
+	/*
+	* Removes all impulses.
+	*/
+	void Clear() { m_Impulses.clear(); }
+	/*
+	* Indicates whether no impulses are queued.
+	*/
+	bool Empty() const { return m_Impulses.empty(); }
+	/*
+	* Retrieves the queued impulses.
+	*/
+	const std::vector<Impulse>& Impulses() const { return m_Impulses; }
+
+private:
+	std::vector<Impulse> m_Impulses;
+
+	/*
+	* Rasterises a stroke into a single row.
+	*/
+	static void ApplyStroke(const Impulse& impulse, glm::vec2* velocity, glm::vec4* color, int width, int y);
+	/*
+	* Rasterises a burst into a single row.
+	*/
+	static void ApplyBurst(const Impulse& impulse, glm::vec2* velocity, glm::vec4* color, int width, int y);
+};
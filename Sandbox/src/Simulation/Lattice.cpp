@@ -0,0 +1,163 @@
+#include "stdfax.h"
+#include <emmintrin.h>
+#include "Lattice.h"
+#include "WorkerPool.h"
+#include "Constants.h"
+
+/*
+* Discrete velocities, weights and opposite directions of D2Q9: rest, the four axes, the four diagonals.
+*/
+static const int s_DirectionX[LATTICE_DIRECTIONS] = { 0, 1, 0, -1, 0, 1, -1, -1, 1 };
+static const int s_DirectionY[LATTICE_DIRECTIONS] = { 0, 0, 1, 0, -1, 1, 1, -1, -1 };
+static const int s_Opposite[LATTICE_DIRECTIONS] = { 0, 3, 4, 1, 2, 7, 8, 5, 6 };
+static const float s_Weights[LATTICE_DIRECTIONS] = {
+	4.0f / 9.0f, 1.0f / 9.0f, 1.0f / 9.0f, 1.0f / 9.0f, 1.0f / 9.0f, 1.0f / 36.0f, 1.0f / 36.0f, 1.0f / 36.0f, 1.0f / 36.0f
+};
+
+LatticeSolver::LatticeSolver(int width, int height)
+	: m_Width(width), m_Height(height)
+{
+	const size_t cells = (size_t)width * height;
+	m_Arena.Reset(LATTICE_DIRECTIONS * Arena::Align(sizeof(float) * cells) + Arena::Align(sizeof(glm::vec2) * cells));
+
+	for (int i = 0; i < LATTICE_DIRECTIONS; i++) m_Distributions[i] = m_Arena.Allocate<float>(cells);
+	m_Output = m_Arena.Allocate<glm::vec2>(cells);
+
+	Reset();
+}
+
+void LatticeSolver::Reset()
+{
+	const size_t cells = (size_t)m_Width * m_Height;
+
+	// The equilibrium at rest is the weights themselves.
+	for (int i = 0; i < LATTICE_DIRECTIONS; i++) std::fill(m_Distributions[i], m_Distributions[i] + cells, s_Weights[i]);
+	std::fill(m_Output, m_Output + cells, glm::vec2(0.0f));
+	m_Steps = 0;
+}
+
+void LatticeSolver::Step(WorkerPool* pool, uint thread, float dt, int substeps, glm::vec2* velocity)
+{
+	const float scale = dt * RDX / substeps;
+	const uint64_t steps = m_Steps;
+	RowRange rows = pool->Rows(thread, m_Height);
+
+	// Impulses are imposed once per frame, the velocity is only written back after the last substep.
+	for (int s = 0; s < substeps; s++) {
+		const bool odd = ((steps + s) & 1) != 0;
+		const glm::vec2* impose = s == 0 ? velocity : nullptr;
+		glm::vec2* output = s == substeps - 1 ? velocity : nullptr;
+
+		for (int y = rows.begin; y < rows.end; y++)
+			for (int x = 0; x < m_Width; x += 4) StepCells(x, y, odd, scale, impose, output);
+		pool->Sync(thread);
+	}
+
+	// Every thread read the step count before the first sync.
+	if (thread == 0) m_Steps += substeps;
+}
+
+void LatticeSolver::StepCells(int x, int y, bool odd, float scale, const glm::vec2* impose, glm::vec2* output)
+{
+	const int lanes = glm::min(4, m_Width - x);
+	const size_t cell = x + (size_t)y * m_Width;
+	auto inside = [&](int nx, int ny) { return nx >= 0 && ny >= 0 && nx < m_Width && ny < m_Height; };
+
+	// Cells whose odd-step neighbours might lie outside the domain, and partial groups, take the checked path.
+	const bool checked = lanes < 4 || (odd && (x == 0 || x + 4 >= m_Width || y == 0 || y == m_Height - 1));
+
+	// Stream: an even step reads the cell's own distributions, an odd step pulls them from the neighbours,
+	// where the previous even step stored them in the opposite slot. A wall reflects the cell's own.
+	__m128 f[LATTICE_DIRECTIONS];
+	for (int i = 0; i < LATTICE_DIRECTIONS; i++) {
+		const ptrdiff_t offset = s_DirectionX[i] + (ptrdiff_t)s_DirectionY[i] * m_Width;
+		if (!checked) {
+			f[i] = odd ? _mm_loadu_ps(m_Distributions[s_Opposite[i]] + cell - offset) : _mm_loadu_ps(m_Distributions[i] + cell);
+			continue;
+		}
+
+		alignas(16) float gathered[4];
+		for (int l = 0; l < 4; l++) {
+			int nx = x + l - s_DirectionX[i], ny = y - s_DirectionY[i];
+			if (l >= lanes) gathered[l] = s_Weights[i];
+			else if (odd && inside(nx, ny)) gathered[l] = m_Distributions[s_Opposite[i]][nx + (size_t)ny * m_Width];
+			else gathered[l] = m_Distributions[i][cell + l];
+		}
+		f[i] = _mm_load_ps(gathered);
+	}
+
+	// Moments.
+	const __m128 one = _mm_set1_ps(1.0f);
+	__m128 rho = f[0];
+	for (int i = 1; i < LATTICE_DIRECTIONS; i++) rho = _mm_add_ps(rho, f[i]);
+	__m128 mx = _mm_sub_ps(_mm_add_ps(_mm_add_ps(f[1], f[5]), f[8]), _mm_add_ps(_mm_add_ps(f[3], f[6]), f[7]));
+	__m128 my = _mm_sub_ps(_mm_add_ps(_mm_add_ps(f[2], f[5]), f[6]), _mm_add_ps(_mm_add_ps(f[4], f[7]), f[8]));
+	__m128 rRho = _mm_div_ps(one, rho);
+	__m128 ux = _mm_mul_ps(mx, rRho), uy = _mm_mul_ps(my, rRho);
+	__m128 omega = _mm_set1_ps(1.0f / (3.0f * LATTICE_VISCOSITY + 0.5f));
+
+	if (impose) {
+		// Cells whose velocity changed since the last output were written by the impulses. They are set to the
+		// equilibrium of the imposed velocity by relaxing them fully.
+		alignas(16) glm::vec2 imposed[4] = {}, last[4] = {};
+		for (int l = 0; l < lanes; l++) imposed[l] = impose[cell + l], last[l] = m_Output[cell + l];
+
+		__m128 i0 = _mm_load_ps(&imposed[0].x), i1 = _mm_load_ps(&imposed[2].x);
+		int changed = _mm_movemask_ps(_mm_cmpneq_ps(i0, _mm_load_ps(&last[0].x))) |
+			_mm_movemask_ps(_mm_cmpneq_ps(i1, _mm_load_ps(&last[2].x))) << 4;
+
+		if (changed) {
+			alignas(16) int lanesChanged[4];
+			for (int l = 0; l < 4; l++) lanesChanged[l] = (changed >> (2 * l)) & 3 ? -1 : 0;
+			__m128 mask = _mm_castsi128_ps(_mm_load_si128((const __m128i*)lanesChanged));
+
+			__m128 ix = _mm_mul_ps(_mm_shuffle_ps(i0, i1, _MM_SHUFFLE(2, 0, 2, 0)), _mm_set1_ps(scale));
+			__m128 iy = _mm_mul_ps(_mm_shuffle_ps(i0, i1, _MM_SHUFFLE(3, 1, 3, 1)), _mm_set1_ps(scale));
+
+			// Clamp the imposed speed to the accurate range of the lattice.
+			__m128 speed2 = _mm_max_ps(_mm_add_ps(_mm_mul_ps(ix, ix), _mm_mul_ps(iy, iy)), _mm_set1_ps(1e-12f));
+			__m128 limit = _mm_min_ps(one, _mm_mul_ps(_mm_set1_ps(LATTICE_MAX_SPEED), _mm_rsqrt_ps(speed2)));
+			ix = _mm_mul_ps(ix, limit), iy = _mm_mul_ps(iy, limit);
+
+			ux = _mm_or_ps(_mm_and_ps(mask, ix), _mm_andnot_ps(mask, ux));
+			uy = _mm_or_ps(_mm_and_ps(mask, iy), _mm_andnot_ps(mask, uy));
+			omega = _mm_or_ps(_mm_and_ps(mask, one), _mm_andnot_ps(mask, omega));
+		}
+	}
+
+	// BGK collision, relax towards the second-order equilibrium.
+	__m128 usq = _mm_mul_ps(_mm_set1_ps(1.5f), _mm_add_ps(_mm_mul_ps(ux, ux), _mm_mul_ps(uy, uy)));
+	for (int i = 0; i < LATTICE_DIRECTIONS; i++) {
+		__m128 cu = _mm_add_ps(_mm_mul_ps(_mm_set1_ps((float)s_DirectionX[i]), ux), _mm_mul_ps(_mm_set1_ps((float)s_DirectionY[i]), uy));
+		__m128 polynomial = _mm_add_ps(_mm_mul_ps(cu, _mm_add_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_set1_ps(4.5f), cu))), _mm_sub_ps(one, usq));
+		__m128 equilibrium = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(s_Weights[i]), rho), polynomial);
+		f[i] = _mm_add_ps(f[i], _mm_mul_ps(omega, _mm_sub_ps(equilibrium, f[i])));
+	}
+
+	if (output) {
+		__m128 rScale = _mm_set1_ps(1.0f / scale);
+		alignas(16) glm::vec2 velocity[4];
+		_mm_store_ps(&velocity[0].x, _mm_unpacklo_ps(_mm_mul_ps(ux, rScale), _mm_mul_ps(uy, rScale)));
+		_mm_store_ps(&velocity[2].x, _mm_unpackhi_ps(_mm_mul_ps(ux, rScale), _mm_mul_ps(uy, rScale)));
+		for (int l = 0; l < lanes; l++) output[cell + l] = m_Output[cell + l] = velocity[l];
+	}
+
+	// Store: an even step swaps into the opposite slots of the cell, an odd step pushes to the neighbours.
+	// A wall bounces the distribution back into the cell's opposite slot.
+	for (int i = 0; i < LATTICE_DIRECTIONS; i++) {
+		const ptrdiff_t offset = s_DirectionX[i] + (ptrdiff_t)s_DirectionY[i] * m_Width;
+		if (!checked) {
+			if (odd) _mm_storeu_ps(m_Distributions[i] + cell + offset, f[i]);
+			else _mm_storeu_ps(m_Distributions[s_Opposite[i]] + cell, f[i]);
+			continue;
+		}
+
+		alignas(16) float scattered[4];
+		_mm_store_ps(scattered, f[i]);
+		for (int l = 0; l < lanes; l++) {
+			int nx = x + l + s_DirectionX[i], ny = y + s_DirectionY[i];
+			if (odd && inside(nx, ny)) m_Distributions[i][nx + (size_t)ny * m_Width] = scattered[l];
+			else m_Distributions[s_Opposite[i]][cell + l] = scattered[l];
+		}
+	}
+}
@@ -0,0 +1,148 @@
+#include "stdfax.h"
+#include "Obstacles.h"
+#include "WorkerPool.h"
+#include "Constants.h"
+
+ObstacleSet::ObstacleSet(int width, int height)
+	: m_Width(width), m_Height(height)
+{
+	const size_t cells = (size_t)width * height;
+	m_Arena.Reset(Arena::Align(cells));
+	m_Solid = m_Arena.Allocate<uchar>(cells);
+	memset(m_Solid, 0, cells);
+}
+
+void ObstacleSet::Add(const Obstacle& obstacle)
+{
+	if (m_Bodies.size() >= MAX_OBSTACLES) FATAL_ERROR("At most %d obstacles are supported.", MAX_OBSTACLES);
+
+	Body body;
+	body.obstacle = obstacle;
+	Place(body);
+	m_Bodies.push_back(body);
+}
+
+void ObstacleSet::Move(float dt)
+{
+	m_Time += dt;
+
+	m_Dirty.clear(), m_DirtyPrevious.clear();
+	m_Rows = { m_Height, 0 };
+	m_DirtyRows = { m_Height, 0 };
+	for (Body& body : m_Bodies) {
+		Pose previous = body.rasterised;
+		Place(body);
+		const Bounds& bounds = body.pose.bounds;
+		m_Rows.begin = glm::min(m_Rows.begin, bounds.y0), m_Rows.end = glm::max(m_Rows.end, bounds.y1);
+
+		// An obstacle at rest covers the same cells as before.
+		const Obstacle& obstacle = body.obstacle;
+		bool moving = obstacle.amplitude != glm::vec2(0.0f) || obstacle.spin != 0.0f;
+		bool rasterised = previous.bounds.x1 > previous.bounds.x0 && previous.bounds.y1 > previous.bounds.y0;
+		if (!moving && rasterised) continue;
+
+		m_Dirty.push_back(&body);
+		m_DirtyPrevious.push_back(previous);
+		m_DirtyRows.begin = glm::min(m_DirtyRows.begin, bounds.y0), m_DirtyRows.end = glm::max(m_DirtyRows.end, bounds.y1);
+		if (rasterised)
+			m_DirtyRows.begin = glm::min(m_DirtyRows.begin, previous.bounds.y0), m_DirtyRows.end = glm::max(m_DirtyRows.end, previous.bounds.y1);
+		body.rasterised = body.pose;
+	}
+	if (m_Rows.end <= m_Rows.begin) m_Rows = { 0, 0 };
+	if (m_DirtyRows.end <= m_DirtyRows.begin) m_DirtyRows = { 0, 0 };
+}
+
+void ObstacleSet::Rasterize(WorkerPool* pool, uint thread)
+{
+	auto rasterize = [&](int y, int x0, int x1) {
+		x0 = glm::max(x0, 0), x1 = glm::min(x1, m_Width);
+		for (int x = x0; x < x1; x++) m_Solid[x + (size_t)y * m_Width] = Cover(x, y);
+	};
+
+	// Split the rows of all bodies rather than the bodies, overlapping bodies are rasterised by a single thread.
+	RowRange rows = pool->Rows(thread, m_DirtyRows.end - m_DirtyRows.begin);
+	for (int y = m_DirtyRows.begin + rows.begin; y < m_DirtyRows.begin + rows.end; y++)
+		for (size_t i = 0; i < m_Dirty.size(); i++) {
+			const Body& body = *m_Dirty[i];
+			Span before = Covered(m_DirtyPrevious[i], body.obstacle.halfSize, y), after = Covered(body.pose, body.obstacle.halfSize, y);
+
+			// Only the cells between the old and the new ends of the span change, plus a cell against rounding.
+			if (before.x1 > before.x0 && after.x1 > after.x0 && before.x0 < after.x1 && after.x0 < before.x1) {
+				rasterize(y, glm::min(before.x0, after.x0) - 1, glm::max(before.x0, after.x0) + 1);
+				rasterize(y, glm::min(before.x1, after.x1) - 1, glm::max(before.x1, after.x1) + 1);
+			}
+			else {
+				if (before.x1 > before.x0) rasterize(y, before.x0 - 1, before.x1 + 1);
+				if (after.x1 > after.x0) rasterize(y, after.x0 - 1, after.x1 + 1);
+			}
+		}
+}
+
+glm::vec2 ObstacleSet::VelocityAt(int x, int y) const
+{
+	const Body& body = m_Bodies[m_Solid[x + (size_t)y * m_Width] - 1];
+	glm::vec2 offset = glm::vec2(x, y) - body.pose.center;
+
+	// The velocity is in cells per second, the fluid's in world units.
+	return (body.velocity + body.obstacle.spin * glm::vec2(-offset.y, offset.x)) * DX;
+}
+
+void ObstacleSet::Place(Body& body) const
+{
+	const Obstacle& obstacle = body.obstacle;
+	float phase = obstacle.frequency * m_Time, angle = obstacle.angle + obstacle.spin * m_Time;
+	Pose& pose = body.pose;
+
+	pose.center = obstacle.anchor + obstacle.amplitude * glm::sin(phase);
+	pose.axis = glm::vec2(glm::cos(angle), glm::sin(angle));
+	body.velocity = obstacle.amplitude * obstacle.frequency * glm::cos(phase);
+
+	// Bounding box of the rotated rectangle, kept off the walls of the grid.
+	glm::vec2 extent = glm::abs(pose.axis.x) * obstacle.halfSize + glm::abs(pose.axis.y) * glm::vec2(obstacle.halfSize.y, obstacle.halfSize.x);
+	pose.bounds.x0 = glm::clamp((int)glm::floor(pose.center.x - extent.x), 1, m_Width - 1);
+	pose.bounds.y0 = glm::clamp((int)glm::floor(pose.center.y - extent.y), 1, m_Height - 1);
+	pose.bounds.x1 = glm::clamp((int)glm::ceil(pose.center.x + extent.x) + 1, 1, m_Width - 1);
+	pose.bounds.y1 = glm::clamp((int)glm::ceil(pose.center.y + extent.y) + 1, 1, m_Height - 1);
+}
+
+ObstacleSet::Span ObstacleSet::Covered(const Pose& pose, glm::vec2 halfSize, int y)
+{
+	const Bounds& bounds = pose.bounds;
+	if (y < bounds.y0 || y >= bounds.y1 || bounds.x1 <= bounds.x0) return {};
+
+	// Along the row both axes of the rectangle are linear in the offset t from the center, |slope t + offset| <= half
+	// bounds t on each axis.
+	float low = -FLT_MAX, high = FLT_MAX;
+	auto clip = [&](float slope, float offset, float half) {
+		if (slope == 0.0f) {
+			if (glm::abs(offset) > half) low = 1.0f, high = 0.0f;
+			return;
+		}
+		float t0 = (-half - offset) / slope, t1 = (half - offset) / slope;
+		low = glm::max(low, glm::min(t0, t1)), high = glm::min(high, glm::max(t0, t1));
+	};
+	const float dy = (float)y - pose.center.y;
+	clip(pose.axis.x, dy * pose.axis.y, halfSize.x);
+	clip(-pose.axis.y, dy * pose.axis.x, halfSize.y);
+	if (high < low) return {};
+
+	Span span;
+	span.x0 = glm::max((int)glm::ceil(pose.center.x + low), bounds.x0);
+	span.x1 = glm::min((int)glm::floor(pose.center.x + high) + 1, bounds.x1);
+	if (span.x1 <= span.x0) return {};
+	return span;
+}
+
+uchar ObstacleSet::Cover(int x, int y) const
+{
+	for (size_t i = 0; i < m_Bodies.size(); i++) {
+		const Pose& pose = m_Bodies[i].pose;
+		const Bounds& bounds = pose.bounds;
+		if (x < bounds.x0 || x >= bounds.x1 || y < bounds.y0 || y >= bounds.y1) continue;
+
+		glm::vec2 offset = glm::vec2(x, y) - pose.center;
+		float u = glm::dot(offset, pose.axis), v = glm::dot(offset, glm::vec2(-pose.axis.y, pose.axis.x));
+		if (glm::abs(u) <= m_Bodies[i].obstacle.halfSize.x && glm::abs(v) <= m_Bodies[i].obstacle.halfSize.y) return (uchar)(i + 1);
+	}
+	return 0;
+}
@@ -0,0 +1,140 @@
+#pragma once
+#include <vector>
+#include "Arena.h"
+#include "Threading.h"
+
+class WorkerPool;
+
+/*
+* Largest number of obstacles, the solid mask stores an obstacle per cell in a byte.
+*/
+#define MAX_OBSTACLES 255
+
+/*
+* Kinematic rectangle moving along a prescribed path, in grid coordinates. Its center oscillates around the
+* anchor and it spins around its center: a paddle has an amplitude, a fan a spin.
+*/
+struct Obstacle {
+	glm::vec2 anchor;
+	/* Half the size of the rectangle along its own axes. */
+	glm::vec2 halfSize;
+	/* Largest offset of the center from the anchor and the angular frequency of the oscillation. */
+	glm::vec2 amplitude;
+	float frequency;
+	/* Angle at time zero and angular velocity in radians per second. */
+	float angle;
+	float spin;
+};
+
+/*
+* Solid mask of a set of moving obstacles. Each cell holds the index plus one of the obstacle covering it, or zero
+* for fluid. The velocity of a solid cell is evaluated from the pose of its obstacle instead of being stored, so
+* moving an obstacle only changes the mask where the coverage of its old and new pose differs. A rectangle covers
+* a single span of every row, so per row only the cells between the old and the new ends of the span are
+* rasterised again, split over the threads by rows. All other cells keep their state.
+*/
+class ObstacleSet {
+
+public:
+	/*
+	* Creates an empty mask.
+	* @param[in] width			Number of grid cells in x-direction.
+	* @param[in] height			Number of grid cells in y-direction.
+	*/
+	ObstacleSet(int width, int height);
+
+	/*
+	* Adds an obstacle, rasterised by the next update.
+	*/
+	void Add(const Obstacle& obstacle);
+	bool Empty() const { return m_Bodies.empty(); }
+
+	/*
+	* Moves the obstacles to the poses after a step and collects the obstacles to rasterise.
+	* @param[in] dt				Time-step.
+	*/
+	void Move(float dt);
+	/*
+	* Rasterises the cells whose coverage the obstacles collected by Move changed. Called by every thread of the pool.
+	*/
+	void Rasterize(WorkerPool* pool, uint thread);
+
+	/*
+	* Indicates whether a range of rows, or the rows next to it, holds solid cells.
+	*/
+	bool Covers(RowRange rows) const { return rows.begin <= m_Rows.end && rows.end >= m_Rows.begin && m_Rows.end > m_Rows.begin; }
+	/*
+	* Retrieves the rows holding solid cells.
+	*/
+	RowRange Rows() const { return m_Rows; }
+	/*
+	* Retrieves the mask, indexed x + y * width.
+	*/
+	const uchar* Solid() const { return m_Solid; }
+	/*
+	* Evaluates the velocity of a solid cell in world units.
+	*/
+	glm::vec2 VelocityAt(int x, int y) const;
+
+private:
+	/*
+	* Cells covered by a pose, from the first up to the last cell.
+	*/
+	struct Bounds {
+		int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+	};
+	/*
+	* Cells of a row, from the first up to the last cell.
+	*/
+	struct Span {
+		int x0 = 0, x1 = 0;
+	};
+	/*
+	* Position and orientation of a rectangle, and its bounds.
+	*/
+	struct Pose {
+		glm::vec2 center;
+		glm::vec2 axis;
+		Bounds bounds;
+	};
+	/*
+	* An obstacle, its current pose and the pose it was last rasterised at.
+	*/
+	struct Body {
+		Obstacle obstacle;
+		Pose pose, rasterised;
+		glm::vec2 velocity;
+	};
+
+	int m_Width, m_Height;
+	float m_Time = 0.0f;
+
+	Arena m_Arena;
+	uchar* m_Solid = nullptr;
+	std::vector<Body> m_Bodies;
+	/*
+	* Bodies to rasterise, with the pose they were rasterised at before, and the rows of both poses.
+	*/
+	std::vector<Body*> m_Dirty;
+	std::vector<Pose> m_DirtyPrevious;
+	RowRange m_DirtyRows = { 0, 0 };
+	/*
+	* Rows holding solid cells after the last update.
+	*/
+	RowRange m_Rows = { 0, 0 };
+
+	/*
+	* Computes the pose of a body at the current time.
+	*/
+	void Place(Body& body) const;
+	/*
+	* Finds the cells of a row whose centers a pose of a rectangle covers, exact up to rounding.
+	* @returns					Span of the cells, empty when the pose does not reach the row.
+	*/
+	static Span Covered(const Pose& pose, glm::vec2 halfSize, int y);
+	/*
+	* Finds the obstacle covering the center of a cell.
+	* @returns					Index of the obstacle plus one, or zero for fluid.
+	*/
+	uchar Cover(int x, int y) const;
+};
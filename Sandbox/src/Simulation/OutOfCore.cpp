@@ -0,0 +1,320 @@
+#include "stdfax.h"
+#include <future>
+#include "OutOfCore.h"
+#include "Constants.h"
+#include "Stencil.h"
+#include "WorkerPool.h"
+#include "Template/Application.h"
+
+static_assert(OUT_OF_CORE_FUSED_SWEEPS + 1 <= OUT_OF_CORE_HALO, "The halo must hold the fused sweeps and the divergence after them.");
+
+/*
+* Retrieves the granularity at which views of a file can start.
+*/
+static size_t AllocationGranularity()
+{
+	static size_t s_Granularity = 0;
+	if (!s_Granularity) {
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		s_Granularity = info.dwAllocationGranularity;
+	}
+	return s_Granularity;
+}
+
+/*
+* Starts reading views in. Returns once the reads are issued, the pages land in the standby list so the copies
+* out of the views take soft faults at most.
+*/
+static void Prefetch(const std::vector<MappedBand>& bands)
+{
+	std::vector<WIN32_MEMORY_RANGE_ENTRY> ranges;
+	for (const MappedBand& band : bands) ranges.push_back({ band.view, band.size });
+	PrefetchVirtualMemory(GetCurrentProcess(), ranges.size(), ranges.data(), 0);
+}
+
+/*
+* Writes a view back to its file and unmaps it.
+*/
+static void WriteBack(const MappedBand& band)
+{
+	FlushViewOfFile(band.view, band.size);
+	UnmapViewOfFile(band.view);
+}
+
+/*
+* Divides a range of rows among the threads of a pool.
+*/
+static RowRange Share(WorkerPool* pool, uint thread, RowRange rows)
+{
+	RowRange part = pool->Rows(thread, rows.end - rows.begin);
+	return { rows.begin + part.begin, rows.begin + part.end };
+}
+
+MappedField::MappedField(const std::string& path, size_t rowSize, int rows)
+	: m_RowSize(rowSize), m_Rows(rows)
+{
+	const uint64_t size = (uint64_t)rowSize * rows;
+
+	m_File = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+	if (m_File == INVALID_HANDLE_VALUE) FATAL_ERROR("Failed to create the field file %s.", path.c_str());
+
+	// Mapping a section larger than the file extends the file with zeros.
+	m_Section = CreateFileMappingA(m_File, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, NULL);
+	if (!m_Section) FATAL_ERROR("Failed to map the field file %s of %llu bytes.", path.c_str(), (unsigned long long)size);
+}
+
+MappedField::~MappedField()
+{
+	if (m_Section) CloseHandle(m_Section);
+	if (m_File && m_File != INVALID_HANDLE_VALUE) CloseHandle(m_File);
+}
+
+MappedBand MappedField::Map(RowRange rows) const
+{
+	const uint64_t begin = (uint64_t)m_RowSize * rows.begin, end = (uint64_t)m_RowSize * rows.end;
+	const uint64_t offset = begin & ~(uint64_t)(AllocationGranularity() - 1);
+
+	MappedBand band;
+	band.size = (size_t)(end - offset);
+	band.view = (uchar*)MapViewOfFile(m_Section, FILE_MAP_ALL_ACCESS, (DWORD)(offset >> 32), (DWORD)offset, band.size);
+	if (!band.view) FATAL_ERROR("Failed to map rows %d to %d of a field file.", rows.begin, rows.end);
+
+	band.first = band.view + (begin - offset);
+	return band;
+}
+
+OutOfCoreSolver::OutOfCoreSolver(const std::string& directory, int width, int height)
+	: m_Width(width), m_Height(height)
+{
+	auto create = [&](const char* name, size_t elementSize) { return new MappedField(directory + "\\" + name + ".field", elementSize * width, height); };
+	m_Velocity[0] = create("velocity0", sizeof(glm::vec2)), m_Velocity[1] = create("velocity1", sizeof(glm::vec2));
+	m_Color[0] = create("color0", sizeof(glm::vec4)), m_Color[1] = create("color1", sizeof(glm::vec4));
+	m_Pressure[0] = create("pressure0", sizeof(float)), m_Pressure[1] = create("pressure1", sizeof(float));
+	m_Divergence = create("divergence", sizeof(float));
+
+	const size_t cells = (size_t)width * (OUT_OF_CORE_BAND + 2 * OUT_OF_CORE_HALO);
+	size_t size =
+		2 * Arena::Align(sizeof(glm::vec2) * cells) +
+		2 * Arena::Align(sizeof(glm::vec4) * cells) +
+		2 * Arena::Align(sizeof(float) * cells) +
+		1 * Arena::Align(sizeof(float) * cells);
+
+	m_Arena.Reset(size);
+
+	m_VelocityWindow = (uchar*)m_Arena.Allocate<glm::vec2>(cells);
+	m_VelocityOutput = (uchar*)m_Arena.Allocate<glm::vec2>(cells);
+	m_ColorWindow = (uchar*)m_Arena.Allocate<glm::vec4>(cells);
+	m_ColorOutput = (uchar*)m_Arena.Allocate<glm::vec4>(cells);
+	m_PressureWindow = (uchar*)m_Arena.Allocate<float>(cells);
+	m_PressureOutput = (uchar*)m_Arena.Allocate<float>(cells);
+	m_DivergenceWindow = (uchar*)m_Arena.Allocate<float>(cells);
+
+	// Fresh files are zero-filled, the fields start at rest.
+}
+
+OutOfCoreSolver::~OutOfCoreSolver()
+{
+	for (int i = 0; i < 2; i++) delete m_Velocity[i], delete m_Color[i], delete m_Pressure[i];
+	delete m_Divergence;
+}
+
+void OutOfCoreSolver::Reset()
+{
+	StreamBands({}, { { m_Velocity[0], &m_VelocityWindow }, { m_Color[0], &m_ColorWindow }, { m_Pressure[0], &m_PressureWindow } }, 0,
+		[&](WorkerPool* pool, uint thread, RowRange rows) {
+			RowRange part = Share(pool, thread, rows);
+			size_t cells = (size_t)(part.end - part.begin) * m_Width;
+			memset(Window<glm::vec2>(m_VelocityWindow) + (size_t)part.begin * m_Width, 0, sizeof(glm::vec2) * cells);
+			memset(Window<glm::vec4>(m_ColorWindow) + (size_t)part.begin * m_Width, 0, sizeof(glm::vec4) * cells);
+			memset(Window<float>(m_PressureWindow) + (size_t)part.begin * m_Width, 0, sizeof(float) * cells);
+		});
+}
+
+void OutOfCoreSolver::Step(float dt, const ImpulseQueue& impulses)
+{
+	// Impulses, boundaries and advection. The whole window gets the impulses and boundaries, the halos are read by
+	// the backtraces.
+	StreamBands({ { m_Velocity[0], &m_VelocityWindow }, { m_Color[0], &m_ColorWindow } },
+		{ { m_Velocity[1], &m_VelocityOutput }, { m_Color[1], &m_ColorOutput } }, OUT_OF_CORE_HALO,
+		[&](WorkerPool* pool, uint thread, RowRange rows) {
+			glm::vec2* velocity = Window<glm::vec2>(m_VelocityWindow);
+			glm::vec4* color = Window<glm::vec4>(m_ColorWindow);
+
+			impulses.Apply(velocity, color, m_Width, m_Height, Share(pool, thread, m_Window));
+			pool->Sync(thread);
+			if (thread == 0) UpdateBoundaries(velocity, -1.0f, m_Window), UpdateBoundaries(color, 0.0f, m_Window);
+			pool->Sync(thread);
+
+			RowRange part = Share(pool, thread, rows);
+			Advect(velocity, velocity, Window<glm::vec2>(m_VelocityOutput), dt, part);
+			Advect(velocity, color, Window<glm::vec4>(m_ColorOutput), dt, part);
+		});
+	std::swap(m_Velocity[0], m_Velocity[1]), std::swap(m_Color[0], m_Color[1]);
+
+	// Diffusion, the last pass computes the divergence from its result.
+	for (int done = 0; done < OUT_OF_CORE_SWEEPS; done += OUT_OF_CORE_FUSED_SWEEPS) {
+		const int sweeps = glm::min(OUT_OF_CORE_FUSED_SWEEPS, OUT_OF_CORE_SWEEPS - done);
+		const bool last = done + sweeps == OUT_OF_CORE_SWEEPS;
+
+		std::vector<Stream> outputs = { { m_Velocity[1], &m_VelocityWindow } };
+		if (last) outputs.push_back({ m_Divergence, &m_DivergenceWindow });
+
+		StreamBands({ { m_Velocity[0], &m_VelocityWindow } }, outputs, last ? sweeps + 1 : sweeps,
+			[&](WorkerPool* pool, uint thread, RowRange rows) {
+				Relax<glm::vec2>(pool, thread, sweeps, &m_VelocityWindow, &m_VelocityOutput,
+					[&](const glm::vec2* velocity, glm::vec2* output, RowRange part) { DiffuseVelocities(dt, velocity, output, part); });
+				if (last) ComputeDivergence(Window<glm::vec2>(m_VelocityWindow), Window<float>(m_DivergenceWindow), Share(pool, thread, rows));
+			});
+		std::swap(m_Velocity[0], m_Velocity[1]);
+	}
+
+	// Pressure, the last pass sets its boundaries for the gradient.
+	for (int done = 0; done < OUT_OF_CORE_SWEEPS; done += OUT_OF_CORE_FUSED_SWEEPS) {
+		const int sweeps = glm::min(OUT_OF_CORE_FUSED_SWEEPS, OUT_OF_CORE_SWEEPS - done);
+		const bool last = done + sweeps == OUT_OF_CORE_SWEEPS;
+
+		StreamBands({ { m_Pressure[0], &m_PressureWindow }, { m_Divergence, &m_DivergenceWindow } }, { { m_Pressure[1], &m_PressureWindow } }, sweeps,
+			[&](WorkerPool* pool, uint thread, RowRange rows) {
+				const float* divergence = Window<float>(m_DivergenceWindow);
+				Relax<float>(pool, thread, sweeps, &m_PressureWindow, &m_PressureOutput,
+					[&](const float* pressure, float* output, RowRange part) { ComputePressure(pressure, divergence, output, part); });
+				if (last && thread == 0) UpdateBoundaries(Window<float>(m_PressureWindow), 1.0f, rows);
+			});
+		std::swap(m_Pressure[0], m_Pressure[1]);
+	}
+
+	StreamBands({ { m_Velocity[0], &m_VelocityWindow }, { m_Pressure[0], &m_PressureWindow } }, { { m_Velocity[1], &m_VelocityWindow } }, 1,
+		[&](WorkerPool* pool, uint thread, RowRange rows) {
+			SubtractPressureGradient(Window<glm::vec2>(m_VelocityWindow), Window<float>(m_PressureWindow), Share(pool, thread, rows));
+		});
+	std::swap(m_Velocity[0], m_Velocity[1]);
+}
+
+void OutOfCoreSolver::ReadColors(RowRange rows, glm::vec4* colors) const
+{
+	MappedBand band = m_Color[0]->Map(rows);
+	memcpy(colors, band.first, m_Color[0]->RowSize() * (rows.end - rows.begin));
+	UnmapViewOfFile(band.view);
+}
+
+void OutOfCoreSolver::StreamBands(const std::vector<Stream>& inputs, const std::vector<Stream>& outputs, int halo, const std::function<void(WorkerPool*, uint, RowRange)>& kernel)
+{
+	WorkerPool* pool = Application::Workers();
+	const int bands = (m_Height + OUT_OF_CORE_BAND - 1) / OUT_OF_CORE_BAND;
+
+	auto bandRows = [&](int band) { return RowRange{ band * OUT_OF_CORE_BAND, glm::min((band + 1) * OUT_OF_CORE_BAND, m_Height) }; };
+	auto windowRows = [&](RowRange rows) { return RowRange{ glm::max(rows.begin - halo, 0), glm::min(rows.end + halo, m_Height) }; };
+
+	// Maps the windows of the inputs and the band of the outputs, and starts reading them in. The outputs are
+	// read as well, as the views are not aligned to whole pages.
+	auto map = [&](int band) {
+		std::vector<MappedBand> views;
+		for (const Stream& input : inputs) views.push_back(input.field->Map(windowRows(bandRows(band))));
+		for (const Stream& output : outputs) views.push_back(output.field->Map(bandRows(band)));
+		Prefetch(views);
+		return views;
+	};
+
+	std::future<std::vector<MappedBand>> next = std::async(std::launch::async, map, 0);
+	std::future<void> written;
+
+	for (int band = 0; band < bands; band++) {
+		std::vector<MappedBand> views = next.get();
+		if (band + 1 < bands) next = std::async(std::launch::async, map, band + 1);
+
+		const RowRange rows = bandRows(band);
+		m_Window = windowRows(rows);
+
+		pool->Run([&](uint thread) {
+			RowRange part = Share(pool, thread, m_Window);
+			for (size_t i = 0; i < inputs.size(); i++) {
+				const size_t rowSize = inputs[i].field->RowSize();
+				memcpy(*inputs[i].window + rowSize * (part.begin - m_Window.begin), views[i].first + rowSize * (part.begin - m_Window.begin), rowSize * (part.end - part.begin));
+			}
+			pool->Sync(thread);
+
+			kernel(pool, thread, rows);
+			pool->Sync(thread);
+
+			part = Share(pool, thread, rows);
+			for (size_t i = 0; i < outputs.size(); i++) {
+				const size_t rowSize = outputs[i].field->RowSize();
+				memcpy(views[inputs.size() + i].first + rowSize * (part.begin - rows.begin), *outputs[i].window + rowSize * (part.begin - m_Window.begin), rowSize * (part.end - part.begin));
+			}
+		});
+
+		// The inputs were only read. The outputs are written back while the next band is computed, one band at a time.
+		for (size_t i = 0; i < inputs.size(); i++) UnmapViewOfFile(views[i].view);
+		if (written.valid()) written.get();
+		std::vector<MappedBand> dirty(views.begin() + inputs.size(), views.end());
+		written = std::async(std::launch::async, [dirty]() { for (const MappedBand& view : dirty) WriteBack(view); });
+	}
+	if (written.valid()) written.get();
+}
+
+template<typename T>
+void OutOfCoreSolver::Relax(WorkerPool* pool, uint thread, int sweeps, uchar** field, uchar** output, const std::function<void(const T*, T*, RowRange)>& kernel)
+{
+	RowRange valid = m_Window;
+	for (int sweep = 0; sweep < sweeps; sweep++) {
+		// Every sweep reads a row further into the halos, the edges of the grid are clamped and stay valid.
+		if (valid.begin > 0) valid.begin++;
+		if (valid.end < m_Height) valid.end--;
+
+		kernel(Window<T>(*field), Window<T>(*output), Share(pool, thread, valid));
+		pool->Sync(thread);
+		if (thread == 0) std::swap(*field, *output);
+		pool->Sync(thread);
+	}
+}
+
+template<typename T>
+void OutOfCoreSolver::UpdateBoundaries(T* field, float scale, RowRange rows)
+{
+	Stencil::Boundaries(Stencil::Dense<T>(field, m_Width, m_Height), scale, rows);
+}
+
+template<typename T>
+void OutOfCoreSolver::Advect(const glm::vec2* velocity, const T* field, T* output, float dt, RowRange rows)
+{
+	// Limit the backtrace like a slab's, so it stays within the window.
+	using namespace Stencil;
+	Dense<const glm::vec2> w(velocity, m_Width, m_Height);
+	Run(rows, Assign(Dense<T>(output, m_Width, m_Height), Sample(Dense<const T>(field, m_Width, m_Height), Backtrace(Center(w), dt * RDX, (float)ADVECTION_REACH))));
+}
+
+void OutOfCoreSolver::DiffuseVelocities(float dt, const glm::vec2* velocity, glm::vec2* output, RowRange rows)
+{
+	const float alpha = (DX * DX) / (VISCOSITY * dt);
+	const float rBeta = 1.0f / (alpha + 4.0f);
+
+	using namespace Stencil;
+	Dense<const glm::vec2> w(velocity, m_Width, m_Height);
+	Run(rows, Assign(Dense<glm::vec2>(output, m_Width, m_Height), (Left(w) + Right(w) + Below(w) + Above(w) + alpha * Center(w)) * rBeta));
+}
+
+void OutOfCoreSolver::ComputeDivergence(const glm::vec2* velocity, float* divergence, RowRange rows)
+{
+	using namespace Stencil;
+	Dense<const glm::vec2> w(velocity, m_Width, m_Height);
+	Run(rows, Assign(Dense<float>(divergence, m_Width, m_Height), HALFDX * ((X(Right(w)) - X(Left(w))) + (Y(Above(w)) - Y(Below(w))))));
+}
+
+void OutOfCoreSolver::ComputePressure(const float* pressure, const float* divergence, float* output, RowRange rows)
+{
+	const float alpha = -1.0f * (DX * DX);
+	const float rBeta = 0.25f;
+
+	using namespace Stencil;
+	Dense<const float> p(pressure, m_Width, m_Height), b(divergence, m_Width, m_Height);
+	Run(rows, Assign(Dense<float>(output, m_Width, m_Height), (Left(p) + Right(p) + Below(p) + Above(p) + alpha * Center(b)) * rBeta));
+}
+
+void OutOfCoreSolver::SubtractPressureGradient(glm::vec2* velocity, const float* pressure, RowRange rows)
+{
+	using namespace Stencil;
+	Dense<glm::vec2> w(velocity, m_Width, m_Height);
+	Dense<const float> p(pressure, m_Width, m_Height);
+	Run(rows, Assign(w, Center(w) - HALFDX * Vec2(Right(p) - Left(p), Above(p) - Below(p))));
+}
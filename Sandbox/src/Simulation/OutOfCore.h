@@ -0,0 +1,181 @@
+#pragma once
+#include <functional>
+#include "Arena.h"
+#include "Impulse.h"
+#include "Constants.h"
+
+class WorkerPool;
+
+/*
+* Number of rows streamed through memory at a time.
+*/
+#define OUT_OF_CORE_BAND 256
+/*
+* Number of rows read on each side of a band. Advection reads up to this many rows into the neighbouring bands,
+* like the halos of a slab, and a pass of fused sweeps needs one row per sweep.
+*/
+#define OUT_OF_CORE_HALO (ADVECTION_REACH + 1)
+/*
+* Number of Jacobi sweeps per step, and the number of them fused into a single pass over the bands.
+*/
+#define OUT_OF_CORE_SWEEPS 8
+#define OUT_OF_CORE_FUSED_SWEEPS 8
+
+/*
+* Rows of a mapped field mapped into memory.
+*/
+struct MappedBand {
+	/*
+	* Start and size of the view, aligned to the allocation granularity.
+	*/
+	uchar* view = nullptr;
+	size_t size = 0;
+	/*
+	* First row of the band within the view.
+	*/
+	uchar* first = nullptr;
+};
+
+/*
+* Grid field stored in a file, of which bands of rows are mapped into memory on demand. The file is deleted when
+* the field is destroyed.
+*/
+class MappedField {
+
+public:
+	/*
+	* Creates the file, zero-filled.
+	* @param[in] path			Path of the file.
+	* @param[in] rowSize		Size of a row in bytes.
+	* @param[in] rows			Number of rows.
+	*/
+	MappedField(const std::string& path, size_t rowSize, int rows);
+	~MappedField();
+
+	MappedField(const MappedField&) = delete;
+	MappedField& operator=(const MappedField&) = delete;
+
+	/*
+	* Maps a band of rows.
+	* @param[in] rows			Rows to map.
+	* @returns					The view holding the rows.
+	*/
+	MappedBand Map(RowRange rows) const;
+	size_t RowSize() const { return m_RowSize; }
+
+private:
+	HANDLE m_File = nullptr, m_Section = nullptr;
+	size_t m_RowSize;
+	int m_Rows;
+};
+
+/*
+* Simulation whose fields live in memory-mapped files, for grids that do not fit in memory. Every phase of the
+* step streams over the grid in bands of OUT_OF_CORE_BAND rows: the band and its halos are copied into resident
+* windows, the kernels run on the windows, and the band is copied back. While a band is computed the next one is
+* mapped and read in asynchronously, and the previous one is written back, so the disk stays busy with large
+* sequential transfers instead of faulting in single pages. The Jacobi sweeps of a pass are fused per band:
+* every sweep is valid one row less into the halos, so a window with a halo per sweep yields the band after all
+* of them, at the cost of relaxing the halos redundantly. The step matches SlabSolver's.
+*/
+class OutOfCoreSolver {
+
+public:
+	/*
+	* Creates the fields, at rest.
+	* @param[in] directory		Directory the files of the fields are created in.
+	* @param[in] width			Number of grid cells in x-direction.
+	* @param[in] height			Number of grid cells in y-direction.
+	*/
+	OutOfCoreSolver(const std::string& directory, int width, int height);
+	~OutOfCoreSolver();
+
+	OutOfCoreSolver(const OutOfCoreSolver&) = delete;
+	OutOfCoreSolver& operator=(const OutOfCoreSolver&) = delete;
+
+	/*
+	* Clears the velocity, pressure and color.
+	*/
+	void Reset();
+	/*
+	* Advances the simulation by a single time-step.
+	* @param[in] dt				Time-step.
+	* @param[in] impulses		Impulses to apply.
+	*/
+	void Step(float dt, const ImpulseQueue& impulses);
+
+	/*
+	* Copies a band of rows of the color field into memory.
+	* @param[in] rows			Rows to copy.
+	* @param[out] colors		Array of width * (rows.end - rows.begin) colors.
+	*/
+	void ReadColors(RowRange rows, glm::vec4* colors) const;
+
+private:
+	/*
+	* A field a pass streams through and the window holding its current band.
+	*/
+	struct Stream {
+		MappedField* field;
+		uchar** window;
+	};
+
+	int m_Width, m_Height;
+	/*
+	* Fields on disk, the current state and the output of a pass.
+	*/
+	MappedField* m_Velocity[2] = {}, * m_Color[2] = {}, * m_Pressure[2] = {};
+	MappedField* m_Divergence = nullptr;
+
+	Arena m_Arena;
+	/*
+	* Resident windows, each holding a band and its halos, and the rows of the grid they hold.
+	*/
+	uchar* m_VelocityWindow = nullptr, * m_VelocityOutput = nullptr;
+	uchar* m_ColorWindow = nullptr, * m_ColorOutput = nullptr;
+	uchar* m_PressureWindow = nullptr, * m_PressureOutput = nullptr;
+	uchar* m_DivergenceWindow = nullptr;
+	RowRange m_Window = { 0, 0 };
+
+	/*
+	* Offsets a window so that it is indexed with the coordinates of the whole grid.
+	*/
+	template<typename T>
+	T* Window(uchar* window) const { return (T*)window - (ptrdiff_t)m_Window.begin * m_Width; }
+
+	/*
+	* Runs a kernel over every band of the grid. The windows of the inputs are loaded with the band and its halos,
+	* after the kernel the band is stored from the windows of the outputs.
+	* @param[in] inputs			Fields read by the kernel.
+	* @param[in] outputs		Fields written by the kernel, must not be inputs.
+	* @param[in] halo			Number of rows read on each side of the band.
+	* @param[in] kernel			Kernel computing a band, called by every thread of the pool.
+	*/
+	void StreamBands(const std::vector<Stream>& inputs, const std::vector<Stream>& outputs, int halo, const std::function<void(WorkerPool*, uint, RowRange)>& kernel);
+	/*
+	* Runs fused Jacobi sweeps over the window, ping-ponging between two windows. Afterwards the field window
+	* holds the result, valid for the window shrunk by a row per sweep. Called by every thread of the pool.
+	* @param[in] sweeps			Number of sweeps.
+	* @param[in,out] field		Window relaxed by the sweeps.
+	* @param[in,out] output		Window the kernel writes to.
+	* @param[in] kernel			Kernel relaxing a range of rows from the first field into the second.
+	*/
+	template<typename T>
+	void Relax(WorkerPool* pool, uint thread, int sweeps, uchar** field, uchar** output, const std::function<void(const T*, T*, RowRange)>& kernel);
+
+	/*
+	* Sets the boundaries of the whole grid on a range of rows.
+	*/
+	template<typename T>
+	void UpdateBoundaries(T* field, float scale, RowRange rows);
+	/*
+	* Advects a field through the velocity field. Backtraces are limited to ADVECTION_REACH rows like a slab's.
+	*/
+	template<typename T>
+	void Advect(const glm::vec2* velocity, const T* field, T* output, float dt, RowRange rows);
+
+	void DiffuseVelocities(float dt, const glm::vec2* velocity, glm::vec2* output, RowRange rows);
+	void ComputeDivergence(const glm::vec2* velocity, float* divergence, RowRange rows);
+	void ComputePressure(const float* pressure, const float* divergence, float* output, RowRange rows);
+	void SubtractPressureGradient(glm::vec2* velocity, const float* pressure, RowRange rows);
+};
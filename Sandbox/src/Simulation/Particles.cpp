@@ -0,0 +1,98 @@
+#include "stdfax.h"
+#include "Particles.h"
+
+/*
+* Spreads the lower 16 bits of a value over the even bits.
+*/
+static uint SpreadBits(uint value)
+{
+	value &= 0x0000FFFF;
+	value = (value | (value << 8)) & 0x00FF00FF;
+	value = (value | (value << 4)) & 0x0F0F0F0F;
+	value = (value | (value << 2)) & 0x33333333;
+	value = (value | (value << 1)) & 0x55555555;
+	return value;
+}
+
+float HashUnit(uint value)
+{
+	value ^= value >> 16, value *= 0x7FEB352D;
+	value ^= value >> 15, value *= 0x846CA68B;
+	value ^= value >> 16;
+	return (value >> 8) * (1.0f / 16777216.0f);
+}
+
+void Particles::Resize(size_t count)
+{
+	x.resize(count, 0.0f), y.resize(count, 0.0f);
+	vx.resize(count, 0.0f), vy.resize(count, 0.0f);
+}
+
+void Particles::Gather(const std::vector<uint>& order)
+{
+	std::vector<float> scratch(order.size());
+	for (std::vector<float>* attribute : { &x, &y, &vx, &vy }) {
+		for (size_t i = 0; i < order.size(); i++) scratch[i] = (*attribute)[order[i]];
+		attribute->swap(scratch);
+	}
+}
+
+void Particles::SortMorton(float cellSize)
+{
+	const size_t count = Size();
+	const float rCellSize = 1.0f / cellSize;
+
+	std::vector<uint> keys(count), order(count), sortedKeys(count), sortedOrder(count);
+	for (size_t i = 0; i < count; i++) {
+		uint cx = (uint)glm::clamp(x[i] * rCellSize, 0.0f, 65535.0f);
+		uint cy = (uint)glm::clamp(y[i] * rCellSize, 0.0f, 65535.0f);
+		keys[i] = SpreadBits(cx) | SpreadBits(cy) << 1;
+		order[i] = (uint)i;
+	}
+
+	// Stable LSD radix sort, one byte of the key per pass.
+	for (int shift = 0; shift < 32; shift += 8) {
+		size_t start[257] = {};
+		for (size_t i = 0; i < count; i++) start[((keys[i] >> shift) & 0xFF) + 1]++;
+		for (int b = 0; b < 256; b++) start[b + 1] += start[b];
+
+		for (size_t i = 0; i < count; i++) {
+			size_t slot = start[(keys[i] >> shift) & 0xFF]++;
+			sortedKeys[slot] = keys[i];
+			sortedOrder[slot] = order[i];
+		}
+		keys.swap(sortedKeys), order.swap(sortedOrder);
+	}
+
+	Gather(order);
+}
+
+void CellList::Resize(int cellsX, int cellsY, float cellSize, size_t count)
+{
+	m_CellsX = cellsX, m_CellsY = cellsY;
+	m_RCellSize = 1.0f / cellSize;
+	m_Cell.resize(count), m_Index.resize(count);
+	m_Start.resize((size_t)cellsX * cellsY + 1), m_Next.resize((size_t)cellsX * cellsY);
+}
+
+void CellList::Assign(const Particles& particles, RowRange range)
+{
+	for (int i = range.begin; i < range.end; i++) m_Cell[i] = CellOf(particles.x[i], particles.y[i]);
+}
+
+void CellList::Sort()
+{
+	std::fill(m_Start.begin(), m_Start.end(), 0);
+	for (size_t i = 0; i < m_Cell.size(); i++) m_Start[m_Cell[i] + 1]++;
+	for (size_t c = 0; c + 1 < m_Start.size(); c++) m_Start[c + 1] += m_Start[c];
+
+	std::copy(m_Start.begin(), m_Start.end() - 1, m_Next.begin());
+	for (size_t i = 0; i < m_Cell.size(); i++) m_Index[m_Next[m_Cell[i]]++] = (uint)i;
+}
+
+uint CellList::CellOf(float x, float y) const
+{
+	int cx = glm::clamp((int)(x * m_RCellSize), 0, m_CellsX - 1);
+	int cy = glm::clamp((int)(y * m_RCellSize), 0, m_CellsY - 1);
+	return (uint)(cx + cy * m_CellsX);
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <vector>
+#include "Threading.h"
+
+/*
+* Hashes an integer to a float in [0, 1), for reproducible jitter and emission.
+*/
+float HashUnit(uint value);
+
+/*
+* Particles in structure-of-arrays layout. Every attribute lives in its own array, so a loop over a single
+* attribute streams contiguous memory and four particles fit into a SIMD register.
+*/
+struct Particles {
+	/* Position in grid coordinates. */
+	std::vector<float> x, y;
+	/* Velocity. */
+	std::vector<float> vx, vy;
+
+	/*
+	* Retrieves the number of particles.
+	*/
+	size_t Size() const { return x.size(); }
+	/*
+	* Resizes every attribute, new particles are zeroed.
+	*/
+	void Resize(size_t count);
+	/*
+	* Reorders all attributes so that particle i takes the attributes of particle order[i].
+	*/
+	void Gather(const std::vector<uint>& order);
+	/*
+	* Sorts the particles along a Z-order (Morton) curve through square cells, so that particles that are close
+	* in space are close in memory. Particles within a cell keep their relative order.
+	* @param[in] cellSize		Size of the cells in grid units.
+	*/
+	void SortMorton(float cellSize);
+};
+
+/*
+* Particles binned into square cells with a counting sort. Once sorted, the slots of a cell are contiguous and
+* the cells of a row are consecutive, so the particles of a row of cells form a single run of slots.
+*/
+class CellList {
+
+public:
+	/*
+	* Sizes the list.
+	* @param[in] cellsX			Number of cells in x-direction.
+	* @param[in] cellsY			Number of cells in y-direction.
+	* @param[in] cellSize		Size of the cells in grid units.
+	* @param[in] count			Number of particles.
+	*/
+	void Resize(int cellsX, int cellsY, float cellSize, size_t count);
+	/*
+	* Computes the cell of a range of particles. Different threads may assign disjoint ranges.
+	*/
+	void Assign(const Particles& particles, RowRange range);
+	/*
+	* Sorts the particle indices by cell. Run by a single thread after all particles were assigned.
+	*/
+	void Sort();
+
+	/*
+	* Retrieves the cell a position falls into, positions outside the grid are clamped to the edge cells.
+	*/
+	uint CellOf(float x, float y) const;
+	/*
+	* Retrieves the cell of a particle.
+	*/
+	uint Cell(size_t particle) const { return m_Cell[particle]; }
+	/*
+	* Retrieves the particle of a slot in cell order.
+	*/
+	uint Particle(size_t slot) const { return m_Index[slot]; }
+	/*
+	* Retrieves the first slot of a cell. The slots of the cells [a, b) are [Start(a), Start(b)).
+	*/
+	uint Start(size_t cell) const { return m_Start[cell]; }
+
+	int CellsX() const { return m_CellsX; }
+	int CellsY() const { return m_CellsY; }
+
+private:
+	int m_CellsX = 0, m_CellsY = 0;
+	float m_RCellSize = 1.0f;
+	/*
+	* Cell of each particle, particle of each slot, first slot of each cell and the next free slot per cell.
+	*/
+	std::vector<uint> m_Cell, m_Index, m_Start, m_Next;
+};
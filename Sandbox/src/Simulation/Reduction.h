@@ -0,0 +1,21 @@
+#pragma once
+#include <vector>
+
+/*
+* Combines partial results pairwise in a fixed tree: neighbouring partials first, then neighbouring pairs, and so
+* on. The order of the combinations only depends on the number of partials, so partials produced per fixed block
+* of work reduce to the same bits whichever threads produced them, and the rounding error grows with the depth of
+* the tree instead of the number of partials. The partials are overwritten.
+* @param[in,out] partials	Partial results, indexed by block.
+* @param[in] combine		Callable combining two partials into one.
+* @returns					The combined result, or a default value without partials.
+*/
+template<typename T, typename Combine>
+T ReducePairwise(std::vector<T>& partials, const Combine& combine)
+{
+	if (partials.empty()) return T();
+
+	for (size_t stride = 1; stride < partials.size(); stride *= 2)
+		for (size_t i = 0; i + stride < partials.size(); i += 2 * stride) partials[i] = combine(partials[i], partials[i + stride]);
+	return partials[0];
+}
@@ -0,0 +1,21 @@
+#include "stdfax.h"
+#include <glm/gtc/constants.hpp>
+#include "Relaxation.h"
+
+float JacobiSpectralRadius(int width, int height)
+{
+	const float pi = glm::pi<float>();
+	return 0.5f * (glm::cos(pi / width) + glm::cos(pi / height));
+}
+
+void ChebyshevWeights(float rho, int sweeps, std::vector<float>& weights)
+{
+	weights.resize(sweeps);
+
+	float rho2 = rho * rho;
+	for (int i = 0; i < sweeps; i++) {
+		if (i == 0) weights[i] = 1.0f;
+		else if (i == 1) weights[i] = 1.0f / (1.0f - 0.5f * rho2);
+		else weights[i] = 1.0f / (1.0f - 0.25f * rho2 * weights[i - 1]);
+	}
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+/*
+* Iteration used by the Jacobi-type sweeps of the pressure solve and the diffusion.
+*/
+enum class Relaxation {
+	/* Plain Jacobi sweeps. */
+	Jacobi = 0,
+	/* Jacobi sweeps with Chebyshev semi-iterative acceleration. */
+	Chebyshev = 1,
+	/* Overlapping tiles of the pressure relaxed locally, with a coarse correction every few iterations. */
+	Schwarz = 2
+};
+
+/*
+* Retrieves the spectral radius of the Jacobi iteration of the 5-point Laplacian on a grid, i.e. the factor by
+* which its slowest-decaying error mode shrinks per sweep.
+* @param[in] width			Number of grid cells in x-direction.
+* @param[in] height			Number of grid cells in y-direction.
+* @returns					Spectral radius, below one.
+*/
+float JacobiSpectralRadius(int width, int height);
+
+/*
+* Computes the weights of the Chebyshev semi-iterative method, x(k+1) = x(k-1) + w(k) * (J x(k) - x(k-1)), where
+* J is a Jacobi sweep. The first weight is one, so the first sweep is plain Jacobi.
+* @param[in] rho			Spectral radius of the Jacobi iteration.
+* @param[in] sweeps			Number of sweeps.
+* @param[out] weights		Weight per sweep.
+*/
+void ChebyshevWeights(float rho, int sweeps, std::vector<float>& weights);
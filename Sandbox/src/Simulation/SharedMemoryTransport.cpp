@@ -0,0 +1,95 @@
+#include "stdfax.h"
+#include "SharedMemoryTransport.h"
+#include "Arena.h"
+#include <thread>
+
+/*
+* Number of polls a waiting rank spins before it yields its core.
+*/
+#define HALO_SPIN_COUNT 4096
+
+/*
+* Spins until a condition holds.
+*/
+template<typename Condition>
+static void SpinUntil(Condition condition)
+{
+	for (uint spin = 0; !condition(); spin++) {
+		if (spin < HALO_SPIN_COUNT) YieldProcessor();
+		else std::this_thread::yield();
+	}
+}
+
+SharedMemoryTransport::SharedMemoryTransport(const std::string& name, int rank, int ranks, size_t capacity)
+	: m_Rank(rank), m_Ranks(ranks), m_Capacity(capacity)
+{
+	m_MailboxSize = sizeof(Mailbox) + Arena::Align(sizeof(float) * capacity) * HALO_SLOTS;
+	size_t size = sizeof(Header) + m_MailboxSize * ranks * 2;
+
+	// The first rank to arrive creates the section, the others open it. Fresh sections are zero-filled.
+	std::string section = "Local\\FluidDynamics." + name;
+	m_Section = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, section.c_str());
+	if (!m_Section) FATAL_ERROR("Failed to create the shared-memory section %s.", section.c_str());
+
+	m_View = (uchar*)MapViewOfFile(m_Section, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (!m_View) FATAL_ERROR("Failed to map the shared-memory section %s.", section.c_str());
+
+	Barrier();
+}
+
+SharedMemoryTransport::~SharedMemoryTransport()
+{
+	if (m_View) UnmapViewOfFile(m_View);
+	if (m_Section) CloseHandle(m_Section);
+}
+
+void SharedMemoryTransport::Post(HaloSide side, const float* data, size_t count)
+{
+	if (count > m_Capacity) FATAL_ERROR("Halo message of %zu floats exceeds the capacity of %zu floats.", count, m_Capacity);
+
+	Mailbox* mailbox = GetMailbox(m_Rank, side);
+	uint64_t message = mailbox->posted.load(std::memory_order_relaxed);
+
+	// Wait until the neighbour copied the message that used the slot before.
+	SpinUntil([&]() { return mailbox->received.load(std::memory_order_acquire) + HALO_SLOTS > message; });
+
+	memcpy(GetSlot(mailbox, message), data, sizeof(float) * count);
+	mailbox->posted.store(message + 1, std::memory_order_release);
+}
+
+void SharedMemoryTransport::Receive(HaloSide side, float* data, size_t count)
+{
+	// Read the mailbox of the neighbour on that side, facing us.
+	int neighbour = side == HaloSide::Below ? m_Rank - 1 : m_Rank + 1;
+	Mailbox* mailbox = GetMailbox(neighbour, side == HaloSide::Below ? HaloSide::Above : HaloSide::Below);
+	uint64_t message = mailbox->received.load(std::memory_order_relaxed);
+
+	SpinUntil([&]() { return mailbox->posted.load(std::memory_order_acquire) > message; });
+
+	memcpy(data, GetSlot(mailbox, message), sizeof(float) * count);
+	mailbox->received.store(message + 1, std::memory_order_release);
+}
+
+void SharedMemoryTransport::Barrier()
+{
+	Header* header = (Header*)m_View;
+	uint generation = header->generation.load(std::memory_order_acquire);
+
+	// The last rank to arrive resets the counter and releases the others by advancing the generation.
+	if (header->arrived.fetch_add(1, std::memory_order_acq_rel) == (uint)m_Ranks - 1) {
+		header->arrived.store(0, std::memory_order_relaxed);
+		header->generation.store(generation + 1, std::memory_order_release);
+		return;
+	}
+	SpinUntil([&]() { return header->generation.load(std::memory_order_acquire) != generation; });
+}
+
+SharedMemoryTransport::Mailbox* SharedMemoryTransport::GetMailbox(int rank, HaloSide side) const
+{
+	return (Mailbox*)(m_View + sizeof(Header) + m_MailboxSize * (rank * 2 + (int)side));
+}
+
+float* SharedMemoryTransport::GetSlot(Mailbox* mailbox, uint64_t message) const
+{
+	return (float*)((uchar*)mailbox + sizeof(Mailbox) + Arena::Align(sizeof(float) * m_Capacity) * (message % HALO_SLOTS));
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <atomic>
+#include "HaloTransport.h"
+
+/*
+* Number of messages that can be in flight per neighbour before a sender waits for the receiver.
+*/
+#define HALO_SLOTS 2
+
+/*
+* Halo transport between processes on the same host through a named shared-memory section. Every rank owns a
+* mailbox per side with HALO_SLOTS message slots; posting copies into the next slot and publishes it with a
+* sequence counter, receiving spins on the neighbour's counter. No system calls are made per message.
+*/
+class SharedMemoryTransport : public HaloTransport {
+
+public:
+	/*
+	* Creates or opens the section and waits until all ranks attached.
+	* @param[in] name			Name of the section, identical for all ranks of a run.
+	* @param[in] rank			Index of this process.
+	* @param[in] ranks			Number of processes.
+	* @param[in] capacity		Maximum number of floats in a single message.
+	*/
+	SharedMemoryTransport(const std::string& name, int rank, int ranks, size_t capacity);
+	~SharedMemoryTransport();
+
+	SharedMemoryTransport(const SharedMemoryTransport&) = delete;
+	SharedMemoryTransport& operator=(const SharedMemoryTransport&) = delete;
+
+	int Rank() const override { return m_Rank; }
+	int Ranks() const override { return m_Ranks; }
+	size_t Capacity() const override { return m_Capacity; }
+
+	void Post(HaloSide side, const float* data, size_t count) override;
+	void Receive(HaloSide side, float* data, size_t count) override;
+	void Barrier() override;
+
+private:
+	/*
+	* Start of the section, shared by all ranks.
+	*/
+	struct alignas(64) Header {
+		std::atomic<uint> arrived;
+		std::atomic<uint> generation;
+	};
+	/*
+	* Messages of one rank towards one side. The slots follow the mailbox in memory. The counters are written
+	* by different processes, so they live on separate cache-lines.
+	*/
+	struct alignas(64) Mailbox {
+		/* Number of messages posted. */
+		alignas(64) std::atomic<uint64_t> posted;
+		/* Number of messages the neighbour finished copying. */
+		alignas(64) std::atomic<uint64_t> received;
+	};
+
+	int m_Rank, m_Ranks;
+	size_t m_Capacity, m_MailboxSize;
+
+	HANDLE m_Section = nullptr;
+	uchar* m_View = nullptr;
+
+	/*
+	* Retrieves the mailbox a rank posts to a side through.
+	*/
+	Mailbox* GetMailbox(int rank, HaloSide side) const;
+	/*
+	* Retrieves the slot of a message in a mailbox.
+	*/
+	float* GetSlot(Mailbox* mailbox, uint64_t message) const;
+};
@@ -0,0 +1,265 @@
+#include "stdfax.h"
+#include "Slab.h"
+#include "Constants.h"
+#include "Stencil.h"
+#include "WorkerPool.h"
+
+SlabSolver::SlabSolver(HaloTransport* transport, WorkerPool* pool, int width, int height)
+	: m_Transport(transport), m_Pool(pool), m_Width(width), m_Height(height)
+{
+	m_Rows = OwnedRows(transport->Rank(), transport->Ranks(), height);
+	if (m_Rows.end - m_Rows.begin < SLAB_HALO)
+		FATAL_ERROR("Slab of rank %d holds %d rows, at least %d are required.", transport->Rank(), m_Rows.end - m_Rows.begin, SLAB_HALO);
+	if (transport->Capacity() < MessageCapacity(width))
+		FATAL_ERROR("Halo transport holds %zu floats per message, %zu are required.", transport->Capacity(), MessageCapacity(width));
+
+	// The rows next to a neighbour read its halo.
+	m_Interior = m_Rows;
+	if (transport->Rank() > 0) m_Interior.begin++;
+	if (transport->Rank() < transport->Ranks() - 1) m_Interior.end--;
+
+	const size_t cells = (size_t)m_Width * (m_Rows.end - m_Rows.begin + 2 * SLAB_HALO);
+	size_t size =
+		2 * Arena::Align(sizeof(glm::vec2) * cells) +
+		2 * Arena::Align(sizeof(float) * cells) +
+		2 * Arena::Align(sizeof(glm::vec4) * cells) +
+		1 * Arena::Align(sizeof(float) * cells);
+
+	m_Arena.Reset(size);
+
+	m_VelocityBuffer = AllocateField<glm::vec2>();
+	m_VelocityOutput = AllocateField<glm::vec2>();
+	m_PressureBuffer = AllocateField<float>();
+	m_PressureOutput = AllocateField<float>();
+	m_ColorBuffer = AllocateField<glm::vec4>();
+	m_ColorOutput = AllocateField<glm::vec4>();
+	m_DivergenceBuffer = AllocateField<float>();
+
+	Reset();
+}
+
+template<typename T>
+T* SlabSolver::AllocateField()
+{
+	T* field = m_Arena.Allocate<T>((size_t)m_Width * (m_Rows.end - m_Rows.begin + 2 * SLAB_HALO));
+	return field - (ptrdiff_t)(m_Rows.begin - SLAB_HALO) * m_Width;
+}
+
+void SlabSolver::Reset()
+{
+	WorkerPool* pool = m_Pool;
+
+	// First-touch the owned rows from the thread that works on them, the halos from thread 0.
+	pool->Run([&](uint thread) {
+		RowRange band = pool->Rows(thread, m_Rows.end - m_Rows.begin);
+		band.begin += m_Rows.begin, band.end += m_Rows.begin;
+
+		auto clear = [&](RowRange rows) {
+			size_t cells = (size_t)(rows.end - rows.begin) * m_Width;
+			memset(m_VelocityBuffer + ((size_t)rows.begin * m_Width), 0, sizeof(glm::vec2) * cells);
+			memset(m_VelocityOutput + ((size_t)rows.begin * m_Width), 0, sizeof(glm::vec2) * cells);
+			memset(m_PressureBuffer + ((size_t)rows.begin * m_Width), 0, sizeof(float) * cells);
+			memset(m_PressureOutput + ((size_t)rows.begin * m_Width), 0, sizeof(float) * cells);
+			memset(m_ColorBuffer + ((size_t)rows.begin * m_Width), 0, sizeof(glm::vec4) * cells);
+			memset(m_ColorOutput + ((size_t)rows.begin * m_Width), 0, sizeof(glm::vec4) * cells);
+			memset(m_DivergenceBuffer + ((size_t)rows.begin * m_Width), 0, sizeof(float) * cells);
+		};
+
+		clear(band);
+		if (thread == 0) {
+			clear({ m_Rows.begin - SLAB_HALO, m_Rows.begin });
+			clear({ m_Rows.end, m_Rows.end + SLAB_HALO });
+		}
+	});
+}
+
+void SlabSolver::Step(float dt, const ImpulseQueue& impulses)
+{
+	WorkerPool* pool = m_Pool;
+
+	// Same order as Game's step, the halos are refreshed before every phase reading them.
+	pool->Run([&](uint thread) {
+		RowRange band = pool->Rows(thread, m_Rows.end - m_Rows.begin);
+		band.begin += m_Rows.begin, band.end += m_Rows.begin;
+
+		impulses.Apply(m_VelocityBuffer, m_ColorBuffer, m_Width, m_Height, band);
+		pool->Sync(thread);
+
+		// Advection reads up to SLAB_HALO rows into the neighbours.
+		if (thread == 0) {
+			UpdateBoundaries(m_VelocityBuffer, -1.0f), UpdateBoundaries(m_ColorBuffer, 0.0f);
+			PostHalos(m_VelocityBuffer, SLAB_HALO), PostHalos(m_ColorBuffer, SLAB_HALO);
+			ReceiveHalos(m_VelocityBuffer, SLAB_HALO), ReceiveHalos(m_ColorBuffer, SLAB_HALO);
+		}
+		pool->Sync(thread);
+		Advect(m_VelocityBuffer, m_VelocityOutput, dt, band);
+		Advect(m_ColorBuffer, m_ColorOutput, dt, band);
+		pool->Sync(thread);
+		CopyRows(m_VelocityBuffer, m_VelocityOutput, band);
+		CopyRows(m_ColorBuffer, m_ColorOutput, band);
+		pool->Sync(thread);
+
+		for (int i = 0; i < 8; i++)
+			Sweep(pool, thread, band, m_VelocityBuffer, m_VelocityOutput, [&](RowRange rows) { DiffuseVelocities(dt, rows); });
+
+		// The divergence reads a single row of the neighbours' velocity.
+		if (thread == 0) PostHalos(m_VelocityBuffer, 1), ReceiveHalos(m_VelocityBuffer, 1);
+		pool->Sync(thread);
+		ComputeDivergence(band);
+		pool->Sync(thread);
+
+		for (int i = 0; i < 8; i++)
+			Sweep(pool, thread, band, m_PressureBuffer, m_PressureOutput, [&](RowRange rows) { ComputePressure(rows); });
+
+		if (thread == 0) {
+			UpdateBoundaries(m_PressureBuffer, 1.0f);
+			PostHalos(m_PressureBuffer, 1), ReceiveHalos(m_PressureBuffer, 1);
+		}
+		pool->Sync(thread);
+		SubtractPressureGradient(band);
+	});
+}
+
+template<typename T>
+void SlabSolver::PostHalos(const T* field, int depth)
+{
+	const size_t count = (size_t)depth * m_Width * (sizeof(T) / sizeof(float));
+
+	if (m_Transport->Rank() > 0)
+		m_Transport->Post(HaloSide::Below, (const float*)(field + (size_t)m_Rows.begin * m_Width), count);
+	if (m_Transport->Rank() < m_Transport->Ranks() - 1)
+		m_Transport->Post(HaloSide::Above, (const float*)(field + (size_t)(m_Rows.end - depth) * m_Width), count);
+}
+
+template<typename T>
+void SlabSolver::ReceiveHalos(T* field, int depth)
+{
+	const size_t count = (size_t)depth * m_Width * (sizeof(T) / sizeof(float));
+
+	if (m_Transport->Rank() > 0)
+		m_Transport->Receive(HaloSide::Below, (float*)(field + (size_t)(m_Rows.begin - depth) * m_Width), count);
+	if (m_Transport->Rank() < m_Transport->Ranks() - 1)
+		m_Transport->Receive(HaloSide::Above, (float*)(field + (size_t)m_Rows.end * m_Width), count);
+}
+
+template<typename T>
+void SlabSolver::Sweep(WorkerPool* pool, uint thread, RowRange band, T* field, const T* output, const std::function<void(RowRange)>& kernel)
+{
+	// Post the edges, relax the interior while they travel, and the rows next to the halos once they arrived.
+	if (thread == 0) PostHalos(field, 1);
+	kernel({ glm::max(band.begin, m_Interior.begin), glm::min(band.end, m_Interior.end) });
+	if (thread == 0) {
+		ReceiveHalos(field, 1);
+		kernel({ m_Rows.begin, m_Interior.begin });
+		kernel({ m_Interior.end, m_Rows.end });
+	}
+	pool->Sync(thread);
+	CopyRows(field, output, band);
+	pool->Sync(thread);
+}
+
+template<typename T>
+void SlabSolver::UpdateBoundaries(T* field, float scale)
+{
+	// Only the outermost ranks own the x-boundaries.
+	Stencil::Boundaries(Stencil::Dense<T>(field, m_Width, m_Height), scale, m_Rows);
+}
+
+template<typename T>
+void SlabSolver::Advect(const T* field, T* output, float dt, RowRange rows)
+{
+	// Limit the backtrace independently of the slab, so it stays within the halos on every rank.
+	using namespace Stencil;
+	Dense<const glm::vec2> w(m_VelocityBuffer, m_Width, m_Height);
+	Run(rows, Assign(Dense<T>(output, m_Width, m_Height), Sample(Dense<const T>(field, m_Width, m_Height), Backtrace(Center(w), dt * RDX, (float)ADVECTION_REACH))));
+}
+
+template<typename T>
+void SlabSolver::CopyRows(T* dst, const T* src, RowRange rows)
+{
+	memcpy(dst + (size_t)rows.begin * m_Width, src + (size_t)rows.begin * m_Width, sizeof(T) * m_Width * (rows.end - rows.begin));
+}
+
+void SlabSolver::DiffuseVelocities(float dt, RowRange rows)
+{
+	float alpha = (DX * DX) / (VISCOSITY * dt);
+	float rBeta = 1.0f / (alpha + 4.0f);
+
+	for (int y = rows.begin; y < rows.end; y++) {
+		for (int x = 0; x < m_Width; x++) {
+			int stx = glm::clamp(x - 1, 0, m_Width - 1);
+			int sty = glm::clamp(y - 1, 0, m_Height - 1);
+			int stz = glm::clamp(x + 1, 0, m_Width - 1);
+			int stw = glm::clamp(y + 1, 0, m_Height - 1);
+
+			glm::vec2 xL = m_VelocityBuffer[stx + (size_t)y * m_Width];
+			glm::vec2 xR = m_VelocityBuffer[stz + (size_t)y * m_Width];
+			glm::vec2 xB = m_VelocityBuffer[x + (size_t)sty * m_Width];
+			glm::vec2 xT = m_VelocityBuffer[x + (size_t)stw * m_Width];
+			glm::vec2 bC = m_VelocityBuffer[x + (size_t)y * m_Width];
+
+			m_VelocityOutput[x + (size_t)y * m_Width] = (xL + xR + xB + xT + alpha * bC) * rBeta;
+		}
+	}
+}
+
+void SlabSolver::ComputeDivergence(RowRange rows)
+{
+	for (int y = rows.begin; y < rows.end; y++) {
+		for (int x = 0; x < m_Width; x++) {
+			int stx = glm::clamp(x - 1, 0, m_Width - 1);
+			int sty = glm::clamp(y - 1, 0, m_Height - 1);
+			int stz = glm::clamp(x + 1, 0, m_Width - 1);
+			int stw = glm::clamp(y + 1, 0, m_Height - 1);
+
+			glm::vec2 wL = m_VelocityBuffer[stx + (size_t)y * m_Width];
+			glm::vec2 wR = m_VelocityBuffer[stz + (size_t)y * m_Width];
+			glm::vec2 wB = m_VelocityBuffer[x + (size_t)sty * m_Width];
+			glm::vec2 wT = m_VelocityBuffer[x + (size_t)stw * m_Width];
+
+			m_DivergenceBuffer[x + (size_t)y * m_Width] = HALFDX * ((wR.x - wL.x) + (wT.y - wB.y));
+		}
+	}
+}
+
+void SlabSolver::ComputePressure(RowRange rows)
+{
+	float alpha = -1.0f * (DX * DX);
+	float rBeta = 0.25f;
+
+	for (int y = rows.begin; y < rows.end; y++) {
+		for (int x = 0; x < m_Width; x++) {
+			int stx = glm::clamp(x - 1, 0, m_Width - 1);
+			int sty = glm::clamp(y - 1, 0, m_Height - 1);
+			int stz = glm::clamp(x + 1, 0, m_Width - 1);
+			int stw = glm::clamp(y + 1, 0, m_Height - 1);
+
+			float xL = m_PressureBuffer[stx + (size_t)y * m_Width];
+			float xR = m_PressureBuffer[stz + (size_t)y * m_Width];
+			float xB = m_PressureBuffer[x + (size_t)sty * m_Width];
+			float xT = m_PressureBuffer[x + (size_t)stw * m_Width];
+			float bC = m_DivergenceBuffer[x + (size_t)y * m_Width];
+
+			m_PressureOutput[x + (size_t)y * m_Width] = (xL + xR + xB + xT + alpha * bC) * rBeta;
+		}
+	}
+}
+
+void SlabSolver::SubtractPressureGradient(RowRange rows)
+{
+	for (int y = rows.begin; y < rows.end; y++) {
+		for (int x = 0; x < m_Width; x++) {
+			int stx = glm::clamp(x - 1, 0, m_Width - 1);
+			int sty = glm::clamp(y - 1, 0, m_Height - 1);
+			int stz = glm::clamp(x + 1, 0, m_Width - 1);
+			int stw = glm::clamp(y + 1, 0, m_Height - 1);
+
+			float pL = m_PressureBuffer[stx + (size_t)y * m_Width];
+			float pR = m_PressureBuffer[stz + (size_t)y * m_Width];
+			float pB = m_PressureBuffer[x + (size_t)sty * m_Width];
+			float pT = m_PressureBuffer[x + (size_t)stw * m_Width];
+
+			m_VelocityBuffer[x + (size_t)y * m_Width] = m_VelocityBuffer[x + (size_t)y * m_Width] - HALFDX * glm::vec2(pR - pL, pT - pB);
+		}
+	}
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include <functional>
+#include "Arena.h"
+#include "HaloTransport.h"
+#include "Impulse.h"
+#include "Constants.h"
+
+class WorkerPool;
+
+/*
+* Number of halo rows kept on each side of a slab. Backtraces are limited to ADVECTION_REACH rows whatever the
+* decomposition, and the bilinear sample reads one row further, so every number of ranks computes the same result.
+* The Jacobi sweeps need a single row.
+*/
+#define SLAB_HALO (ADVECTION_REACH + 1)
+
+/*
+* Part of a simulation decomposed into horizontal slabs over several processes. Each rank owns a contiguous band
+* of rows plus SLAB_HALO halo rows on both sides, and runs the same step as Game on its band. The ranks only
+* synchronize through halo exchanges with their direct neighbours. Within a sweep the edge rows are posted first,
+* the interior is relaxed while they are in flight, and the rows next to the halos are relaxed last.
+*/
+class SlabSolver {
+
+public:
+	/*
+	* Creates the slab of this rank and clears it.
+	* @param[in] transport		Link to the neighbouring ranks; its capacity must hold SLAB_HALO rows of colors.
+	* @param[in] pool			Pool stepping the slab.
+	* @param[in] width			Number of grid cells in x-direction of the whole grid.
+	* @param[in] height			Number of grid cells in y-direction of the whole grid.
+	*/
+	SlabSolver(HaloTransport* transport, WorkerPool* pool, int width, int height);
+
+	/*
+	* Clears the velocity, pressure and color of the slab.
+	*/
+	void Reset();
+	/*
+	* Advances the slab by a single time-step. All ranks must step together.
+	* @param[in] dt				Time-step.
+	* @param[in] impulses		Impulses to apply, in coordinates of the whole grid.
+	*/
+	void Step(float dt, const ImpulseQueue& impulses);
+
+	/*
+	* Retrieves the rows owned by this rank.
+	*/
+	RowRange Rows() const { return m_Rows; }
+	/*
+	* Retrieves the velocity field, indexed like the whole grid. Only the owned rows are valid.
+	*/
+	const glm::vec2* Velocity() const { return m_VelocityBuffer; }
+	/*
+	* Retrieves the color field, indexed like the whole grid. Only the owned rows are valid.
+	*/
+	const glm::vec4* Colors() const { return m_ColorBuffer; }
+
+	/*
+	* Retrieves the number of floats a transport message must be able to hold.
+	* @param[in] width			Number of grid cells in x-direction of the whole grid.
+	*/
+	static size_t MessageCapacity(int width) { return (size_t)SLAB_HALO * width * 4; }
+
+private:
+	HaloTransport* m_Transport;
+	WorkerPool* m_Pool;
+	int m_Width, m_Height;
+	/*
+	* Rows owned by this rank, and the owned rows that do not read a halo row.
+	*/
+	RowRange m_Rows, m_Interior;
+
+	Arena m_Arena;
+	/*
+	* Fields, offset so that they are indexed with the coordinates of the whole grid. Valid rows range from
+	* m_Rows.begin - SLAB_HALO to m_Rows.end + SLAB_HALO.
+	*/
+	glm::vec2* m_VelocityBuffer = nullptr, * m_VelocityOutput = nullptr;
+	float* m_PressureBuffer = nullptr, * m_PressureOutput = nullptr;
+	glm::vec4* m_ColorBuffer = nullptr, * m_ColorOutput = nullptr;
+	float* m_DivergenceBuffer = nullptr;
+
+	/*
+	* Sub-allocates a field of the slab and offsets it to grid coordinates.
+	*/
+	template<typename T>
+	T* AllocateField();
+	/*
+	* Posts the rows along both edges of the slab to the neighbours.
+	* @param[in] field			Field to exchange.
+	* @param[in] depth			Number of rows to exchange.
+	*/
+	template<typename T>
+	void PostHalos(const T* field, int depth);
+	/*
+	* Receives the halo rows posted by the neighbours.
+	* @param[in,out] field		Field to exchange.
+	* @param[in] depth			Number of rows to exchange.
+	*/
+	template<typename T>
+	void ReceiveHalos(T* field, int depth);
+	/*
+	* Runs one Jacobi sweep over the slab, overlapping the halo exchange with the interior, and copies the result
+	* back. Called by every thread of the pool.
+	* @param[in] pool			Pool running the step.
+	* @param[in] thread			Index of the calling thread.
+	* @param[in] band			Rows of the slab owned by the calling thread.
+	* @param[in,out] field		Field relaxed by the sweep, its halos are exchanged.
+	* @param[in] output			Field the kernel writes to.
+	* @param[in] kernel			Kernel relaxing a range of rows.
+	*/
+	template<typename T>
+	void Sweep(WorkerPool* pool, uint thread, RowRange band, T* field, const T* output, const std::function<void(RowRange)>& kernel);
+	/*
+	* Sets the boundaries of the whole grid on the rows owned by this rank.
+	*/
+	template<typename T>
+	void UpdateBoundaries(T* field, float scale);
+	/*
+	* Advects a field through the velocity field. Backtraces are limited to ADVECTION_REACH rows.
+	*/
+	template<typename T>
+	void Advect(const T* field, T* output, float dt, RowRange rows);
+	template<typename T>
+	void CopyRows(T* dst, const T* src, RowRange rows);
+
+	void DiffuseVelocities(float dt, RowRange rows);
+	void ComputeDivergence(RowRange rows);
+	void ComputePressure(RowRange rows);
+	void SubtractPressureGradient(RowRange rows);
+};
@@ -0,0 +1,233 @@
+#include "stdfax.h"
+#include <xmmintrin.h>
+#include <glm/gtc/constants.hpp>
+#include "Sph.h"
+#include "WorkerPool.h"
+#include "Constants.h"
+
+/*
+* Coordinate of padding lanes, far outside every kernel.
+*/
+#define SPH_FAR 1e9f
+
+/*
+* Loads up to four consecutive values, the missing lanes are set to a padding value.
+*/
+static __m128 LoadLanes(const float* values, int count, float padding)
+{
+	if (count == 4) return _mm_loadu_ps(values);
+
+	alignas(16) float lanes[4] = { padding, padding, padding, padding };
+	for (int l = 0; l < count; l++) lanes[l] = values[l];
+	return _mm_load_ps(lanes);
+}
+
+static float HorizontalSum(__m128 value)
+{
+	alignas(16) float lanes[4];
+	_mm_store_ps(lanes, value);
+	return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+SphSolver::SphSolver(int width, int height, size_t count)
+	: m_Width(width), m_Height(height), m_Count(count)
+{
+	// Each particle carries the mass of its share of the initial lattice, the rest density is what a particle
+	// inside that lattice measures.
+	const float pi = glm::pi<float>();
+	m_Poly6 = 4.0f / (pi * glm::pow(SPH_SMOOTHING, 8.0f));
+	m_Spiky = 30.0f / (pi * glm::pow(SPH_SMOOTHING, 5.0f));
+	m_Laplacian = 40.0f / (pi * glm::pow(SPH_SMOOTHING, 5.0f));
+
+	const float h2 = SPH_SMOOTHING * SPH_SMOOTHING;
+	const int reach = (int)glm::ceil(SPH_SMOOTHING / SPH_SPACING);
+	m_Mass = SPH_SPACING * SPH_SPACING;
+	m_RestDensity = 0.0f;
+	for (int j = -reach; j <= reach; j++)
+		for (int i = -reach; i <= reach; i++) {
+			float r2 = SPH_SPACING * SPH_SPACING * (float)(i * i + j * j);
+			if (r2 < h2) m_RestDensity += m_Mass * m_Poly6 * (h2 - r2) * (h2 - r2) * (h2 - r2);
+		}
+
+	Reset();
+
+	m_Sorted.Resize(m_Count);
+	m_Density.resize(m_Count), m_Pressure.resize(m_Count);
+	m_Cells.Resize((int)glm::ceil(width / SPH_SMOOTHING), (int)glm::ceil(height / SPH_SMOOTHING), SPH_SMOOTHING, m_Count);
+}
+
+void SphSolver::Reset()
+{
+	// Fill the left half of the domain from the bottom up, the whole width if that is not enough.
+	int perRow = glm::max((int)(0.5f * m_Width / SPH_SPACING), 1);
+	int rows = (int)(0.95f * m_Height / SPH_SPACING);
+	if ((size_t)perRow * rows < m_Count) perRow = (int)(m_Width / SPH_SPACING) - 1;
+	m_Count = glm::min(m_Count, (size_t)perRow * rows);
+
+	m_Particles.Resize(m_Count);
+	for (size_t i = 0; i < m_Count; i++) {
+		int column = (int)(i % perRow), row = (int)(i / perRow);
+
+		// Staggering every other row keeps the lattice from collapsing along its axes.
+		m_Particles.x[i] = (column + (row & 1 ? 0.75f : 0.25f)) * SPH_SPACING;
+		m_Particles.y[i] = (row + 0.5f) * SPH_SPACING;
+		m_Particles.vx[i] = m_Particles.vy[i] = 0.0f;
+	}
+	m_Particles.SortMorton(SPH_SMOOTHING);
+	m_Steps = 0;
+}
+
+void SphSolver::Step(WorkerPool* pool, uint thread, float dt, int substeps, const ImpulseQueue& impulses)
+{
+	const float scale = dt * RDX / substeps;
+	RowRange slots = pool->Rows(thread, (int)m_Count);
+
+	for (int s = 0; s < substeps; s++) {
+		m_Cells.Assign(m_Particles, slots);
+		pool->Sync(thread);
+
+		if (thread == 0) m_Cells.Sort();
+		pool->Sync(thread);
+
+		for (int slot = slots.begin; slot < slots.end; slot++) {
+			uint i = m_Cells.Particle(slot);
+			m_Sorted.x[slot] = m_Particles.x[i], m_Sorted.y[slot] = m_Particles.y[i];
+			m_Sorted.vx[slot] = m_Particles.vx[i], m_Sorted.vy[slot] = m_Particles.vy[i];
+		}
+		pool->Sync(thread);
+
+		for (int slot = slots.begin; slot < slots.end; slot++) ComputeDensity(slot);
+		pool->Sync(thread);
+
+		// Impulses are imposed once per frame.
+		for (int slot = slots.begin; slot < slots.end; slot++) Integrate(slot, scale, s == 0 && !impulses.Empty() ? &impulses : nullptr);
+		pool->Sync(thread);
+	}
+
+	// The other threads only splat from the sorted copy from here on.
+	if (thread == 0) {
+		if (m_Steps / SPH_SORT_INTERVAL != (m_Steps + substeps) / SPH_SORT_INTERVAL) m_Particles.SortMorton(SPH_SMOOTHING);
+		m_Steps += substeps;
+	}
+}
+
+void SphSolver::Splat(WorkerPool* pool, uint thread, glm::vec4* color)
+{
+	const int pixelsPerCell = (int)SPH_SMOOTHING;
+	const size_t cellsX = m_Cells.CellsX();
+	RowRange cells = pool->Rows(thread, m_Cells.CellsY());
+	RowRange rows = { glm::min(cells.begin * pixelsPerCell, m_Height), glm::min(cells.end * pixelsPerCell, m_Height) };
+
+	memset(color + (size_t)rows.begin * m_Width, 0, sizeof(glm::vec4) * m_Width * (rows.end - rows.begin));
+
+	const glm::vec4 slow = glm::vec4(0.05f, 0.15f, 0.4f, 1.0f), fast = glm::vec4(0.3f, 0.3f, 0.3f, 0.0f);
+	const uint first = m_Cells.Start(cells.begin * cellsX), last = m_Cells.Start(cells.end * cellsX);
+	for (uint slot = first; slot < last; slot++) {
+		int x = glm::clamp((int)m_Sorted.x[slot], 0, m_Width - 1);
+		int y = glm::clamp((int)m_Sorted.y[slot], rows.begin, rows.end - 1);
+
+		float speed = glm::sqrt(m_Sorted.vx[slot] * m_Sorted.vx[slot] + m_Sorted.vy[slot] * m_Sorted.vy[slot]);
+		glm::vec4& pixel = color[x + (size_t)y * m_Width];
+		pixel = glm::min(pixel + slow + fast * (speed / SPH_MAX_SPEED), glm::vec4(1.0f));
+	}
+}
+
+template<typename Visitor>
+void SphSolver::VisitNeighbours(uint cell, const Visitor& visitor) const
+{
+	const int cellsX = m_Cells.CellsX(), cellsY = m_Cells.CellsY();
+	int cx = (int)(cell % cellsX), cy = (int)(cell / cellsX);
+	int first = glm::max(cx - 1, 0), last = glm::min(cx + 1, cellsX - 1);
+
+	// The cells of a row are consecutive, so are their slots.
+	for (int ny = glm::max(cy - 1, 0); ny <= glm::min(cy + 1, cellsY - 1); ny++)
+		visitor(m_Cells.Start(first + (size_t)ny * cellsX), m_Cells.Start(last + 1 + (size_t)ny * cellsX));
+}
+
+void SphSolver::ComputeDensity(size_t slot)
+{
+	const float h2 = SPH_SMOOTHING * SPH_SMOOTHING;
+	const __m128 px = _mm_set1_ps(m_Sorted.x[slot]), py = _mm_set1_ps(m_Sorted.y[slot]);
+	const __m128 radius2 = _mm_set1_ps(h2), zero = _mm_setzero_ps();
+	__m128 sum = zero;
+
+	VisitNeighbours(m_Cells.Cell(m_Cells.Particle(slot)), [&](uint begin, uint end) {
+		for (uint j = begin; j < end; j += 4) {
+			int count = (int)glm::min(end - j, 4u);
+			__m128 dx = _mm_sub_ps(LoadLanes(&m_Sorted.x[j], count, SPH_FAR), px);
+			__m128 dy = _mm_sub_ps(LoadLanes(&m_Sorted.y[j], count, SPH_FAR), py);
+			__m128 q = _mm_max_ps(_mm_sub_ps(radius2, _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy))), zero);
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_mul_ps(q, q), q));
+		}
+	});
+
+	// Only compression is resisted, a free surface must not pull particles together.
+	float density = m_Mass * m_Poly6 * HorizontalSum(sum);
+	m_Density[slot] = density;
+	m_Pressure[slot] = glm::max(SPH_STIFFNESS * (density - m_RestDensity), 0.0f);
+}
+
+void SphSolver::Integrate(size_t slot, float scale, const ImpulseQueue* impulses)
+{
+	const float h = SPH_SMOOTHING;
+
+	const float density = m_Density[slot];
+	const __m128 px = _mm_set1_ps(m_Sorted.x[slot]), py = _mm_set1_ps(m_Sorted.y[slot]);
+	const __m128 vx = _mm_set1_ps(m_Sorted.vx[slot]), vy = _mm_set1_ps(m_Sorted.vy[slot]);
+	const __m128 pressureTerm = _mm_set1_ps(m_Pressure[slot] / (density * density));
+	const __m128 radius = _mm_set1_ps(h), radius2 = _mm_set1_ps(h * h), epsilon = _mm_set1_ps(1e-12f);
+	const __m128 pressureScale = _mm_set1_ps(m_Mass * m_Spiky);
+	const __m128 viscosityScale = _mm_set1_ps(SPH_VISCOSITY * m_Mass * m_Laplacian / density);
+	const __m128 zero = _mm_setzero_ps();
+	__m128 ax = zero, ay = zero;
+
+	VisitNeighbours(m_Cells.Cell(m_Cells.Particle(slot)), [&](uint begin, uint end) {
+		for (uint j = begin; j < end; j += 4) {
+			int count = (int)glm::min(end - j, 4u);
+			__m128 dx = _mm_sub_ps(px, LoadLanes(&m_Sorted.x[j], count, SPH_FAR));
+			__m128 dy = _mm_sub_ps(py, LoadLanes(&m_Sorted.y[j], count, SPH_FAR));
+			__m128 r2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+
+			// The particle itself and particles outside the kernel do not contribute.
+			__m128 inside = _mm_and_ps(_mm_cmplt_ps(r2, radius2), _mm_cmpgt_ps(r2, epsilon));
+			__m128 r = _mm_sqrt_ps(_mm_max_ps(r2, epsilon));
+			__m128 w = _mm_max_ps(_mm_sub_ps(radius, r), zero);
+
+			__m128 neighbourDensity = LoadLanes(&m_Density[j], count, 1.0f);
+			__m128 neighbourTerm = _mm_div_ps(LoadLanes(&m_Pressure[j], count, 0.0f), _mm_mul_ps(neighbourDensity, neighbourDensity));
+
+			// Symmetric pressure force along the spiky kernel's gradient, pushing away from the neighbour.
+			__m128 pressure = _mm_div_ps(_mm_mul_ps(_mm_mul_ps(pressureScale, _mm_add_ps(pressureTerm, neighbourTerm)), _mm_mul_ps(w, w)), r);
+			pressure = _mm_and_ps(inside, pressure);
+			ax = _mm_add_ps(ax, _mm_mul_ps(pressure, dx));
+			ay = _mm_add_ps(ay, _mm_mul_ps(pressure, dy));
+
+			// Viscosity pulls towards the neighbour's velocity.
+			__m128 viscosity = _mm_and_ps(inside, _mm_mul_ps(viscosityScale, _mm_div_ps(w, neighbourDensity)));
+			ax = _mm_add_ps(ax, _mm_mul_ps(viscosity, _mm_sub_ps(LoadLanes(&m_Sorted.vx[j], count, 0.0f), vx)));
+			ay = _mm_add_ps(ay, _mm_mul_ps(viscosity, _mm_sub_ps(LoadLanes(&m_Sorted.vy[j], count, 0.0f), vy)));
+		}
+	});
+
+	glm::vec2 position = glm::vec2(m_Sorted.x[slot], m_Sorted.y[slot]);
+	glm::vec2 velocity = glm::vec2(m_Sorted.vx[slot], m_Sorted.vy[slot]);
+	velocity += glm::vec2(HorizontalSum(ax), HorizontalSum(ay) - SPH_GRAVITY);
+
+	glm::vec2 imposed;
+	if (impulses && impulses->Sample(position, imposed)) velocity = imposed * scale;
+
+	float speed = glm::length(velocity);
+	if (speed > SPH_MAX_SPEED) velocity *= SPH_MAX_SPEED / speed;
+	position += velocity;
+
+	// Bounce off the domain edges.
+	const glm::vec2 bounds = glm::vec2(m_Width, m_Height) - 1e-3f;
+	for (int axis = 0; axis < 2; axis++) {
+		if (position[axis] < 0.0f) position[axis] = 0.0f, velocity[axis] *= -SPH_WALL_DAMPING;
+		if (position[axis] > bounds[axis]) position[axis] = bounds[axis], velocity[axis] *= -SPH_WALL_DAMPING;
+	}
+
+	uint i = m_Cells.Particle(slot);
+	m_Particles.x[i] = position.x, m_Particles.y[i] = position.y;
+	m_Particles.vx[i] = velocity.x, m_Particles.vy[i] = velocity.y;
+}
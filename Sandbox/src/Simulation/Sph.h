@@ -0,0 +1,106 @@
+#pragma once
+#include "Particles.h"
+#include "Impulse.h"
+
+class WorkerPool;
+
+/*
+* Initial spacing of the particles in grid cells.
+*/
+#define SPH_SPACING 0.5f
+/*
+* Kernel radius in grid cells, also the size of the cells of the neighbour search. A whole number of cells, so
+* the bands of cells the splat is split into cover whole pixel rows.
+*/
+#define SPH_SMOOTHING 1.0f
+/*
+* Squared speed of sound of the equation of state in cells per step, below the CFL limit of 0.4 h per step.
+*/
+#define SPH_STIFFNESS 0.16f
+#define SPH_VISCOSITY 0.02f
+#define SPH_GRAVITY 1e-5f
+/*
+* Largest particle speed in cells per step.
+*/
+#define SPH_MAX_SPEED 0.3f
+/*
+* Fraction of the velocity kept when a particle bounces off the domain edges.
+*/
+#define SPH_WALL_DAMPING 0.5f
+/*
+* Number of steps after which the particles are re-sorted along a Z-order curve.
+*/
+#define SPH_SORT_INTERVAL 16
+
+/*
+* Weakly compressible SPH liquid of free particles. Neighbours are found through a cell list built with a
+* counting sort every step: the particles are binned into cells of the kernel radius and copied into cell
+* order, so the candidates of a particle are three contiguous runs, one per row of neighbouring cells, and the
+* density and force loops process four neighbours at once with SSE. The particles themselves are re-sorted
+* along a Z-order curve every SPH_SORT_INTERVAL steps to keep the copy into cell order cache-friendly.
+*/
+class SphSolver {
+
+public:
+	/*
+	* Creates a block of liquid resting at the bottom left of the domain.
+	* @param[in] width			Number of grid cells in x-direction.
+	* @param[in] height			Number of grid cells in y-direction.
+	* @param[in] count			Number of particles, limited to what fits into the domain.
+	*/
+	SphSolver(int width, int height, size_t count);
+
+	/*
+	* Puts the block of liquid back into place.
+	*/
+	void Reset();
+	/*
+	* Advances the particles by a frame. Called by every thread of the pool.
+	* @param[in] pool			Pool running the step.
+	* @param[in] thread			Index of the calling thread.
+	* @param[in] dt				Time-step of the frame, only used to convert the impulses to cells per step.
+	* @param[in] substeps		Number of steps per frame.
+	* @param[in] impulses		Impulses imposing their velocity on the particles they cover.
+	*/
+	void Step(WorkerPool* pool, uint thread, float dt, int substeps, const ImpulseQueue& impulses);
+	/*
+	* Clears a color field and splats every particle onto the pixel it covers. Called by every thread of the
+	* pool after a step, each thread draws the pixel rows of its band of cells.
+	* @param[in] pool			Pool running the splat.
+	* @param[in] thread			Index of the calling thread.
+	* @param[out] color			Color field of the grid size.
+	*/
+	void Splat(WorkerPool* pool, uint thread, glm::vec4* color);
+
+	/*
+	* Retrieves the particles.
+	*/
+	const Particles& GetParticles() const { return m_Particles; }
+
+private:
+	int m_Width, m_Height;
+	size_t m_Count;
+	float m_Mass, m_RestDensity;
+	/*
+	* Normalization of the poly6 kernel, the spiky kernel's gradient and the viscosity kernel's Laplacian.
+	*/
+	float m_Poly6, m_Spiky, m_Laplacian;
+	uint64_t m_Steps = 0;
+
+	Particles m_Particles;
+	/*
+	* Copy of the particles in cell order, with their density and pressure.
+	*/
+	Particles m_Sorted;
+	std::vector<float> m_Density, m_Pressure;
+	CellList m_Cells;
+
+	/*
+	* Visits the runs of slots of the cells around a cell, one run per row of cells.
+	*/
+	template<typename Visitor>
+	void VisitNeighbours(uint cell, const Visitor& visitor) const;
+
+	void ComputeDensity(size_t slot);
+	void Integrate(size_t slot, float scale, const ImpulseQueue* impulses);
+};
@@ -0,0 +1,369 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <tuple>
+#include <type_traits>
+#include "Threading.h"
+
+/*
+* Compile-time stencil expressions over grid fields. A kernel is written as an expression of neighbour taps,
+* e.g. (Left(p) + Right(p) + Below(p) + Above(p) + alpha * Center(b)) * rBeta, which builds a tree of small
+* templates that the compiler inlines into a single loop nest. The taps clamp to the grid edges like the
+* hand-written kernels, but only in the border cells within the expression's reach; the interior runs without
+* any clamping.
+*
+* Fields are accessed through layouts, so the same expression runs against row-major (optionally padded),
+* tiled or structure-of-arrays storage. A layout provides Width(), Height(), Load(x, y) and Store(x, y, value).
+* Run evaluates any number of assignments per cell in one pass, so chained kernels are fused: an assignment
+* may read what an earlier one wrote, at the center only. Shift evaluates a whole expression at an offset,
+* which fuses a stencil of a stencil at the cost of recomputing the inner one. Sample reads a field at a computed
+* position instead of a fixed offset, which builds the semi-Lagrangian advection of every solver.
+*/
+namespace Stencil {
+
+	/*
+	* Row-major layout, optionally with a row stride and padding around the grid.
+	*/
+	template<typename T>
+	class Dense {
+
+	public:
+		using Value = T;
+
+		Dense(T* data, int width, int height, int stride = 0, int pad = 0)
+			: m_Data(data + pad + (size_t)pad * (stride ? stride : width)), m_Width(width), m_Height(height), m_Stride(stride ? stride : width) {}
+
+		int Width() const { return m_Width; }
+		int Height() const { return m_Height; }
+		T Load(int x, int y) const { return m_Data[x + (ptrdiff_t)y * m_Stride]; }
+		void Store(int x, int y, const T& value) const { m_Data[x + (ptrdiff_t)y * m_Stride] = value; }
+
+	private:
+		T* m_Data;
+		int m_Width, m_Height, m_Stride;
+	};
+
+	/*
+	* Square tiles of Size x Size cells stored one after another in row-major order of the tiles, the cells of a
+	* tile in row-major order. The grid is rounded up to whole tiles.
+	*/
+	template<typename T, int Size>
+	class Tiled {
+
+	public:
+		using Value = T;
+
+		Tiled(T* data, int width, int height)
+			: m_Data(data), m_Width(width), m_Height(height), m_TilesX((width + Size - 1) / Size) {}
+
+		int Width() const { return m_Width; }
+		int Height() const { return m_Height; }
+		T Load(int x, int y) const { return m_Data[Index(x, y)]; }
+		void Store(int x, int y, const T& value) const { m_Data[Index(x, y)] = value; }
+
+	private:
+		T* m_Data;
+		int m_Width, m_Height, m_TilesX;
+
+		size_t Index(int x, int y) const
+		{
+			size_t tile = (size_t)(x / Size) + (size_t)(y / Size) * m_TilesX;
+			return tile * Size * Size + (x % Size) + (y % Size) * Size;
+		}
+	};
+
+	/*
+	* Two-component vectors stored as two row-major arrays of floats.
+	*/
+	class SoA2 {
+
+	public:
+		using Value = glm::vec2;
+
+		SoA2(float* x, float* y, int width, int height) : m_X(x), m_Y(y), m_Width(width), m_Height(height) {}
+
+		int Width() const { return m_Width; }
+		int Height() const { return m_Height; }
+		glm::vec2 Load(int x, int y) const { size_t i = x + (size_t)y * m_Width; return glm::vec2(m_X[i], m_Y[i]); }
+		void Store(int x, int y, const glm::vec2& value) const { size_t i = x + (size_t)y * m_Width; m_X[i] = value.x, m_Y[i] = value.y; }
+
+	private:
+		float* m_X, * m_Y;
+		int m_Width, m_Height;
+	};
+
+	/*
+	* One lane of cells that hold Stride values each, e.g. one member of an ensemble batched per cell.
+	*/
+	template<typename T>
+	class Strided {
+
+	public:
+		using Value = T;
+
+		Strided(T* data, int width, int height, int stride) : m_Data(data), m_Width(width), m_Height(height), m_Stride(stride) {}
+
+		int Width() const { return m_Width; }
+		int Height() const { return m_Height; }
+		T Load(int x, int y) const { return m_Data[Index(x, y)]; }
+		void Store(int x, int y, const T& value) const { m_Data[Index(x, y)] = value; }
+
+	private:
+		T* m_Data;
+		int m_Width, m_Height, m_Stride;
+
+		size_t Index(int x, int y) const { return ((size_t)x + (size_t)y * m_Width) * m_Stride; }
+	};
+
+	/*
+	* Base of every expression node. A node has a compile-time Reach, the largest distance in cells it reads from
+	* the evaluated cell, and evaluates with Eval<Checked>(x, y), clamping its taps when Checked.
+	*/
+	struct Expression {};
+
+	template<typename E>
+	constexpr bool IsExpression = std::is_base_of_v<Expression, E>;
+
+	template<typename Layout, int OffsetX, int OffsetY>
+	struct Tap : Expression {
+		static constexpr int Reach = std::max(OffsetX < 0 ? -OffsetX : OffsetX, OffsetY < 0 ? -OffsetY : OffsetY);
+		Layout field;
+
+		explicit Tap(const Layout& field) : field(field) {}
+
+		template<bool Checked>
+		auto Eval(int x, int y) const
+		{
+			if constexpr (Checked)
+				return field.Load(std::clamp(x + OffsetX, 0, field.Width() - 1), std::clamp(y + OffsetY, 0, field.Height() - 1));
+			else
+				return field.Load(x + OffsetX, y + OffsetY);
+		}
+	};
+
+	template<typename T>
+	struct Constant : Expression {
+		static constexpr int Reach = 0;
+		T value;
+
+		explicit Constant(const T& value) : value(value) {}
+
+		template<bool Checked>
+		T Eval(int, int) const { return value; }
+	};
+
+	/*
+	* Applies a function object to the values of its operands.
+	*/
+	template<typename F, typename... E>
+	struct Map : Expression {
+		static constexpr int Reach = std::max({ 0, E::Reach... });
+		F function;
+		std::tuple<E...> operands;
+
+		explicit Map(const F& function, const E&... operands) : function(function), operands(operands...) {}
+
+		template<bool Checked>
+		auto Eval(int x, int y) const
+		{
+			return std::apply([&](const E&... e) { return function(e.template Eval<Checked>(x, y)...); }, operands);
+		}
+	};
+
+	/*
+	* Coordinates of the evaluated cell.
+	*/
+	struct Position : Expression {
+		static constexpr int Reach = 0;
+
+		template<bool Checked>
+		glm::vec2 Eval(int x, int y) const { return glm::vec2(x, y); }
+	};
+
+	/*
+	* Bilinear sample of a field at a position in cells. The taps are always clamped to the grid, so the reach is
+	* only that of the position.
+	*/
+	template<typename Layout, typename E>
+	struct Sampled : Expression {
+		static constexpr int Reach = E::Reach;
+		Layout field;
+		E position;
+
+		Sampled(const Layout& field, const E& position) : field(field), position(position) {}
+
+		template<bool Checked>
+		auto Eval(int x, int y) const
+		{
+			const float fWidth = (float)field.Width(), fHeight = (float)field.Height();
+			glm::vec2 pos = position.template Eval<Checked>(x, y);
+
+			int stx = (int)glm::clamp(floor(pos.x), 0.0f, fWidth - 1.0f);
+			int sty = (int)glm::clamp(floor(pos.y), 0.0f, fHeight - 1.0f);
+			int stz = (int)glm::clamp(stx + 1.0f, 0.0f, fWidth - 1.0f);
+			int stw = (int)glm::clamp(sty + 1.0f, 0.0f, fHeight - 1.0f);
+
+			glm::vec2 t = glm::vec2(glm::clamp(pos.x - stx, 0.0f, 1.0f), glm::clamp(pos.y - sty, 0.0f, 1.0f));
+			return glm::mix(glm::mix(field.Load(stx, sty), field.Load(stz, sty), t.x), glm::mix(field.Load(stx, stw), field.Load(stz, stw), t.x), t.y);
+		}
+	};
+
+	template<int OffsetX, int OffsetY, typename E>
+	struct Shifted : Expression {
+		static constexpr int Reach = E::Reach + std::max(OffsetX < 0 ? -OffsetX : OffsetX, OffsetY < 0 ? -OffsetY : OffsetY);
+		E expression;
+
+		explicit Shifted(const E& expression) : expression(expression) {}
+
+		template<bool Checked>
+		auto Eval(int x, int y) const { return expression.template Eval<Checked>(x + OffsetX, y + OffsetY); }
+	};
+
+	/*
+	* Neighbour taps of a field.
+	*/
+	template<int OffsetX, int OffsetY, typename Layout>
+	Tap<Layout, OffsetX, OffsetY> At(const Layout& field) { return Tap<Layout, OffsetX, OffsetY>(field); }
+	template<typename Layout> auto Center(const Layout& field) { return At<0, 0>(field); }
+	template<typename Layout> auto Left(const Layout& field) { return At<-1, 0>(field); }
+	template<typename Layout> auto Right(const Layout& field) { return At<1, 0>(field); }
+	template<typename Layout> auto Below(const Layout& field) { return At<0, -1>(field); }
+	template<typename Layout> auto Above(const Layout& field) { return At<0, 1>(field); }
+
+	/*
+	* Evaluates an expression at an offset from the evaluated cell.
+	*/
+	template<int OffsetX, int OffsetY, typename E, typename = std::enable_if_t<IsExpression<E>>>
+	Shifted<OffsetX, OffsetY, E> Shift(const E& expression) { return Shifted<OffsetX, OffsetY, E>(expression); }
+
+	template<typename F, typename... E>
+	Map<F, E...> Apply(const F& function, const E&... operands) { return Map<F, E...>(function, operands...); }
+
+	/*
+	* Samples a field at the position an expression evaluates to.
+	*/
+	template<typename Layout, typename E, typename = std::enable_if_t<IsExpression<E>>>
+	Sampled<Layout, E> Sample(const Layout& field, const E& position) { return Sampled<Layout, E>(field, position); }
+
+	/*
+	* Departure point of a semi-Lagrangian backtrace from the evaluated cell through a velocity expression.
+	* @param[in] velocity		Velocity of the cell.
+	* @param[in] scale			Cells per unit of velocity, dt * RDX.
+	* @param[in] reach			Limit of the displacement in y, e.g. to stay within the halos of a decomposed solver.
+	*/
+	template<typename E, typename = std::enable_if_t<IsExpression<E>>>
+	auto Backtrace(const E& velocity, float scale, float reach = FLT_MAX)
+	{
+		return Apply([scale, reach](const glm::vec2& position, const glm::vec2& v) {
+			glm::vec2 step = scale * v;
+			return position - glm::vec2(step.x, glm::clamp(step.y, -reach, reach));
+		}, Position(), velocity);
+	}
+
+	/*
+	* Components of vector-valued expressions, and vectors from scalar ones.
+	*/
+	template<typename E, typename = std::enable_if_t<IsExpression<E>>>
+	auto X(const E& e) { return Apply([](const auto& v) { return v.x; }, e); }
+	template<typename E, typename = std::enable_if_t<IsExpression<E>>>
+	auto Y(const E& e) { return Apply([](const auto& v) { return v.y; }, e); }
+	template<typename A, typename B, typename = std::enable_if_t<IsExpression<A> && IsExpression<B>>>
+	auto Vec2(const A& a, const B& b) { return Apply([](float x, float y) { return glm::vec2(x, y); }, a, b); }
+
+	/*
+	* Wraps plain values into constants so they mix with expressions.
+	*/
+	template<typename T>
+	auto Wrap(const T& value)
+	{
+		if constexpr (IsExpression<T>) return value;
+		else return Constant<T>(value);
+	}
+
+#define STENCIL_OPERATOR(op)																			\
+	template<typename A, typename B, typename = std::enable_if_t<IsExpression<A> || IsExpression<B>>>	\
+	auto operator op(const A& a, const B& b)															\
+	{																									\
+		return Apply([](const auto& x, const auto& y) { return x op y; }, Wrap(a), Wrap(b));			\
+	}
+
+	STENCIL_OPERATOR(+)
+	STENCIL_OPERATOR(-)
+	STENCIL_OPERATOR(*)
+	STENCIL_OPERATOR(/)
+#undef STENCIL_OPERATOR
+
+	template<typename E, typename = std::enable_if_t<IsExpression<E>>>
+	auto operator-(const E& e) { return Apply([](const auto& x) { return -x; }, e); }
+
+	/*
+	* Stores an expression into a field.
+	*/
+	template<typename Layout, typename E>
+	struct Assignment {
+		static constexpr int Reach = E::Reach;
+		Layout output;
+		E expression;
+
+		template<bool Checked>
+		void Run(int x, int y) const { output.Store(x, y, expression.template Eval<Checked>(x, y)); }
+	};
+
+	template<typename Layout, typename E, typename = std::enable_if_t<IsExpression<E>>>
+	Assignment<Layout, E> Assign(const Layout& output, const E& expression) { return { output, expression }; }
+
+	/*
+	* Sets the edge cells of a band of rows to their inner neighbours times a scale, -1 for the no-slip velocity
+	* and 1 for the pure Neumann pressure. The bottom and top rows are set by the bands holding them.
+	* @param[in] field			Field to update.
+	* @param[in] scale			Factor of the inner neighbour.
+	* @param[in] rows			Band of rows to update.
+	*/
+	template<typename Layout>
+	void Boundaries(const Layout& field, float scale, RowRange rows)
+	{
+		const int width = field.Width(), height = field.Height();
+
+		// The x-boundaries first, the corners then follow the updated rows.
+		for (int x = 0; x < width; x++) {
+			if (rows.begin == 0) field.Store(x, 0, field.Load(x, 1) * scale);
+			if (rows.end == height) field.Store(x, height - 1, field.Load(x, height - 2) * scale);
+		}
+		for (int y = rows.begin; y < rows.end; y++) {
+			field.Store(0, y, field.Load(1, y) * scale);
+			field.Store(width - 1, y, field.Load(width - 2, y) * scale);
+		}
+	}
+
+	/*
+	* Evaluates the assignments for every cell of a band of rows in a single loop nest, in order per cell. The
+	* grid size is that of the first output.
+	* @param[in] rows			Band of rows to evaluate.
+	* @param[in] first			First assignment.
+	* @param[in] rest			Assignments evaluated after the first for the same cell.
+	*/
+	template<typename First, typename... Rest>
+	void Run(RowRange rows, const First& first, const Rest&... rest)
+	{
+		constexpr int reach = std::max({ First::Reach, Rest::Reach... });
+		const int width = first.output.Width(), height = first.output.Height();
+
+		auto columns = [&](auto checked, int y, int begin, int end) {
+			constexpr bool Checked = decltype(checked)::value;
+			for (int x = begin; x < end; x++) {
+				first.template Run<Checked>(x, y);
+				(rest.template Run<Checked>(x, y), ...);
+			}
+		};
+
+		for (int y = rows.begin; y < rows.end; y++) {
+			if (y < reach || y >= height - reach || width <= 2 * reach) {
+				columns(std::true_type(), y, 0, width);
+				continue;
+			}
+			columns(std::true_type(), y, 0, reach);
+			columns(std::false_type(), y, reach, width - reach);
+			columns(std::true_type(), y, width - reach, width);
+		}
+	}
+}
@@ -0,0 +1,150 @@
+#include "stdfax.h"
+#include "TaskGraph.h"
+#include "WorkerPool.h"
+
+/*
+* Scoped lock on a queue's spin-lock.
+*/
+struct QueueLock {
+	std::atomic_flag& flag;
+	QueueLock(std::atomic_flag& flag) : flag(flag) {
+		while (flag.test_and_set(std::memory_order_acquire)) YieldProcessor();
+	}
+	~QueueLock() { flag.clear(std::memory_order_release); }
+};
+
+TaskGraph::Task TaskGraph::Add(std::function<void()> work, uint affinity)
+{
+	TaskInfo info;
+	info.work = std::move(work);
+	info.affinity = affinity;
+	m_Tasks.push_back(std::move(info));
+
+	return (Task)m_Tasks.size() - 1;
+}
+
+TaskGraph::Task TaskGraph::AddJoin(const TilePhase& dependencies)
+{
+	Task join = Add(nullptr);
+	for (Task dependency : dependencies) Depend(join, dependency);
+	return join;
+}
+
+TaskGraph::TilePhase TaskGraph::AddTiles(int rows, int tileRows, uint threads, const std::function<void(RowRange)>& kernel)
+{
+	TilePhase phase;
+	for (int begin = 0; begin < rows; begin += tileRows) {
+		RowRange tile = { begin, glm::min(begin + tileRows, rows) };
+
+		// Prefer the thread that owns (and first-touched) the first row of the tile.
+		uint owner = 0;
+		while (owner + 1 < threads && OwnedRows(owner, threads, rows).end <= tile.begin) owner++;
+
+		phase.push_back(Add([kernel, tile]() { kernel(tile); }, owner));
+	}
+	return phase;
+}
+
+void TaskGraph::Depend(Task task, Task dependency)
+{
+	m_Tasks[dependency].successors.push_back(task);
+	m_Tasks[task].dependencies++;
+}
+
+void TaskGraph::Depend(const TilePhase& phase, Task dependency)
+{
+	for (Task task : phase) Depend(task, dependency);
+}
+
+void TaskGraph::DependNeighbours(const TilePhase& phase, const TilePhase& dependencies, int radius)
+{
+	for (int i = 0; i < (int)phase.size(); i++) {
+		int first = glm::max(i - radius, 0);
+		int last = glm::min(i + radius, (int)dependencies.size() - 1);
+
+		for (int j = first; j <= last; j++) Depend(phase[i], dependencies[j]);
+	}
+}
+
+void TaskGraph::Clear()
+{
+	m_Tasks.clear();
+}
+
+void TaskGraph::Execute(WorkerPool* pool)
+{
+	if (m_Tasks.empty()) return;
+
+	uint threads = pool->Size();
+
+	// (Re-)size the execution state.
+	if (m_PendingSize < m_Tasks.size()) {
+		m_PendingSize = (uint)m_Tasks.size();
+		m_Pending.reset(new std::atomic<uint>[m_PendingSize]);
+	}
+	if (m_QueueCount != threads) {
+		m_QueueCount = threads;
+		m_Queues.reset(new Queue[m_QueueCount]);
+	}
+
+	// Reset the dependency counters and queue the tasks without dependencies.
+	for (Task task = 0; task < m_Tasks.size(); task++) {
+		m_Pending[task].store(m_Tasks[task].dependencies, std::memory_order_relaxed);
+		if (m_Tasks[task].dependencies == 0) Push(m_Tasks[task].affinity % threads, task);
+	}
+	m_Remaining.store((uint)m_Tasks.size(), std::memory_order_release);
+
+	pool->Run([&](uint thread) {
+		Work(thread, threads);
+	});
+}
+
+void TaskGraph::Work(uint thread, uint threads)
+{
+	while (m_Remaining.load(std::memory_order_acquire) > 0) {
+		Task task;
+		if (!Pop(thread, task) && !Steal(thread, threads, task)) {
+			YieldProcessor();
+			continue;
+		}
+
+		if (m_Tasks[task].work) m_Tasks[task].work();
+
+		// Release the successors, the thread finishing the last dependency queues it at its preferred thread.
+		for (Task next : m_Tasks[task].successors)
+			if (m_Pending[next].fetch_sub(1, std::memory_order_acq_rel) == 1) Push(m_Tasks[next].affinity % threads, next);
+
+		m_Remaining.fetch_sub(1, std::memory_order_acq_rel);
+	}
+}
+
+void TaskGraph::Push(uint thread, Task task)
+{
+	QueueLock lock(m_Queues[thread].lock);
+	m_Queues[thread].tasks.push_back(task);
+}
+
+bool TaskGraph::Pop(uint thread, Task& task)
+{
+	QueueLock lock(m_Queues[thread].lock);
+	if (m_Queues[thread].tasks.empty()) return false;
+
+	task = m_Queues[thread].tasks.back();
+	m_Queues[thread].tasks.pop_back();
+	return true;
+}
+
+bool TaskGraph::Steal(uint thread, uint threads, Task& task)
+{
+	for (uint i = 1; i < threads; i++) {
+		Queue& victim = m_Queues[(thread + i) % threads];
+
+		QueueLock lock(victim.lock);
+		if (victim.tasks.empty()) continue;
+
+		task = victim.tasks.front();
+		victim.tasks.pop_front();
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include "Threading.h"
+
+class WorkerPool;
+
+/*
+* Dependency graph of tasks executed on a worker pool with work stealing. A task becomes ready as soon as all
+* tasks it depends on finished, so independent work of consecutive phases overlaps instead of waiting on a
+* global barrier. The graph is built once and can be executed any number of times.
+*/
+class TaskGraph {
+
+public:
+	typedef uint Task;
+	/*
+	* Tasks of a single kernel split into row tiles, entry i processes tile i.
+	*/
+	typedef std::vector<Task> TilePhase;
+
+	TaskGraph() = default;
+	TaskGraph(const TaskGraph&) = delete;
+	TaskGraph& operator=(const TaskGraph&) = delete;
+
+	/*
+	* Adds a task to the graph.
+	* @param[in] work			Work to execute.
+	* @param[in] affinity		Thread that preferably executes the task.
+	* @returns					Identifier of the task.
+	*/
+	Task Add(std::function<void()> work, uint affinity = 0);
+	/*
+	* Adds a task without work that completes once all its dependencies completed.
+	* @param[in] dependencies	Tasks to wait for.
+	* @returns					Identifier of the task.
+	*/
+	Task AddJoin(const TilePhase& dependencies);
+	/*
+	* Splits a kernel into one task per tile of rows. Each tile prefers the thread owning its first row.
+	* @param[in] rows			Number of grid rows.
+	* @param[in] tileRows		Number of rows per tile.
+	* @param[in] threads		Number of threads the graph is executed with.
+	* @param[in] kernel			Kernel processing a range of rows.
+	* @returns					Tasks of the tiles, in row order.
+	*/
+	TilePhase AddTiles(int rows, int tileRows, uint threads, const std::function<void(RowRange)>& kernel);
+
+	/*
+	* Makes a task wait for another task.
+	* @param[in] task			Task that waits.
+	* @param[in] dependency		Task to wait for.
+	*/
+	void Depend(Task task, Task dependency);
+	/*
+	* Makes every tile of a phase wait for a single task.
+	* @param[in] phase			Tiles that wait.
+	* @param[in] dependency		Task to wait for.
+	*/
+	void Depend(const TilePhase& phase, Task dependency);
+	/*
+	* Makes each tile wait for the tiles of another phase within the given radius, which covers the reads of a
+	* stencil kernel. <b>NOTE:</b> both phases must use the same tiling.
+	* @param[in] phase			Tiles that wait.
+	* @param[in] dependencies	Tiles to wait for.
+	* @param[in] radius			Number of neighbouring tiles on each side to wait for.
+	*/
+	void DependNeighbours(const TilePhase& phase, const TilePhase& dependencies, int radius = 1);
+
+	/*
+	* Removes all tasks.
+	*/
+	void Clear();
+	/*
+	* Executes all tasks and returns once every task finished.
+	* @param[in] pool			Pool to execute the tasks on.
+	*/
+	void Execute(WorkerPool* pool);
+
+	/*
+	* Retrieves the number of tasks in the graph.
+	*/
+	uint Size() const { return (uint)m_Tasks.size(); }
+
+private:
+	struct TaskInfo {
+		std::function<void()> work;
+		std::vector<Task> successors;
+		uint dependencies = 0;
+		uint affinity = 0;
+	};
+
+	/*
+	* Ready tasks of a single thread. The owner pops from the back, thieves steal from the front.
+	*/
+	struct alignas(64) Queue {
+		std::atomic_flag lock = ATOMIC_FLAG_INIT;
+		std::deque<Task> tasks;
+	};
+
+	std::vector<TaskInfo> m_Tasks;
+
+	/*
+	* Execution state, sized on execution.
+	*/
+	std::unique_ptr<std::atomic<uint>[]> m_Pending;
+	std::unique_ptr<Queue[]> m_Queues;
+	uint m_PendingSize = 0, m_QueueCount = 0;
+	std::atomic<uint> m_Remaining = 0;
+
+	/*
+	* Executes tasks until the graph completed.
+	* @param[in] thread			Index of the executing thread.
+	* @param[in] threads		Number of executing threads.
+	*/
+	void Work(uint thread, uint threads);
+	/*
+	* Pushes a ready task onto a thread's queue.
+	*/
+	void Push(uint thread, Task task);
+	/*
+	* Pops the most recently pushed task of a thread's own queue.
+	*/
+	bool Pop(uint thread, Task& task);
+	/*
+	* Steals the oldest task from the queue of another thread.
+	*/
+	bool Steal(uint thread, uint threads, Task& task);
+};
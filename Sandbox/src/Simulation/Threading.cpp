@@ -0,0 +1,90 @@
+#include "stdfax.h"
+#include "Threading.h"
+
+/*
+* Logical processors of a single NUMA node.
+*/
+struct NumaNode {
+	WORD group;
+	std::vector<uint> processors;
+};
+
+/*
+* Queries the NUMA nodes and their logical processors.
+*/
+static std::vector<NumaNode> QueryTopology() {
+	std::vector<NumaNode> nodes;
+
+	ULONG highest = 0;
+	GetNumaHighestNodeNumber(&highest);
+
+	for (USHORT node = 0; node <= highest; node++) {
+		GROUP_AFFINITY affinity;
+		if (!GetNumaNodeProcessorMaskEx(node, &affinity) || affinity.Mask == 0) continue;
+
+		NumaNode numaNode;
+		numaNode.group = affinity.Group;
+		for (uint i = 0; i < sizeof(KAFFINITY) * 8; i++)
+			if (affinity.Mask & ((KAFFINITY)1 << i)) numaNode.processors.push_back(i);
+
+		nodes.push_back(numaNode);
+	}
+
+	// Should not happen, but fall back to a single node spanning all processors of group 0.
+	if (nodes.empty()) {
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+
+		NumaNode numaNode;
+		numaNode.group = 0;
+		for (uint i = 0; i < info.dwNumberOfProcessors && i < sizeof(KAFFINITY) * 8; i++) numaNode.processors.push_back(i);
+		nodes.push_back(numaNode);
+	}
+
+	return nodes;
+}
+
+/*
+* Retrieves the NUMA topology, queried once.
+*/
+static const std::vector<NumaNode>& Topology() {
+	static const std::vector<NumaNode> s_Nodes = QueryTopology();
+	return s_Nodes;
+}
+
+RowRange OwnedRows(uint thread, uint threads, int rows)
+{
+	// Distribute the remainder over the first threads, so bands differ at most one row in size.
+	int size = rows / (int)threads;
+	int remainder = rows % (int)threads;
+
+	int begin = thread * size + glm::min((int)thread, remainder);
+	int end = begin + size + ((int)thread < remainder ? 1 : 0);
+
+	return { begin, end };
+}
+
+void PinThread(uint thread, uint threads)
+{
+	// Skip the system call when the thread is already pinned to the same slot.
+	static thread_local uint s_Thread = ~0u, s_Threads = ~0u;
+	if (s_Thread == thread && s_Threads == threads) return;
+	s_Thread = thread, s_Threads = threads;
+
+	const std::vector<NumaNode>& nodes = Topology();
+
+	// Consecutive threads share a node.
+	uint node = thread * (uint)nodes.size() / threads;
+	uint first = (node * threads + (uint)nodes.size() - 1) / (uint)nodes.size();
+	uint last = ((node + 1) * threads + (uint)nodes.size() - 1) / (uint)nodes.size();
+	uint local = thread - first, perNode = glm::max(last - first, 1u);
+
+	// Spread the threads over the node, logical siblings of a core are adjacent so this fills cores first.
+	const std::vector<uint>& processors = nodes[node].processors;
+	uint processor = processors[(local * (uint)processors.size() / perNode) % processors.size()];
+
+	GROUP_AFFINITY affinity = {};
+	affinity.Group = nodes[node].group;
+	affinity.Mask = (KAFFINITY)1 << processor;
+	SetThreadGroupAffinity(GetCurrentThread(), &affinity, NULL);
+}
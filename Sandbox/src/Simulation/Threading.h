@@ -0,0 +1,26 @@
+#pragma once
+
+/*
+* Half-open range of grid rows [begin, end).
+*/
+struct RowRange {
+	int begin, end;
+};
+
+/*
+* Retrieves the rows owned by a thread. Rows are split into contiguous bands, so a thread that first-touches
+* its band keeps working on memory local to its NUMA node.
+* @param[in] thread			Index of the thread.
+* @param[in] threads		Total number of threads.
+* @param[in] rows			Number of rows to divide.
+* @returns					Rows owned by the thread.
+*/
+RowRange OwnedRows(uint thread, uint threads, int rows);
+
+/*
+* Pins the calling thread to a logical processor. Consecutive threads are packed onto the same NUMA node and
+* spread over the node's cores, so neighbouring row bands share a node. Cheap when the thread is already pinned.
+* @param[in] thread			Index of the thread among all threads pinned over the machine.
+* @param[in] threads		Total number of threads pinned over the machine.
+*/
+void PinThread(uint thread, uint threads);
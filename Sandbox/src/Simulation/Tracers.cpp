@@ -0,0 +1,138 @@
+#include "stdfax.h"
+#include <emmintrin.h>
+#include "Tracers.h"
+#include "Particles.h"
+#include "WorkerPool.h"
+#include "Constants.h"
+
+/*
+* Distance the tracers keep from the last interior cell, so the nodes they sample stay inside the grid.
+*/
+#define TRACER_EDGE 1e-3f
+
+/*
+* Samples a velocity field bilinearly at four positions within the interior of the grid.
+*/
+static void SampleVelocity(const glm::vec2* velocity, int width, __m128 px, __m128 py, __m128& vx, __m128& vy)
+{
+	alignas(16) int nodeX[4], nodeY[4];
+	__m128i ix = _mm_cvttps_epi32(px), iy = _mm_cvttps_epi32(py);
+	_mm_store_si128((__m128i*)nodeX, ix), _mm_store_si128((__m128i*)nodeY, iy);
+	__m128 wx1 = _mm_sub_ps(px, _mm_cvtepi32_ps(ix)), wy1 = _mm_sub_ps(py, _mm_cvtepi32_ps(iy));
+	__m128 wx0 = _mm_sub_ps(_mm_set1_ps(1.0f), wx1), wy0 = _mm_sub_ps(_mm_set1_ps(1.0f), wy1);
+
+	// Gather the four nodes around each position, bottom-left, bottom-right, top-left, top-right.
+	alignas(16) float u[4][4], v[4][4];
+	for (int l = 0; l < 4; l++) {
+		const glm::vec2* node = velocity + nodeX[l] + (size_t)nodeY[l] * width;
+		u[0][l] = node[0].x, u[1][l] = node[1].x, u[2][l] = node[width].x, u[3][l] = node[width + 1].x;
+		v[0][l] = node[0].y, v[1][l] = node[1].y, v[2][l] = node[width].y, v[3][l] = node[width + 1].y;
+	}
+
+	auto interpolate = [&](const float(*values)[4]) {
+		__m128 bottom = _mm_add_ps(_mm_mul_ps(wx0, _mm_load_ps(values[0])), _mm_mul_ps(wx1, _mm_load_ps(values[1])));
+		__m128 top = _mm_add_ps(_mm_mul_ps(wx0, _mm_load_ps(values[2])), _mm_mul_ps(wx1, _mm_load_ps(values[3])));
+		return _mm_add_ps(_mm_mul_ps(wy0, bottom), _mm_mul_ps(wy1, top));
+	};
+	vx = interpolate(u), vy = interpolate(v);
+}
+
+TracerSystem::TracerSystem(int width, int height, size_t count)
+	: m_Width(width), m_Height(height), m_Count((count + 3) & ~(size_t)3)
+{
+	m_TilesX = (width + TRACER_SORT_TILE - 1) / TRACER_SORT_TILE;
+	m_TilesY = (height + TRACER_SORT_TILE - 1) / TRACER_SORT_TILE;
+	m_TileStart.resize((size_t)m_TilesX * m_TilesY + 1);
+
+	const size_t floats = Arena::Align(sizeof(float) * m_Count);
+	m_Arena.Reset(8 * floats);
+	m_X = m_Arena.Allocate<float>(m_Count), m_Y = m_Arena.Allocate<float>(m_Count);
+	m_Age = m_Arena.Allocate<uint>(m_Count);
+	m_SortedX = m_Arena.Allocate<float>(m_Count), m_SortedY = m_Arena.Allocate<float>(m_Count);
+	m_SortedAge = m_Arena.Allocate<uint>(m_Count), m_Tiles = m_Arena.Allocate<uint>(m_Count);
+	m_Packed = m_Arena.Allocate<uint>(m_Count);
+
+	Reset();
+}
+
+void TracerSystem::Reset()
+{
+	for (size_t i = 0; i < m_Count; i++) {
+		Emit(i, 0);
+		m_Age[i] = (uint)(HashUnit((uint)i ^ 0x9E3779B9) * TRACER_LIFETIME);
+	}
+	memset(m_Packed, 0, sizeof(uint) * m_Count);
+	m_Steps = 0;
+}
+
+void TracerSystem::Step(WorkerPool* pool, uint thread, float dt, const glm::vec2* velocity)
+{
+	const uint64_t steps = m_Steps;
+	RowRange groups = pool->Rows(thread, (int)(m_Count / 4));
+	const size_t first = 4 * (size_t)groups.begin, last = 4 * (size_t)groups.end;
+
+	for (size_t i = first; i < last; i += 4) Advect(i, dt * RDX, velocity);
+	for (size_t i = first; i < last; i++)
+		if (++m_Age[i] >= TRACER_LIFETIME) Emit(i, (uint)steps + 1), m_Age[i] = 0;
+	pool->Sync(thread);
+
+	if ((steps + 1) % TRACER_SORT_INTERVAL == 0) {
+		for (size_t i = first; i < last; i++) {
+			int tx = (int)m_X[i] / TRACER_SORT_TILE, ty = (int)m_Y[i] / TRACER_SORT_TILE;
+			m_Tiles[i] = (uint)(tx + ty * m_TilesX);
+		}
+		pool->Sync(thread);
+		if (thread == 0) Sort();
+		pool->Sync(thread);
+	}
+
+	// Pack to 16-bit normalized coordinates at the pixel centers.
+	const __m128 scaleX = _mm_set1_ps(65535.0f / m_Width), scaleY = _mm_set1_ps(65535.0f / m_Height), half = _mm_set1_ps(0.5f);
+	for (size_t i = first; i < last; i += 4) {
+		__m128i x = _mm_cvtps_epi32(_mm_mul_ps(_mm_add_ps(_mm_load_ps(m_X + i), half), scaleX));
+		__m128i y = _mm_cvtps_epi32(_mm_mul_ps(_mm_add_ps(_mm_load_ps(m_Y + i), half), scaleY));
+		_mm_store_si128((__m128i*)(m_Packed + i), _mm_or_si128(x, _mm_slli_epi32(y, 16)));
+	}
+
+	// Every thread read the step count before the first sync.
+	if (thread == 0) m_Steps++;
+}
+
+void TracerSystem::Emit(size_t i, uint seed)
+{
+	const uint hash = (uint)i * 2 + seed * 0x85EBCA6B;
+	m_X[i] = 1.0f + HashUnit(hash) * (m_Width - 2 - TRACER_EDGE);
+	m_Y[i] = 1.0f + HashUnit(hash + 1) * (m_Height - 2 - TRACER_EDGE);
+}
+
+void TracerSystem::Advect(size_t first, float scale, const glm::vec2* velocity)
+{
+	const __m128 one = _mm_set1_ps(1.0f), step = _mm_set1_ps(scale), halfStep = _mm_set1_ps(0.5f * scale);
+	const __m128 upperX = _mm_set1_ps(m_Width - 1 - TRACER_EDGE), upperY = _mm_set1_ps(m_Height - 1 - TRACER_EDGE);
+	auto clampX = [&](__m128 x) { return _mm_min_ps(_mm_max_ps(x, one), upperX); };
+	auto clampY = [&](__m128 y) { return _mm_min_ps(_mm_max_ps(y, one), upperY); };
+
+	__m128 px = _mm_load_ps(m_X + first), py = _mm_load_ps(m_Y + first);
+	__m128 vx, vy;
+
+	// Midpoint method: sample at the start, then again halfway along that velocity.
+	SampleVelocity(velocity, m_Width, px, py, vx, vy);
+	__m128 mx = clampX(_mm_add_ps(px, _mm_mul_ps(halfStep, vx))), my = clampY(_mm_add_ps(py, _mm_mul_ps(halfStep, vy)));
+	SampleVelocity(velocity, m_Width, mx, my, vx, vy);
+
+	_mm_store_ps(m_X + first, clampX(_mm_add_ps(px, _mm_mul_ps(step, vx))));
+	_mm_store_ps(m_Y + first, clampY(_mm_add_ps(py, _mm_mul_ps(step, vy))));
+}
+
+void TracerSystem::Sort()
+{
+	std::fill(m_TileStart.begin(), m_TileStart.end(), 0);
+	for (size_t i = 0; i < m_Count; i++) m_TileStart[m_Tiles[i] + 1]++;
+	for (size_t t = 0; t + 1 < m_TileStart.size(); t++) m_TileStart[t + 1] += m_TileStart[t];
+
+	for (size_t i = 0; i < m_Count; i++) {
+		uint slot = m_TileStart[m_Tiles[i]]++;
+		m_SortedX[slot] = m_X[i], m_SortedY[slot] = m_Y[i], m_SortedAge[slot] = m_Age[i];
+	}
+	std::swap(m_X, m_SortedX), std::swap(m_Y, m_SortedY), std::swap(m_Age, m_SortedAge);
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <vector>
+#include "Arena.h"
+#include "Threading.h"
+
+class WorkerPool;
+
+/*
+* Number of steps a tracer lives before it is emitted anew.
+*/
+#define TRACER_LIFETIME 600
+/*
+* Number of steps after which the tracers are re-sorted, and the size of the tiles they are sorted by in grid cells.
+*/
+#define TRACER_SORT_INTERVAL 32
+#define TRACER_SORT_TILE 16
+
+/*
+* Massless marker particles advected through a velocity field to visualize the flow. The positions and ages are
+* stored as separate arrays in an arena, the count is rounded up to a multiple of four so every group of four
+* tracers is advected with SSE without a scalar tail. A tracer that reaches its lifetime is emitted anew at a
+* hashed position in place, so emission needs neither allocation nor synchronization. The initial ages are
+* staggered so only a small fraction of the tracers is recycled per step.
+*
+* Every TRACER_SORT_INTERVAL steps the tracers are sorted by tile with a counting sort, which keeps the velocity
+* samples of neighbouring tracers in the same cache lines. After each step the positions are packed into two
+* 16-bit normalized coordinates per tracer, a quarter of the floats, ready to be uploaded as a vertex buffer.
+*/
+class TracerSystem {
+
+public:
+	/*
+	* Allocates the tracers and emits them over the whole domain.
+	* @param[in] width			Number of grid cells in x-direction.
+	* @param[in] height			Number of grid cells in y-direction.
+	* @param[in] count			Number of tracers, rounded up to a multiple of four.
+	*/
+	TracerSystem(int width, int height, size_t count);
+
+	/*
+	* Emits every tracer anew.
+	*/
+	void Reset();
+	/*
+	* Advects the tracers by a step with the midpoint method and packs their positions. Called by every thread of
+	* the pool.
+	* @param[in] pool			Pool running the step.
+	* @param[in] thread			Index of the calling thread.
+	* @param[in] dt				Time-step.
+	* @param[in] velocity		Velocity field in grid units.
+	*/
+	void Step(WorkerPool* pool, uint thread, float dt, const glm::vec2* velocity);
+
+	/*
+	* Retrieves the packed positions, x in the low and y in the high 16 bits, normalized to the grid such that
+	* the center of a cell is at the center of its pixel.
+	*/
+	const uint* Packed() const { return m_Packed; }
+	size_t Size() const { return m_Count; }
+
+private:
+	int m_Width, m_Height;
+	size_t m_Count;
+	uint64_t m_Steps = 0;
+
+	Arena m_Arena;
+	float* m_X = nullptr, * m_Y = nullptr;
+	uint* m_Age = nullptr;
+	/*
+	* Destination of the sort and the tile of each tracer.
+	*/
+	float* m_SortedX = nullptr, * m_SortedY = nullptr;
+	uint* m_SortedAge = nullptr, * m_Tiles = nullptr;
+	uint* m_Packed = nullptr;
+	int m_TilesX, m_TilesY;
+	std::vector<uint> m_TileStart;
+
+	/*
+	* Emits a tracer at a position hashed from its index and a seed.
+	*/
+	void Emit(size_t i, uint seed);
+	/*
+	* Advects four consecutive tracers.
+	* @param[in] first			Index of the first tracer, a multiple of four.
+	* @param[in] scale			Factor from grid velocity to cells per step.
+	* @param[in] velocity		Velocity field in grid units.
+	*/
+	void Advect(size_t first, float scale, const glm::vec2* velocity);
+	/*
+	* Sorts the tracers by tile with a counting sort, after their tiles were computed.
+	*/
+	void Sort();
+};
@@ -0,0 +1,282 @@
+#include "stdfax.h"
+#include <glm/gtx/compatibility.hpp>
+#include "Volume.h"
+#include "Constants.h"
+#include "Hash.h"
+#include "WorkerPool.h"
+#include "Template/Application.h"
+
+VolumeSolver::VolumeSolver(int width, int height, int depth)
+	: m_Width(width), m_Height(height), m_Depth(depth)
+{
+	const size_t cells = (size_t)width * height * depth;
+	size_t size =
+		2 * Arena::Align(sizeof(glm::vec3) * cells) +
+		2 * Arena::Align(sizeof(float) * cells) +
+		2 * Arena::Align(sizeof(float) * cells) +
+		1 * Arena::Align(sizeof(float) * cells);
+
+	m_Arena.Reset(size);
+
+	m_VelocityBuffer = m_Arena.Allocate<glm::vec3>(cells);
+	m_VelocityOutput = m_Arena.Allocate<glm::vec3>(cells);
+	m_PressureBuffer = m_Arena.Allocate<float>(cells);
+	m_PressureOutput = m_Arena.Allocate<float>(cells);
+	m_DensityBuffer = m_Arena.Allocate<float>(cells);
+	m_DensityOutput = m_Arena.Allocate<float>(cells);
+	m_DivergenceBuffer = m_Arena.Allocate<float>(cells);
+
+	Reset();
+}
+
+void VolumeSolver::Reset()
+{
+	WorkerPool* pool = Application::Workers();
+
+	// First-touch every plane of a band from the thread that streams it.
+	pool->Run([&](uint thread) {
+		RowRange rows = pool->Rows(thread, m_Height);
+		const size_t count = (size_t)m_Width * (rows.end - rows.begin);
+
+		for (int z = 0; z < m_Depth; z++) {
+			size_t offset = Index(0, rows.begin, z);
+			memset(m_VelocityBuffer + offset, 0, sizeof(glm::vec3) * count);
+			memset(m_VelocityOutput + offset, 0, sizeof(glm::vec3) * count);
+			memset(m_PressureBuffer + offset, 0, sizeof(float) * count);
+			memset(m_PressureOutput + offset, 0, sizeof(float) * count);
+			memset(m_DensityBuffer + offset, 0, sizeof(float) * count);
+			memset(m_DensityOutput + offset, 0, sizeof(float) * count);
+			memset(m_DivergenceBuffer + offset, 0, sizeof(float) * count);
+		}
+	});
+}
+
+void VolumeSolver::Step(float dt)
+{
+	WorkerPool* pool = Application::Workers();
+
+	pool->Run([&](uint thread) {
+		RowRange rows = pool->Rows(thread, m_Height);
+
+		// The faces are O(n^2), not worth splitting.
+		if (thread == 0) UpdateBoundaries(m_VelocityBuffer, -1.0f), UpdateBoundaries(m_DensityBuffer, 0.0f);
+		pool->Sync(thread);
+		Advect(m_VelocityBuffer, m_VelocityOutput, dt, rows);
+		Advect(m_DensityBuffer, m_DensityOutput, dt, rows);
+		pool->Sync(thread);
+		CopyRows(m_VelocityBuffer, m_VelocityOutput, rows);
+		CopyRows(m_DensityBuffer, m_DensityOutput, rows);
+		pool->Sync(thread);
+
+		for (int i = 0; i < 8; i++) {
+			DiffuseVelocities(dt, rows);
+			pool->Sync(thread);
+			CopyRows(m_VelocityBuffer, m_VelocityOutput, rows);
+			pool->Sync(thread);
+		}
+
+		ComputeDivergence(rows);
+		pool->Sync(thread);
+
+		for (int i = 0; i < 8; i++) {
+			ComputePressure(rows);
+			pool->Sync(thread);
+			CopyRows(m_PressureBuffer, m_PressureOutput, rows);
+			pool->Sync(thread);
+		}
+		if (thread == 0) UpdateBoundaries(m_PressureBuffer, 1.0f);
+		pool->Sync(thread);
+
+		SubtractPressureGradient(rows);
+	});
+}
+
+void VolumeSolver::AddSource(glm::vec3 center, float radius, glm::vec3 velocity, float density)
+{
+	int x0 = glm::max((int)(center.x - radius), 0), x1 = glm::min((int)(center.x + radius) + 1, m_Width);
+	int y0 = glm::max((int)(center.y - radius), 0), y1 = glm::min((int)(center.y + radius) + 1, m_Height);
+	int z0 = glm::max((int)(center.z - radius), 0), z1 = glm::min((int)(center.z + radius) + 1, m_Depth);
+
+	for (int z = z0; z < z1; z++)
+		for (int y = y0; y < y1; y++)
+			for (int x = x0; x < x1; x++) {
+				if (glm::length(glm::vec3(x, y, z) - center) > radius) continue;
+				m_VelocityBuffer[Index(x, y, z)] = velocity;
+				m_DensityBuffer[Index(x, y, z)] = density;
+			}
+}
+
+void VolumeSolver::ExportSlice(Surface* surface, int z) const
+{
+	z = glm::clamp(z, 0, m_Depth - 1);
+
+	// Nearest-neighbour resample the slice onto the surface.
+	for (uint y = 0; y < surface->GetHeight(); y++)
+		for (uint x = 0; x < surface->GetWidth(); x++) {
+			int gx = (int)(x * m_Width / surface->GetWidth());
+			int gy = (int)(y * m_Height / surface->GetHeight());
+			surface->PlotPixel(Color(glm::clamp(m_DensityBuffer[Index(gx, gy, z)], 0.0f, 1.0f)), x, y);
+		}
+}
+
+uint64_t VolumeSolver::Hash() const
+{
+	const size_t cells = (size_t)m_Width * m_Height * m_Depth;
+	uint64_t hash = HashWords(m_VelocityBuffer, sizeof(glm::vec3) * cells);
+	hash = HashWords(m_PressureBuffer, sizeof(float) * cells, hash);
+	return HashWords(m_DensityBuffer, sizeof(float) * cells, hash);
+}
+
+template<typename Kernel>
+void VolumeSolver::StreamBlocks(RowRange rows, const Kernel& kernel) const
+{
+	for (int block = rows.begin; block < rows.end; block += VOLUME_BLOCK_ROWS) {
+		int blockEnd = glm::min(block + VOLUME_BLOCK_ROWS, rows.end);
+
+		for (int z = 0; z < m_Depth; z++)
+			for (int y = block; y < blockEnd; y++) kernel(y, z);
+	}
+}
+
+template<typename T>
+void VolumeSolver::CopyRows(T* dst, const T* src, RowRange rows)
+{
+	const size_t count = (size_t)m_Width * (rows.end - rows.begin);
+
+	for (int z = 0; z < m_Depth; z++) {
+		size_t offset = Index(0, rows.begin, z);
+		memcpy(dst + offset, src + offset, sizeof(T) * count);
+	}
+}
+
+template<typename T>
+void VolumeSolver::UpdateBoundaries(T* field, float scale)
+{
+	// Loop over the x-faces.
+	for (int z = 0; z < m_Depth; z++)
+		for (int y = 0; y < m_Height; y++) {
+			field[Index(0, y, z)] = field[Index(1, y, z)] * scale;
+			field[Index(m_Width - 1, y, z)] = field[Index(m_Width - 2, y, z)] * scale;
+		}
+	// Loop over the y-faces.
+	for (int z = 0; z < m_Depth; z++)
+		for (int x = 0; x < m_Width; x++) {
+			field[Index(x, 0, z)] = field[Index(x, 1, z)] * scale;
+			field[Index(x, m_Height - 1, z)] = field[Index(x, m_Height - 2, z)] * scale;
+		}
+	// Loop over the z-faces.
+	for (int y = 0; y < m_Height; y++)
+		for (int x = 0; x < m_Width; x++) {
+			field[Index(x, y, 0)] = field[Index(x, y, 1)] * scale;
+			field[Index(x, y, m_Depth - 1)] = field[Index(x, y, m_Depth - 2)] * scale;
+		}
+}
+
+template<typename T>
+void VolumeSolver::Advect(const T* field, T* output, float dt, RowRange rows)
+{
+	const glm::vec3 limit = glm::vec3(m_Width, m_Height, m_Depth) - 1.0f;
+
+	StreamBlocks(rows, [&](int y, int z) {
+		for (int x = 0; x < m_Width; x++) {
+			glm::vec3 pos = glm::vec3(x, y, z) - dt * RDX * m_VelocityBuffer[Index(x, y, z)];
+
+			glm::ivec3 st = glm::ivec3(glm::clamp(glm::floor(pos), glm::vec3(0.0f), limit));
+			glm::ivec3 su = glm::ivec3(glm::clamp(glm::vec3(st) + 1.0f, glm::vec3(0.0f), limit));
+			glm::vec3 t = glm::clamp(pos - glm::vec3(st), 0.0f, 1.0f);
+
+			T front = glm::lerp(
+				glm::lerp(field[Index(st.x, st.y, st.z)], field[Index(su.x, st.y, st.z)], t.x),
+				glm::lerp(field[Index(st.x, su.y, st.z)], field[Index(su.x, su.y, st.z)], t.x), t.y);
+			T back = glm::lerp(
+				glm::lerp(field[Index(st.x, st.y, su.z)], field[Index(su.x, st.y, su.z)], t.x),
+				glm::lerp(field[Index(st.x, su.y, su.z)], field[Index(su.x, su.y, su.z)], t.x), t.y);
+
+			output[Index(x, y, z)] = glm::lerp(front, back, t.z);
+		}
+	});
+}
+
+void VolumeSolver::DiffuseVelocities(float dt, RowRange rows)
+{
+	float alpha = (DX * DX) / (VISCOSITY * dt);
+	float rBeta = 1.0f / (alpha + 6.0f);
+
+	StreamBlocks(rows, [&](int y, int z) {
+		// Rows of the four y- and z-neighbours, the z-neighbours were streamed through just before.
+		const glm::vec3* rowB = m_VelocityBuffer + Index(0, glm::max(y - 1, 0), z);
+		const glm::vec3* rowT = m_VelocityBuffer + Index(0, glm::min(y + 1, m_Height - 1), z);
+		const glm::vec3* rowK = m_VelocityBuffer + Index(0, y, glm::max(z - 1, 0));
+		const glm::vec3* rowF = m_VelocityBuffer + Index(0, y, glm::min(z + 1, m_Depth - 1));
+		const glm::vec3* row = m_VelocityBuffer + Index(0, y, z);
+		glm::vec3* out = m_VelocityOutput + Index(0, y, z);
+
+		for (int x = 0; x < m_Width; x++) {
+			glm::vec3 xL = row[glm::max(x - 1, 0)];
+			glm::vec3 xR = row[glm::min(x + 1, m_Width - 1)];
+
+			out[x] = (xL + xR + rowB[x] + rowT[x] + rowK[x] + rowF[x] + alpha * row[x]) * rBeta;
+		}
+	});
+}
+
+void VolumeSolver::ComputeDivergence(RowRange rows)
+{
+	StreamBlocks(rows, [&](int y, int z) {
+		const glm::vec3* rowB = m_VelocityBuffer + Index(0, glm::max(y - 1, 0), z);
+		const glm::vec3* rowT = m_VelocityBuffer + Index(0, glm::min(y + 1, m_Height - 1), z);
+		const glm::vec3* rowK = m_VelocityBuffer + Index(0, y, glm::max(z - 1, 0));
+		const glm::vec3* rowF = m_VelocityBuffer + Index(0, y, glm::min(z + 1, m_Depth - 1));
+		const glm::vec3* row = m_VelocityBuffer + Index(0, y, z);
+		float* out = m_DivergenceBuffer + Index(0, y, z);
+
+		for (int x = 0; x < m_Width; x++) {
+			glm::vec3 wL = row[glm::max(x - 1, 0)];
+			glm::vec3 wR = row[glm::min(x + 1, m_Width - 1)];
+
+			out[x] = HALFDX * ((wR.x - wL.x) + (rowT[x].y - rowB[x].y) + (rowF[x].z - rowK[x].z));
+		}
+	});
+}
+
+void VolumeSolver::ComputePressure(RowRange rows)
+{
+	float alpha = -1.0f * (DX * DX);
+	float rBeta = 1.0f / 6.0f;
+
+	StreamBlocks(rows, [&](int y, int z) {
+		const float* rowB = m_PressureBuffer + Index(0, glm::max(y - 1, 0), z);
+		const float* rowT = m_PressureBuffer + Index(0, glm::min(y + 1, m_Height - 1), z);
+		const float* rowK = m_PressureBuffer + Index(0, y, glm::max(z - 1, 0));
+		const float* rowF = m_PressureBuffer + Index(0, y, glm::min(z + 1, m_Depth - 1));
+		const float* row = m_PressureBuffer + Index(0, y, z);
+		const float* b = m_DivergenceBuffer + Index(0, y, z);
+		float* out = m_PressureOutput + Index(0, y, z);
+
+		for (int x = 0; x < m_Width; x++) {
+			float xL = row[glm::max(x - 1, 0)];
+			float xR = row[glm::min(x + 1, m_Width - 1)];
+
+			out[x] = (xL + xR + rowB[x] + rowT[x] + rowK[x] + rowF[x] + alpha * b[x]) * rBeta;
+		}
+	});
+}
+
+void VolumeSolver::SubtractPressureGradient(RowRange rows)
+{
+	StreamBlocks(rows, [&](int y, int z) {
+		const float* rowB = m_PressureBuffer + Index(0, glm::max(y - 1, 0), z);
+		const float* rowT = m_PressureBuffer + Index(0, glm::min(y + 1, m_Height - 1), z);
+		const float* rowK = m_PressureBuffer + Index(0, y, glm::max(z - 1, 0));
+		const float* rowF = m_PressureBuffer + Index(0, y, glm::min(z + 1, m_Depth - 1));
+		const float* row = m_PressureBuffer + Index(0, y, z);
+		glm::vec3* velocity = m_VelocityBuffer + Index(0, y, z);
+
+		for (int x = 0; x < m_Width; x++) {
+			float pL = row[glm::max(x - 1, 0)];
+			float pR = row[glm::min(x + 1, m_Width - 1)];
+
+			velocity[x] -= HALFDX * glm::vec3(pR - pL, rowT[x] - rowB[x], rowF[x] - rowK[x]);
+		}
+	});
+}
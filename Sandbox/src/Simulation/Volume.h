@@ -0,0 +1,98 @@
+#pragma once
+#include "Arena.h"
+#include "Threading.h"
+
+class Surface;
+
+/*
+* Number of rows of a block streamed through z. Three planes of a block of the largest field stay in L2 at 256 cells
+* wide, so every plane is loaded once per sweep and reused by the planes in front of and behind it.
+*/
+#define VOLUME_BLOCK_ROWS 8
+
+/*
+* Three-dimensional variant of Game's pipeline, transporting a scalar smoke density. Kernels are parallelized over
+* bands of y-rows and stream each band through z in blocks of VOLUME_BLOCK_ROWS rows (2.5D blocking), so the
+* 7-point stencils read their z-neighbours from cache instead of memory.
+*/
+class VolumeSolver {
+
+public:
+	/*
+	* Allocates the volume and clears it.
+	* @param[in] width			Number of grid cells in x-direction.
+	* @param[in] height			Number of grid cells in y-direction.
+	* @param[in] depth			Number of grid cells in z-direction.
+	*/
+	VolumeSolver(int width, int height, int depth);
+
+	/*
+	* Clears the velocity, pressure and density.
+	*/
+	void Reset();
+	/*
+	* Advances the volume by a single time-step.
+	* @param[in] dt				Time-step.
+	*/
+	void Step(float dt);
+
+	/*
+	* Injects smoke into a sphere. Must not be called during a step.
+	* @param[in] center			Center of the sphere in grid coordinates.
+	* @param[in] radius			Radius of the sphere in cells.
+	* @param[in] velocity		Velocity imposed inside the sphere.
+	* @param[in] density		Density imposed inside the sphere.
+	*/
+	void AddSource(glm::vec3 center, float radius, glm::vec3 velocity, float density);
+	/*
+	* Plots the density of a z-slice onto a surface, resampled to the surface size. <b>NOTE:</b> does not sync
+	* the surface.
+	* @param[in] surface		Surface to plot to.
+	* @param[in] z				Index of the slice.
+	*/
+	void ExportSlice(Surface* surface, int z) const;
+	/*
+	* Hashes the velocity, pressure and density with 64-bit FNV-1a, e.g. to compare runs.
+	*/
+	uint64_t Hash() const;
+
+	int Width() const { return m_Width; }
+	int Height() const { return m_Height; }
+	int Depth() const { return m_Depth; }
+
+private:
+	int m_Width, m_Height, m_Depth;
+
+	Arena m_Arena;
+	glm::vec3* m_VelocityBuffer = nullptr, * m_VelocityOutput = nullptr;
+	float* m_PressureBuffer = nullptr, * m_PressureOutput = nullptr;
+	float* m_DensityBuffer = nullptr, * m_DensityOutput = nullptr;
+	float* m_DivergenceBuffer = nullptr;
+
+	size_t Index(int x, int y, int z) const { return (size_t)x + ((size_t)y + (size_t)z * m_Height) * m_Width; }
+
+	/*
+	* Visits every (y, z) row of a band of y-rows, block by block, streaming each block through z.
+	* @param[in] rows			Band of y-rows.
+	* @param[in] kernel			Callable processing a single row, receiving y and z.
+	*/
+	template<typename Kernel>
+	void StreamBlocks(RowRange rows, const Kernel& kernel) const;
+	template<typename T>
+	void CopyRows(T* dst, const T* src, RowRange rows);
+	/*
+	* Sets the six faces of a field to its inner neighbours, scaled.
+	*/
+	template<typename T>
+	void UpdateBoundaries(T* field, float scale);
+	/*
+	* Advects a field through the velocity field with trilinear interpolation.
+	*/
+	template<typename T>
+	void Advect(const T* field, T* output, float dt, RowRange rows);
+
+	void DiffuseVelocities(float dt, RowRange rows);
+	void ComputeDivergence(RowRange rows);
+	void ComputePressure(RowRange rows);
+	void SubtractPressureGradient(RowRange rows);
+};
@@ -0,0 +1,93 @@
+#include "stdfax.h"
+#include <xmmintrin.h>
+#include "WorkerPool.h"
+
+/*
+* Number of polls a waiting thread spins before it yields or sleeps. Frames arrive every few milliseconds,
+* so idle workers should not keep their cores busy in between.
+*/
+#define SPIN_COUNT 4096
+
+WorkerPool::WorkerPool(uint threads, uint firstSlot, uint slots)
+{
+	m_Size = threads > 0 ? threads : glm::max(std::thread::hardware_concurrency(), 1u);
+	m_FirstSlot = firstSlot;
+	m_Slots = glm::max(slots, firstSlot + m_Size);
+	m_LocalSense.resize(m_Size);
+
+	// The calling thread participates as thread 0.
+	PinThread(m_FirstSlot, m_Slots);
+	for (uint i = 1; i < m_Size; i++)
+		m_Threads.emplace_back(&WorkerPool::WorkerLoop, this, i);
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Quit = true;
+	}
+	m_Wake.notify_all();
+
+	for (std::thread& thread : m_Threads) thread.join();
+}
+
+void WorkerPool::Run(const std::function<void(uint thread)>& job)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Job = &job;
+		m_Generation.fetch_add(1, std::memory_order_release);
+	}
+	m_Wake.notify_all();
+
+	const uint control = _mm_getcsr();
+	if (m_FloatControl) _mm_setcsr(m_FloatControl);
+	job(0);
+
+	// Wait for the other threads to finish the job.
+	Sync(0);
+	_mm_setcsr(control);
+}
+
+void WorkerPool::Sync(uint thread)
+{
+	if (m_Size == 1) return;
+
+	uint sense = m_LocalSense[thread].sense ^= 1;
+
+	// The last thread to arrive resets the counter and releases the others by flipping the global sense.
+	if (m_Arrived.fetch_add(1, std::memory_order_acq_rel) == m_Size - 1) {
+		m_Arrived.store(0, std::memory_order_relaxed);
+		m_Sense.store(sense, std::memory_order_release);
+		return;
+	}
+
+	for (uint spin = 0; m_Sense.load(std::memory_order_acquire) != sense; spin++) {
+		if (spin < SPIN_COUNT) YieldProcessor();
+		else std::this_thread::yield();
+	}
+}
+
+void WorkerPool::WorkerLoop(uint thread)
+{
+	PinThread(m_FirstSlot + thread, m_Slots);
+
+	uint generation = 0;
+	while (true) {
+		// Spin briefly for the next job, then go to sleep.
+		for (uint spin = 0; spin < SPIN_COUNT && m_Generation.load(std::memory_order_acquire) == generation; spin++)
+			YieldProcessor();
+
+		if (m_Generation.load(std::memory_order_acquire) == generation) {
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Wake.wait(lock, [&]() { return m_Quit || m_Generation.load(std::memory_order_acquire) != generation; });
+		}
+		if (m_Quit) return;
+
+		generation = m_Generation.load(std::memory_order_acquire);
+		if (m_FloatControl) _mm_setcsr(m_FloatControl);
+		(*m_Job)(thread);
+		Sync(thread);
+	}
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "Threading.h"
+
+/*
+* SSE control register of the deterministic mode: every exception masked, round to nearest and denormals kept,
+* the IEEE defaults.
+*/
+#define DETERMINISTIC_FLOAT_CONTROL 0x1F80
+
+/*
+* Persistent team of pinned worker threads. A job runs on every thread of the pool at once, the calling thread
+* acting as thread 0, and phases inside a job are separated with a sense-reversing barrier instead of opening a
+* new parallel region per kernel.
+*/
+class WorkerPool {
+
+public:
+	/*
+	* Starts the worker threads. Several pools sharing the machine, such as one per rank, pin to disjoint slots.
+	* @param[in] threads		Number of threads including the calling thread, 0 uses one per logical processor.
+	* @param[in] firstSlot		Slot the calling thread is pinned to; the workers take the following slots.
+	* @param[in] slots			Total number of slots spread over the machine, 0 uses the number of threads.
+	*/
+	WorkerPool(uint threads = 0, uint firstSlot = 0, uint slots = 0);
+	~WorkerPool();
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	/*
+	* Runs a job on all threads of the pool and returns once every thread finished it.
+	* @param[in] job			Callable receiving the index of the thread it runs on.
+	*/
+	void Run(const std::function<void(uint thread)>& job);
+	/*
+	* Blocks until all threads of the pool reached the barrier. Only valid inside a job.
+	* @param[in] thread			Index of the calling thread.
+	*/
+	void Sync(uint thread);
+
+	/*
+	* Retrieves the rows owned by a thread of the pool.
+	* @param[in] thread			Index of the thread.
+	* @param[in] rows			Number of rows to divide.
+	*/
+	RowRange Rows(uint thread, int rows) const { return OwnedRows(thread, m_Size, rows); }
+	/*
+	* Retrieves the number of threads in the pool, including the calling thread.
+	*/
+	uint Size() const { return m_Size; }
+	/*
+	* Sets the SSE control register every thread loads at the start of a job, so all threads round and treat
+	* denormals alike whatever the runtime or a driver left in theirs. The calling thread restores its own after
+	* the job.
+	* @param[in] control		Value of the control register, or 0 to leave the threads' registers untouched.
+	*/
+	void SetFloatControl(uint control) { m_FloatControl = control; }
+
+private:
+	/*
+	* Barrier state local to a thread, padded to a cache-line to avoid false sharing.
+	*/
+	struct alignas(64) LocalSense {
+		uint sense = 0;
+	};
+
+	uint m_Size = 1;
+	uint m_FirstSlot = 0, m_Slots = 1;
+	uint m_FloatControl = 0;
+	std::vector<std::thread> m_Threads;
+	std::vector<LocalSense> m_LocalSense;
+
+	/*
+	* Job dispatch; a worker runs the job once it observes a new generation.
+	*/
+	const std::function<void(uint)>* m_Job = nullptr;
+	std::atomic<uint> m_Generation = 0;
+	std::atomic<bool> m_Quit = false;
+	std::mutex m_Mutex;
+	std::condition_variable m_Wake;
+
+	/*
+	* Sense-reversing barrier; arrival counter and global sense on separate cache-lines.
+	*/
+	alignas(64) std::atomic<uint> m_Arrived = 0;
+	alignas(64) std::atomic<uint> m_Sense = 0;
+
+	/*
+	* Main loop of a worker thread.
+	* @param[in] thread			Index of the worker.
+	*/
+	void WorkerLoop(uint thread);
+};
@@ -1,7 +1,15 @@
 #include "stdfax.h"
 #include "Application.h"
 #include "Game.h"
+#include "Simulation/WorkerPool.h"
+#include "Simulation/Constants.h"
+#include "Simulation/Hash.h"
+#include "Simulation/Slab.h"
+#include "Simulation/SharedMemoryTransport.h"
+#include "Simulation/OutOfCore.h"
 #include <chrono>
+#include <thread>
+#include <timeapi.h>
 
 
 // Initialize static member-variables. 
@@ -9,13 +17,77 @@ uint Application::s_RenderWidth = 0;
 uint Application::s_RenderHeight = 0;
 uint Application::s_WindowWidth = 0;
 uint Application::s_WindowHeight = 0;
+uint Application::s_FrameCap = DEFAULT_FRAME_CAP;
 
 bool Application::s_Initialized = false;
 GLFWwindow* Application::s_Window = nullptr;
 Surface* Application::s_RenderSurface = nullptr;
 clContext* Application::s_clContext = nullptr;
+WorkerPool* Application::s_Workers = nullptr;
+
+/*
+* Steps a slab through the scripted impulses of a headless run. All ranks must step together.
+*/
+static void StepSlab(SlabSolver& slab, int width, int height, int steps)
+{
+	ImpulseQueue impulses;
+	for (int step = 0; step < steps; step++) {
+		impulses.Clear();
+		impulses.AddScript(step, width, height);
+		slab.Step(TIMESTEP, impulses);
+	}
+}
+
+/*
+* Steps the slab decomposition of WIDTH by HEIGHT with every rank on its own thread and pool of this process, and
+* hashes the dye and velocity of the whole grid, so runs over different numbers of ranks can be compared.
+*/
+static uint64_t HashRankedRun(int ranks, int steps)
+{
+	const uint threads = glm::max(std::thread::hardware_concurrency() / (uint)ranks, 1u);
+	// Every run gets a fresh section.
+	const std::string section = std::to_string(GetCurrentProcessId()) + ".Determinism." + std::to_string(ranks);
+	uint64_t hash = HashWords(nullptr, 0);
+
+	std::vector<std::thread> rankThreads;
+	for (int rank = 0; rank < ranks; rank++) {
+		rankThreads.emplace_back([&, rank]() {
+			WorkerPool pool(threads, (uint)rank * threads, (uint)ranks * threads);
+			pool.SetFloatControl(DETERMINISTIC_FLOAT_CONTROL);
+			SharedMemoryTransport transport(section, rank, ranks, SlabSolver::MessageCapacity(WIDTH));
+			SlabSolver slab(&transport, &pool, WIDTH, HEIGHT);
+			StepSlab(slab, WIDTH, HEIGHT, steps);
+
+			// Fold in the owned rows in rank order, as if hashing the whole grid at once.
+			RowRange rows = slab.Rows();
+			const size_t first = (size_t)rows.begin * WIDTH, cells = (size_t)(rows.end - rows.begin) * WIDTH;
+			for (int turn = 0; turn < 2 * ranks; turn++) {
+				if (turn == rank) hash = HashWords(slab.Colors() + first, sizeof(glm::vec4) * cells, hash);
+				if (turn == ranks + rank) hash = HashWords(slab.Velocity() + first, sizeof(glm::vec2) * cells, hash);
+				transport.Barrier();
+			}
+		});
+	}
+	for (std::thread& thread : rankThreads) thread.join();
+
+	return hash;
+}
+
+int main(int argc, char** argv) {
+	// Sandbox --check-determinism [steps] runs without a window and returns whether the step is reproducible.
+	if (argc > 1 && strcmp(argv[1], "--check-determinism") == 0)
+		return Application::CheckDeterminism(argc > 2 ? atoi(argv[2]) : DETERMINISM_STEPS);
+	// Sandbox --ranks N [scale] [steps] runs the slab decomposition headless, one process per rank.
+	if (argc > 2 && strcmp(argv[1], "--ranks") == 0)
+		return Application::LaunchRanks(atoi(argv[2]), argc > 3 ? atoi(argv[3]) : RANK_SCALE, argc > 4 ? atoi(argv[4]) : RANK_STEPS);
+	// Sandbox --rank i N section scale steps is how the launcher starts each rank.
+	if (argc > 6 && strcmp(argv[1], "--rank") == 0)
+		return Application::RunRank(atoi(argv[2]), atoi(argv[3]), argv[4], atoi(argv[5]), atoi(argv[6]));
+	// Sandbox --out-of-core [scale] [steps] [directory] runs a grid that need not fit in memory headless.
+	if (argc > 1 && strcmp(argv[1], "--out-of-core") == 0)
+		return Application::RunOutOfCore(argc > 2 ? atoi(argv[2]) : OUT_OF_CORE_SCALE, argc > 3 ? atoi(argv[3]) : OUT_OF_CORE_STEPS,
+			argc > 4 ? argv[4] : ".");
 
-int main() {
 	Application::Initialize(1024, 1024);
 	Application::Run();
 
@@ -36,6 +108,8 @@ void Application::Initialize(uint width, uint height)
 	Application::InitOpenCL();
 	Input::Initialize(Application::Window());
 
+	s_Workers = new WorkerPool();
+
 	s_RenderSurface = new Surface(s_RenderWidth, s_RenderHeight);
 
 	// Set the Game to be initialized.
@@ -55,8 +129,12 @@ void Application::Run()
 	std::chrono::system_clock::time_point tp = std::chrono::system_clock::now();
 	std::chrono::system_clock::time_point tc = std::chrono::system_clock::now();
 	float dt = std::chrono::duration<float>(tc - tp).count() + 0.00001f;
+	// The default timer resolution of about 15.6 ms is coarser than a capped frame.
+	bool fineTimer = false;
 
 	while (!Input::KeyPressed(Key::Escape) && !glfwWindowShouldClose(Application::Window())) {
+		std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+
 		// Compute the time passed since last loop.
 		float dt = std::chrono::duration<float>(tc - tp).count() + 0.00001f;
 		tp = tc; tc = std::chrono::system_clock::now();
@@ -71,6 +149,7 @@ void Application::Run()
 
 		// Render our render-target.
 		Application::Screen()->Draw();
+		game->DrawOverlay(dt);
 
 		game->RenderGUI(dt);
 
@@ -78,12 +157,168 @@ void Application::Run()
 		Input::Update();
 
 		glfwSwapBuffers(Application::Window());
-		glfwPollEvents();
+
+		// Raise the timer resolution only while the frame-rate is capped.
+		if (fineTimer != (s_FrameCap > 0)) {
+			fineTimer = s_FrameCap > 0;
+			if (fineTimer) timeBeginPeriod(1);
+			else timeEndPeriod(1);
+		}
+		// Sleep instead of spinning: until new input while the fluid has settled, else for the rest of the frame.
+		if (game->IsQuiescent()) glfwWaitEventsTimeout(QUIESCENT_WAIT);
+		else {
+			if (s_FrameCap > 0) {
+				auto frameEnd = frameStart + std::chrono::duration<double>(1.0 / s_FrameCap);
+				std::this_thread::sleep_until(frameEnd - std::chrono::duration<double>(FRAME_SPIN));
+				while (std::chrono::steady_clock::now() < frameEnd) YieldProcessor();
+			}
+			glfwPollEvents();
+		}
 	}
+	if (fineTimer) timeEndPeriod(1);
 
 	delete game;
 }
 
+int Application::CheckDeterminism(int steps)
+{
+	const uint threads[] = { 1, 2, 3, std::thread::hardware_concurrency() };
+	int mismatches = 0;
+
+	for (int determinismCase = 0; determinismCase < DETERMINISM_CASES; determinismCase++) {
+		uint64_t reference = 0;
+		for (int i = 0; i < IM_ARRAYSIZE(threads); i++) {
+			// Every run starts from a new pool and game, the game lays out its buffers for the pool.
+			delete s_Workers;
+			s_Workers = new WorkerPool(threads[i]);
+			Game* game = new Game();
+			uint64_t hash = game->RunDeterminismCase(determinismCase, steps);
+			delete game;
+
+			if (i == 0) reference = hash;
+			if (hash != reference) mismatches++;
+			printf("%-28s %3u threads: %016llx%s\n", Game::DeterminismCaseName(determinismCase), s_Workers->Size(),
+				(unsigned long long)hash, hash == reference ? "" : " MISMATCH");
+		}
+	}
+	delete s_Workers;
+	s_Workers = nullptr;
+
+	// The slab decomposition must match a single rank bitwise.
+	const int ranks[] = { 1, 2, 4 };
+	uint64_t reference = 0;
+	for (int i = 0; i < IM_ARRAYSIZE(ranks); i++) {
+		uint64_t hash = HashRankedRun(ranks[i], steps);
+
+		if (i == 0) reference = hash;
+		if (hash != reference) mismatches++;
+		printf("%-28s %3d ranks:   %016llx%s\n", "Ranked slab", ranks[i], (unsigned long long)hash, hash == reference ? "" : " MISMATCH");
+	}
+
+	return mismatches == 0 ? 0 : 1;
+}
+
+int Application::LaunchRanks(int ranks, int scale, int steps)
+{
+	if (ranks < 1) FATAL_ERROR("At least one rank is required.");
+	if (scale < 1) FATAL_ERROR("The slab grid scale must be at least 1.");
+
+	char path[MAX_PATH];
+	if (GetModuleFileNameA(NULL, path, MAX_PATH) == 0) FATAL_ERROR("Failed to retrieve the executable path.");
+	// The section is named after the launcher, so concurrent runs do not share one.
+	std::string section = std::to_string(GetCurrentProcessId());
+
+	std::vector<PROCESS_INFORMATION> processes(ranks);
+	for (int rank = 0; rank < ranks; rank++) {
+		std::string command = std::string("\"") + path + "\" --rank " + std::to_string(rank) + " " + std::to_string(ranks) +
+			" " + section + " " + std::to_string(scale) + " " + std::to_string(steps);
+		STARTUPINFOA startup = {};
+		startup.cb = sizeof(startup);
+		if (!CreateProcessA(NULL, &command[0], NULL, NULL, FALSE, 0, NULL, NULL, &startup, &processes[rank]))
+			FATAL_ERROR("Failed to start rank %d.", rank);
+	}
+
+	int failures = 0;
+	for (PROCESS_INFORMATION& process : processes) {
+		WaitForSingleObject(process.hProcess, INFINITE);
+		DWORD code = 1;
+		GetExitCodeProcess(process.hProcess, &code);
+		if (code != 0) failures++;
+		CloseHandle(process.hThread);
+		CloseHandle(process.hProcess);
+	}
+	return failures == 0 ? 0 : 1;
+}
+
+int Application::RunRank(int rank, int ranks, const char* section, int scale, int steps)
+{
+	if (rank < 0 || rank >= ranks) FATAL_ERROR("Rank %d is outside of 0 to %d.", rank, ranks - 1);
+	if (scale < 1) FATAL_ERROR("The slab grid scale must be at least 1.");
+	const int width = WIDTH * scale, height = HEIGHT * scale;
+
+	// The ranks share the machine, each gets its own part of the hardware threads.
+	const uint threads = glm::max(std::thread::hardware_concurrency() / (uint)ranks, 1u);
+	s_Workers = new WorkerPool(threads, (uint)rank * threads, (uint)ranks * threads);
+	{
+		SharedMemoryTransport transport(section, rank, ranks, SlabSolver::MessageCapacity(width));
+		SlabSolver slab(&transport, s_Workers, width, height);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		StepSlab(slab, width, height, steps);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// Hash the dye of the owned rows to compare runs.
+		RowRange rows = slab.Rows();
+		uint64_t hash = HashWords(slab.Colors() + (size_t)rows.begin * width, sizeof(glm::vec4) * (rows.end - rows.begin) * width);
+
+		printf("Rank %d/%d rows %5d-%5d: %7.3f ms per step, dye %016llx\n", rank, ranks, rows.begin, rows.end,
+			1000.0 * seconds / glm::max(steps, 1), (unsigned long long)hash);
+
+		// Neighbours may still read this rank's last halos, the section is released once all are done.
+		transport.Barrier();
+	}
+	delete s_Workers;
+	s_Workers = nullptr;
+
+	return 0;
+}
+
+int Application::RunOutOfCore(int scale, int steps, const char* directory)
+{
+	if (scale < 1) FATAL_ERROR("The out-of-core grid scale must be at least 1.");
+	const int width = WIDTH * scale, height = HEIGHT * scale;
+
+	s_Workers = new WorkerPool();
+	{
+		OutOfCoreSolver solver(directory, width, height);
+		ImpulseQueue impulses;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int step = 0; step < steps; step++) {
+			impulses.Clear();
+			impulses.AddScript(step, width, height);
+			solver.Step(TIMESTEP, impulses);
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// The dye is read back a band at a time, the whole grid need not fit in memory.
+		std::vector<glm::vec4> band((size_t)width * OUT_OF_CORE_BAND);
+		uint64_t hash = HashWords(nullptr, 0);
+		for (int y = 0; y < height; y += OUT_OF_CORE_BAND) {
+			RowRange rows = { y, glm::min(y + OUT_OF_CORE_BAND, height) };
+			solver.ReadColors(rows, band.data());
+			hash = HashWords(band.data(), sizeof(glm::vec4) * (rows.end - rows.begin) * width, hash);
+		}
+
+		printf("Out-of-core %dx%d: %9.3f ms per step, dye %016llx\n", width, height, 1000.0 * seconds / glm::max(steps, 1),
+			(unsigned long long)hash);
+	}
+	delete s_Workers;
+	s_Workers = nullptr;
+
+	return 0;
+}
+
 GLFWwindow* Application::Window()
 {
 	return s_Window;
@@ -99,6 +334,11 @@ clContext* Application::CLcontext()
 	return s_clContext;
 }
 
+WorkerPool* Application::Workers()
+{
+	return s_Workers;
+}
+
 uint Application::WindowWidth()
 {
 	return s_WindowWidth;
@@ -109,6 +349,16 @@ uint Application::WindowHeight()
 	return s_WindowHeight;
 }
 
+uint Application::FrameCap()
+{
+	return s_FrameCap;
+}
+
+void Application::SetFrameCap(uint fps)
+{
+	s_FrameCap = fps;
+}
+
 uint Application::RenderWidth()
 {
 	return s_RenderWidth;
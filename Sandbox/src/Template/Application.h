@@ -4,6 +4,35 @@
 
 #define WIDTH 1024
 #define HEIGHT 1024
+/*
+* Default limit of the frame-rate, 0 for none.
+*/
+#define DEFAULT_FRAME_CAP 120
+/*
+* Time in seconds at the end of a capped frame that is spun rather than slept, sleeping wakes up late by up to
+* the timer resolution.
+*/
+#define FRAME_SPIN 0.001
+/*
+* Longest time in seconds the main-loop waits for events while the game is quiescent, so the GUI still refreshes.
+*/
+#define QUIESCENT_WAIT 0.5
+/*
+* Default number of steps of each configuration of the determinism check.
+*/
+#define DETERMINISM_STEPS 32
+/*
+* Default grid scale, relative to WIDTH by HEIGHT, and number of steps of a headless run of the slab decomposition.
+*/
+#define RANK_SCALE 1
+#define RANK_STEPS 32
+/*
+* Default grid scale, relative to WIDTH by HEIGHT, and number of steps of a headless out-of-core run.
+*/
+#define OUT_OF_CORE_SCALE 4
+#define OUT_OF_CORE_STEPS 8
+
+class WorkerPool;
 
 class Application
 {
@@ -18,6 +47,41 @@ public:
 	* Start the application main-loop.
 	*/
 	static void Run();
+	/*
+	* Runs every configuration of the deterministic step headless with 1, 2, 3 and all hardware threads, and
+	* prints the hash of the state after each run.
+	* @param[in] steps			Number of steps per run.
+	* @returns					Zero when the hashes of each configuration agree, else one.
+	*/
+	static int CheckDeterminism(int steps);
+	/*
+	* Starts one process per rank of the slab decomposition, each running RunRank, and waits for all of them.
+	* @param[in] ranks			Number of ranks.
+	* @param[in] scale			Grid scale relative to WIDTH by HEIGHT.
+	* @param[in] steps			Number of steps per rank.
+	* @returns					Zero when every rank succeeded, else one.
+	*/
+	static int LaunchRanks(int ranks, int scale, int steps);
+	/*
+	* Steps a single slab headless, exchanging halos with the other ranks through shared memory, and prints the
+	* time per step and the hash of the slab's dye.
+	* @param[in] rank			Index of this rank.
+	* @param[in] ranks			Number of ranks.
+	* @param[in] section		Name of the shared memory section, equal for all ranks of a run.
+	* @param[in] scale			Grid scale relative to WIDTH by HEIGHT.
+	* @param[in] steps			Number of steps.
+	* @returns					Zero on success.
+	*/
+	static int RunRank(int rank, int ranks, const char* section, int scale, int steps);
+	/*
+	* Steps a grid larger than WIDTH by HEIGHT headless with its fields in memory-mapped files, and prints the time
+	* per step and the hash of the dye.
+	* @param[in] scale			Grid scale relative to WIDTH by HEIGHT.
+	* @param[in] steps			Number of steps.
+	* @param[in] directory		Directory the field files are created in.
+	* @returns					Zero on success.
+	*/
+	static int RunOutOfCore(int scale, int steps, const char* directory);
 
 	/*
 	* Retrieve the active GLFW window.
@@ -32,6 +96,11 @@ public:
 	* @returns		Valid cl context object.
 	*/
 	static clContext* CLcontext();
+	/*
+	* Retrieve the global pool of simulation worker threads.
+	* @returns		Valid worker pool.
+	*/
+	static WorkerPool* Workers();
 
 	/*
 	* Retrieve the window's width.
@@ -54,11 +123,26 @@ public:
 	*/
 	static uint RenderHeight();
 
+	/*
+	* Retrieve the frame-rate limit.
+	* @returns		Frames per second, 0 when unlimited.
+	*/
+	static uint FrameCap();
+	/*
+	* Limits the frame-rate, the main-loop sleeps for the remainder of each frame.
+	* @param[in] fps			Frames per second, 0 for no limit.
+	*/
+	static void SetFrameCap(uint fps);
+
 private:
 	/*
 	* Global OpenCL context.
 	*/
 	static clContext* s_clContext;
+	/*
+	* Global pool of simulation worker threads.
+	*/
+	static WorkerPool* s_Workers;
 
 	/*
 	* Window size.
@@ -68,6 +152,10 @@ private:
 	* Render width and height.
 	*/
 	static uint s_RenderWidth, s_RenderHeight;
+	/*
+	* Frame-rate limit, 0 when unlimited.
+	*/
+	static uint s_FrameCap;
 
 	/*
 	* Boolean indicating if the Game class has been intialized yet.
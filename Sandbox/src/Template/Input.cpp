@@ -31,16 +31,36 @@ void InputKeyCallback(GLFWwindow* window, int key, int scancode, int action, int
 	else if (action == GLFW_PRESS) currentKeys[window][key] = KeyState::KeyDown;
 }
 
+/*
+* Cursor position callback function, records every position with a timestamp.
+* @param[in] window The window that received the event.
+* @param[in] x The new cursor x-coordinate, relative to the left edge of the content area.
+* @param[in] y The new cursor y-coordinate, relative to the top edge of the content area.
+*/
+void InputCursorCallback(GLFWwindow* window, double x, double y) {
+	CursorSample sample;
+	sample.position = glm::dvec2(x, y);
+	sample.time = glfwGetTime();
+	sample.left = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+	sample.right = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS;
+	Input::s_PendingCursorSamples.push_back(sample);
+
+	if (Input::s_PreviousCursorCallback) Input::s_PreviousCursorCallback(window, x, y);
+}
+
 GLFWwindow* Input::s_Window = nullptr;
 double Input::s_Px = 0, Input::s_Py = 0;
 double Input::s_Cx = 0, Input::s_Cy = 0;
 KeyState Input::s_MouseLeftPrevious = KeyState::Release, Input::s_MouseRightPrevious = KeyState::Release;
 KeyState Input::s_MouseLeftCurrent = KeyState::Release, Input::s_MouseRightCurrent = KeyState::Release;
+std::vector<CursorSample> Input::s_CursorSamples, Input::s_PendingCursorSamples;
+GLFWcursorposfun Input::s_PreviousCursorCallback = nullptr;
 
 void Input::Initialize(GLFWwindow* window) {
 	s_Window = window;
 	// Set the callback for the input helper.
 	glfwSetKeyCallback(window, InputKeyCallback);
+	s_PreviousCursorCallback = glfwSetCursorPosCallback(window, InputCursorCallback);
 
 	// Add a new mapping to the map of mappings.
 	KeyState* currentKeyStates = (KeyState*)malloc(sizeof(KeyState) * NUM_KEYS);
@@ -77,6 +97,10 @@ void Input::Update() {
 	s_Px = s_Cx, s_Py = s_Cy;
 	glfwGetCursorPos(s_Window, &s_Cx, &s_Cy);
 
+	// Hand the cursor samples received since the last update to the next frame.
+	s_CursorSamples.swap(s_PendingCursorSamples);
+	s_PendingCursorSamples.clear();
+
 	// Update mouse buttons.
 	s_MouseLeftPrevious = s_MouseLeftCurrent, s_MouseRightPrevious = s_MouseRightCurrent;
 
@@ -135,3 +159,7 @@ bool Input::MouseRightButtonClick() {
 	return (int)(s_MouseRightPrevious & KeyState::Pressed);
 }
 
+const std::vector<CursorSample>& Input::CursorSamples() {
+	return s_CursorSamples;
+}
+
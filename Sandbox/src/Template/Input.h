@@ -133,6 +133,18 @@ enum class KeyState : char {
 KeyState operator&(KeyState a, KeyState b);
 KeyState operator|(KeyState a, KeyState b);
 
+/*
+* Cursor position reported by the window system, with the time it was received.
+*/
+struct CursorSample {
+	/* Cursor position in window coordinates. */
+	glm::dvec2 position;
+	/* Time in seconds since glfw was initialized. */
+	double time;
+	/* Mouse button states when the sample was received. */
+	bool left, right;
+};
+
 class Input {
 
 public:
@@ -175,6 +187,11 @@ public:
 	static bool MouseLeftButtonClick();
 	static bool MouseRightButtonDown();
 	static bool MouseRightButtonClick();
+	/*
+	* Retrieves every cursor position received during the last frame, oldest first.
+	* @return				Cursor samples of the last frame.
+	*/
+	static const std::vector<CursorSample>& CursorSamples();
 
 private:
 	/*
@@ -198,6 +215,16 @@ private:
 	* Current mouse button states. 
 	*/
 	static KeyState s_MouseLeftCurrent, s_MouseRightCurrent;
+	/*
+	* Cursor samples of the last frame, and the samples received since.
+	*/
+	static std::vector<CursorSample> s_CursorSamples, s_PendingCursorSamples;
+	/*
+	* Cursor callback that was installed before ours, it is chained so ImGui keeps receiving the cursor.
+	*/
+	static GLFWcursorposfun s_PreviousCursorCallback;
+
+	friend void InputCursorCallback(GLFWwindow* window, double x, double y);
 };
 
 
@@ -204,6 +204,15 @@ void GLshader::SetBufferUint4(GLbuffer* buffer, uint idx, size_t stride) {
 	glDisableVertexAttribArray(idx);
 }
 
+void GLshader::SetBufferUshort2Normalized(GLbuffer* buffer, uint idx, size_t stride) {
+	glBindVertexArray(m_VAO);
+	glEnableVertexAttribArray(idx);
+	buffer->Bind();
+	glVertexAttribPointer(idx, 2, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)0);
+	glBindVertexArray(0);
+	glDisableVertexAttribArray(idx);
+}
+
 void GLshader::SetUniformFloat(const char* name, float val) {
 	glUseProgram(m_Program);
 	glUniform1f(glGetUniformLocation(m_Program, name), val);
@@ -269,6 +278,10 @@ void GLshader::DrawTriangles(size_t count, GLbuffer* indexBuffer, GLenum idxType
 	indexBuffer->Bind();									// Bind index buffer.
 	glDrawElements(GL_TRIANGLES, count, idxType, NULL);		// Draw call.
 }
+void GLshader::DrawPoints(size_t count) {
+
+	glDrawArrays(GL_POINTS, 0, count);						// Draw call.
+}
 
 #pragma endregion
 
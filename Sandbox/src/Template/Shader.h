@@ -73,6 +73,11 @@ public:
 	void SetBufferUint3(GLbuffer* buffer, uint idx, size_t stride = 0);
 	void SetBufferUint4(GLbuffer* buffer, uint idx, size_t stride = 0);
 
+	/*
+	* Binds pairs of 16-bit unsigned integers, normalized to [0, 1] in the shader.
+	*/
+	void SetBufferUshort2Normalized(GLbuffer* buffer, uint idx, size_t stride = 0);
+
 	void SetUniformFloat(const char* name, float val);
 	void SetUniformVec2(const char* name, glm::vec2 val);
 	void SetUniformVec3(const char* name, glm::vec3 val);
@@ -88,6 +93,10 @@ public:
 
 	void DrawLines(size_t count, GLbuffer* indexBuffer, GLenum idxType);
 	void DrawTriangles(size_t count, GLbuffer* indexBuffer, GLenum idxType);
+	/*
+	* Draws the first count vertices of the bound buffers as points, without an index buffer.
+	*/
+	void DrawPoints(size_t count);
 
 	static void Finish() { glFinish(); }
 